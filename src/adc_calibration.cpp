@@ -0,0 +1,157 @@
+#include "adc_calibration.h"
+#include "main.h"
+
+#ifdef ARDUINO
+#include "esp_adc/adc_cali.h"
+#include "esp_adc/adc_cali_scheme.h"
+#endif
+
+// Pin voltage per raw code in ADC_CAL_TABLE_UNIT steps, 8 kB for 12 bits
+static uint16_t pinTable[ADC_MAX_VALUE + 1];
+
+// Units per volt at the pin: shunt amplifier or voltage divider
+static const float channelScale[ADC_CH_COUNT] = {
+    1.0f / CURRENT_SENSE_RATIO,     // ADC_CH_I_SENSE1
+    1.0f / CURRENT_SENSE_RATIO,     // ADC_CH_I_SENSE2
+    VIN_SCALE_FACTOR,               // ADC_CH_VIN
+    VIN_SCALE_FACTOR,               // ADC_CH_VA
+    VIN_SCALE_FACTOR,               // ADC_CH_VB
+    VIN_SCALE_FACTOR                // ADC_CH_VC
+};
+
+// What the conversion applies: units per table step and units at code 0
+static float channelGain[ADC_CH_COUNT];
+static float channelOffset[ADC_CH_COUNT];
+
+static AdcCalibration calibration;
+
+static void updateChannels() {
+    for (int ch = 0; ch < ADC_CH_COUNT; ch++) {
+        channelGain[ch] = ADC_CAL_TABLE_UNIT * channelScale[ch];
+        channelOffset[ch] = calibration.offsetVolts[ch] * channelScale[ch];
+    }
+}
+
+static void fillNominalTable() {
+    for (uint32_t raw = 0; raw <= ADC_MAX_VALUE; raw++) {
+        pinTable[raw] = (uint16_t)(raw * ADC_REFERENCE / ADC_MAX_VALUE / ADC_CAL_TABLE_UNIT + 0.5f);
+    }
+}
+
+#ifdef ARDUINO
+
+static AdcCalScheme characterize() {
+    adc_cali_line_fitting_efuse_val_t efuse;
+    if (adc_cali_scheme_line_fitting_check_efuse(&efuse) != ESP_OK) return ADC_CAL_NOMINAL;
+
+    adc_cali_line_fitting_config_t config = {
+        .unit_id = ADC_UNIT_1,
+        .atten = ADC_ATTEN_DB_12,
+        .bitwidth = ADC_BITWIDTH_12,
+        .default_vref = ADC_CAL_DEFAULT_VREF
+    };
+    adc_cali_handle_t handle;
+    if (adc_cali_create_scheme_line_fitting(&config, &handle) != ESP_OK) return ADC_CAL_NOMINAL;
+
+    for (int raw = 0; raw <= ADC_MAX_VALUE; raw++) {
+        int millivolts = 0;
+        adc_cali_raw_to_voltage(handle, raw, &millivolts);
+        pinTable[raw] = (uint16_t)(millivolts * (1e-3f / ADC_CAL_TABLE_UNIT));
+    }
+    adc_cali_delete_scheme_line_fitting(handle);
+
+    switch (efuse) {
+        case ADC_CALI_LINE_FITTING_EFUSE_VAL_EFUSE_TP:
+            return ADC_CAL_EFUSE_TWO_POINT;
+        case ADC_CALI_LINE_FITTING_EFUSE_VAL_EFUSE_VREF:
+            return ADC_CAL_EFUSE_VREF;
+        default:
+            return ADC_CAL_DEFAULT_REF;
+    }
+}
+
+#else
+
+static AdcCalScheme characterize() {
+    return ADC_CAL_NOMINAL;
+}
+
+#endif
+
+// Table steps for an average of raw codes, interpolated
+static float averageToSteps(float raw) {
+    if (raw <= 0) return pinTable[0];
+    if (raw >= ADC_MAX_VALUE) return pinTable[ADC_MAX_VALUE];
+    uint16_t low = (uint16_t)raw;
+    float fraction = raw - low;
+    return pinTable[low] + fraction * (pinTable[low + 1] - pinTable[low]);
+}
+
+AdcCalScheme adcCalibrationBegin() {
+    fillNominalTable();
+    calibration.scheme = characterize();
+    updateChannels();
+    return calibration.scheme;
+}
+
+bool adcCalibrateOffsets() {
+    if (!adcSamplerRunning()) return false;
+
+    // DC_CAL shorts the amplifier inputs, the output is its offset alone
+    halDcCal(true);
+    delay(ADC_CAL_OFFSET_SETTLE_MS);
+
+    static const AdcChannel currentChannels[2] = {ADC_CH_I_SENSE1, ADC_CH_I_SENSE2};
+    float offsets[2];
+    bool complete = true;
+    for (int i = 0; i < 2; i++) {
+        // Only samples converted after the switch
+        uint32_t start = adcSamplerSequence(currentChannels[i]);
+        unsigned long startTime = millis();
+        while ((uint32_t)(adcSamplerSequence(currentChannels[i]) - start) < ADC_CAL_OFFSET_SAMPLES) {
+            if (millis() - startTime > ADC_CAL_OFFSET_TIMEOUT_MS) {
+                complete = false;
+                break;
+            }
+            delay(1);
+        }
+        float raw = adcSamplerAverage(currentChannels[i], ADC_CAL_OFFSET_SAMPLES);
+        offsets[i] = averageToSteps(raw) * ADC_CAL_TABLE_UNIT;
+    }
+    halDcCal(false);
+    if (!complete) return false;
+
+    for (int i = 0; i < 2; i++) {
+        calibration.offsetVolts[currentChannels[i]] = offsets[i];
+    }
+    calibration.offsetsValid = true;
+    updateChannels();
+    return true;
+}
+
+const AdcCalibration& adcCalibrationInfo() {
+    return calibration;
+}
+
+const char* adcCalSchemeName(AdcCalScheme scheme) {
+    switch (scheme) {
+        case ADC_CAL_EFUSE_VREF: return "eFuse Vref";
+        case ADC_CAL_EFUSE_TWO_POINT: return "eFuse two point";
+        case ADC_CAL_DEFAULT_REF: return "default Vref";
+        default: return "nominal";
+    }
+}
+
+float adcRawToUnits(AdcChannel channel, uint16_t raw) {
+    if (raw > ADC_MAX_VALUE) raw = ADC_MAX_VALUE;
+    return pinTable[raw] * channelGain[channel] - channelOffset[channel];
+}
+
+float adcAverageToUnits(AdcChannel channel, float raw) {
+    return averageToSteps(raw) * channelGain[channel] - channelOffset[channel];
+}
+
+float adcRawToPinVolts(uint16_t raw) {
+    if (raw > ADC_MAX_VALUE) raw = ADC_MAX_VALUE;
+    return pinTable[raw] * ADC_CAL_TABLE_UNIT;
+}
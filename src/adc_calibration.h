@@ -0,0 +1,53 @@
+#ifndef ADC_CALIBRATION_H
+#define ADC_CALIBRATION_H
+
+#include <stdint.h>
+#include "adc_sampler.h"
+
+// Raw ADC codes to amps and volts, the only place that knows the conversion.
+// All sense pins are on ADC1 at the same attenuation, so one
+// characterisation covers every channel: at boot the chip's eFuse
+// calibration (two point or reference voltage, including the ESP32's
+// correction of the bent top of the 11 dB range) is evaluated once for every
+// code into a table of pin voltages. Per channel only a scale (shunt
+// amplifier gain or divider ratio, fixed at compile time) and an offset
+// remain, the latter measured for the current amplifiers with DC_CAL
+// asserted. A conversion is then a table read and a multiply-add.
+// Without calibration data (and on the host) the table is the nominal line
+// from 0 to ADC_REFERENCE.
+
+#define ADC_CAL_TABLE_UNIT       1e-4f   // V per table step, 0.1 mV
+#define ADC_CAL_DEFAULT_VREF     1100    // mV, for chips without an eFuse reference
+#define ADC_CAL_OFFSET_SETTLE_MS 2       // amplifier settles after DC_CAL changes
+#define ADC_CAL_OFFSET_SAMPLES   64      // sampler samples averaged per offset
+#define ADC_CAL_OFFSET_TIMEOUT_MS 100
+
+enum AdcCalScheme {
+    ADC_CAL_NOMINAL = 0,        // no characterisation, straight line
+    ADC_CAL_EFUSE_VREF,         // eFuse reference voltage
+    ADC_CAL_EFUSE_TWO_POINT,    // eFuse two point values
+    ADC_CAL_DEFAULT_REF         // line fitting on ADC_CAL_DEFAULT_VREF
+};
+
+struct AdcCalibration {
+    AdcCalScheme scheme;
+    bool offsetsValid;                  // DC_CAL measurement done
+    float offsetVolts[ADC_CH_COUNT];    // pin voltage at zero current / zero volts
+};
+
+// Characterise ADC1 and fill the table, before the sampler starts
+AdcCalScheme adcCalibrationBegin();
+// Amplifier offsets of the current channels with DC_CAL asserted. Needs the
+// sampler running and the gate driver off, blocks for a few ms.
+bool adcCalibrateOffsets();
+const AdcCalibration& adcCalibrationInfo();
+const char* adcCalSchemeName(AdcCalScheme scheme);
+
+// Amps for the current channels, volts for the voltage channels
+float adcRawToUnits(AdcChannel channel, uint16_t raw);
+// Same for an average of raw codes, interpolated between table entries
+float adcAverageToUnits(AdcChannel channel, float raw);
+// Voltage at the pin
+float adcRawToPinVolts(uint16_t raw);
+
+#endif
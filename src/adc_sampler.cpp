@@ -0,0 +1,377 @@
+#include "adc_sampler.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include "main.h"
+#else
+#include "hal.h"
+#endif
+
+// One ring per channel. A single producer (the sampler task or the host pump)
+// writes the sample first and publishes it by advancing the head afterwards.
+struct AdcRing {
+    uint16_t samples[ADC_SAMPLER_RING_SIZE];
+    volatile uint32_t head;   // number of samples written so far
+};
+
+static AdcRing rings[ADC_CH_COUNT];
+static volatile bool samplerRunning = false;
+static uint32_t sampleRate = ADC_SAMPLER_SAMPLE_RATE;
+static uint8_t oversample = ADC_SAMPLER_OVERSAMPLE;
+static volatile AdcSampleTap sampleTap = nullptr;
+static volatile bool pwmSynced = false;
+static uint32_t syncedRate = 0;
+
+void adcSamplerPush(AdcChannel channel, uint16_t raw) {
+    AdcRing& ring = rings[channel];
+    uint32_t head = ring.head;
+    ring.samples[head & (ADC_SAMPLER_RING_SIZE - 1)] = raw;
+    ring.head = head + 1;
+}
+
+uint32_t adcSamplerSequence(AdcChannel channel) {
+    return rings[channel].head;
+}
+
+uint16_t adcSamplerLatest(AdcChannel channel) {
+    const AdcRing& ring = rings[channel];
+    uint32_t head = ring.head;
+    if (head == 0) return 0;
+    return ring.samples[(head - 1) & (ADC_SAMPLER_RING_SIZE - 1)];
+}
+
+uint16_t adcSamplerRawWindow(AdcChannel channel, uint16_t* out, uint16_t window) {
+    const AdcRing& ring = rings[channel];
+    uint32_t head = ring.head;
+
+    // Clamp to what has been written and keep half the ring as margin so the
+    // producer cannot overwrite the window while we copy it
+    uint32_t available = head < ADC_SAMPLER_RING_SIZE / 2 ? head : ADC_SAMPLER_RING_SIZE / 2;
+    if (window > available) window = available;
+
+    uint32_t start = head - window;
+    for (uint16_t i = 0; i < window; i++) {
+        out[i] = ring.samples[(start + i) & (ADC_SAMPLER_RING_SIZE - 1)];
+    }
+    return window;
+}
+
+bool adcSamplerStats(AdcChannel channel, uint16_t window, AdcWindowStats* stats) {
+    const AdcRing& ring = rings[channel];
+    uint32_t head = ring.head;
+
+    uint32_t available = head < ADC_SAMPLER_RING_SIZE / 2 ? head : ADC_SAMPLER_RING_SIZE / 2;
+    if (window > available) window = available;
+    if (window == 0) {
+        stats->average = 0;
+        stats->min = 0;
+        stats->max = 0;
+        stats->count = 0;
+        return false;
+    }
+
+    uint32_t sum = 0;
+    uint16_t minValue = 0xFFFF;
+    uint16_t maxValue = 0;
+    uint32_t start = head - window;
+    for (uint16_t i = 0; i < window; i++) {
+        uint16_t raw = ring.samples[(start + i) & (ADC_SAMPLER_RING_SIZE - 1)];
+        sum += raw;
+        if (raw < minValue) minValue = raw;
+        if (raw > maxValue) maxValue = raw;
+    }
+
+    stats->average = (float)sum / window;
+    stats->min = minValue;
+    stats->max = maxValue;
+    stats->count = window;
+    return true;
+}
+
+float adcSamplerAverage(AdcChannel channel, uint16_t window) {
+    AdcWindowStats stats;
+    adcSamplerStats(channel, window, &stats);
+    return stats.average;
+}
+
+bool adcSamplerRunning() {
+    return samplerRunning;
+}
+
+bool adcSamplerSetRate(uint32_t rate, uint8_t conversions) {
+    if (rate < ADC_SAMPLER_MIN_RATE || rate > ADC_SAMPLER_MAX_RATE || conversions == 0) return false;
+    if (rate == sampleRate && conversions == oversample) return true;
+
+    bool wasRunning = samplerRunning;
+    if (wasRunning) adcSamplerStop();
+    sampleRate = rate;
+    oversample = conversions;
+    if (wasRunning) return adcSamplerBegin();
+    return true;
+}
+
+uint32_t adcSamplerChannelRate() {
+    if (pwmSynced) return syncedRate;
+    return sampleRate / (ADC_CH_COUNT * oversample);
+}
+
+uint32_t adcSamplerConversionRate(AdcChannel channel) {
+    if (pwmSynced && channel >= ADC_CH_VIN) return syncedRate / (ADC_CH_COUNT - ADC_CH_VIN);
+    return adcSamplerChannelRate();
+}
+
+void adcSamplerSetTap(AdcSampleTap tap) {
+    sampleTap = tap;
+}
+
+static void pushSampleSet(const uint16_t* samples) {
+    for (int ch = 0; ch < ADC_CH_COUNT; ch++) {
+        adcSamplerPush((AdcChannel)ch, samples[ch]);
+    }
+    AdcSampleTap tap = sampleTap;
+    if (tap) tap(samples);
+}
+
+#ifdef ARDUINO
+
+#include "current_sense/hardware_specific/esp32/esp32_mcu.h"
+#include "drivers/hardware_specific/esp32/esp32_driver_mcpwm.h"
+#include "drivers/hardware_specific/esp32/mcpwm_private.h"
+#include "hal/mcpwm_ll.h"
+
+// ESP32 backend: ADC digital controller in continuous (DMA) mode.
+// All sense pins are on ADC1, which is the only unit usable in this mode.
+static const uint8_t samplerPins[ADC_CH_COUNT] = {
+    PIN_I_SENSE1, PIN_I_SENSE2, PIN_VIN_SENSE,
+    PIN_VA_SENSE, PIN_VB_SENSE, PIN_VC_SENSE
+};
+
+static TaskHandle_t samplerTask = nullptr;
+
+// Called from the ADC ISR whenever a DMA frame is complete
+static void ARDUINO_ISR_ATTR onAdcFrame() {
+    BaseType_t woken = pdFALSE;
+    if (samplerTask) {
+        vTaskNotifyGiveFromISR(samplerTask, &woken);
+    }
+    portYIELD_FROM_ISR(woken);
+}
+
+static void samplerTaskLoop(void* arg) {
+    adc_continuous_data_t* frame = nullptr;
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (!samplerRunning) continue;
+
+        if (analogContinuousRead(&frame, 0)) {
+            // Frame entries are in the same order as samplerPins
+            uint16_t samples[ADC_CH_COUNT];
+            for (int ch = 0; ch < ADC_CH_COUNT; ch++) {
+                samples[ch] = (uint16_t)frame[ch].avg_read_raw;
+            }
+            pushSampleSet(samples);
+        }
+    }
+}
+
+bool adcSamplerBegin() {
+    if (samplerRunning) return true;
+    if (pwmSynced) {
+        // The control loop delivers
+        samplerRunning = true;
+        return true;
+    }
+
+    analogContinuousSetWidth(ADC_BITS);
+    analogContinuousSetAtten(ADC_11db);
+
+    if (!samplerTask) {
+        xTaskCreatePinnedToCore(samplerTaskLoop, "adc_sampler", 3072, nullptr, 5, &samplerTask, 0);
+    }
+
+    if (!analogContinuous(samplerPins, ADC_CH_COUNT, oversample, sampleRate, &onAdcFrame)) {
+        Serial.println("ADC sampler: failed to configure continuous mode");
+        return false;
+    }
+
+    samplerRunning = analogContinuousStart();
+    return samplerRunning;
+}
+
+void adcSamplerStop() {
+    if (!samplerRunning) return;
+    samplerRunning = false;
+    if (pwmSynced) return;
+    analogContinuousStop();
+    analogContinuousDeinit();
+}
+
+uint16_t adcSamplerBurst(AdcChannel channel, uint16_t* raw, uint32_t* tUs, uint16_t count, uint32_t spacingUs) {
+    // One-shot reads would collide with the valley interrupt
+    if (pwmSynced) return 0;
+
+    // The pins cannot be read one-shot while continuous mode owns them
+    bool wasRunning = samplerRunning;
+    if (wasRunning) adcSamplerStop();
+
+    uint8_t pin = samplerPins[channel];
+    analogReadResolution(ADC_BITS);
+    analogSetPinAttenuation(pin, ADC_11db);
+
+    uint32_t start = micros();
+    for (uint16_t i = 0; i < count; i++) {
+        if (spacingUs) {
+            while (micros() - start < i * spacingUs) {}
+        }
+        // Timestamp the middle of the conversion
+        uint32_t before = micros();
+        raw[i] = analogRead(pin);
+        uint32_t after = micros();
+        tUs[i] = (before - start) + (after - before) / 2;
+    }
+
+    if (wasRunning) adcSamplerBegin();
+    return count;
+}
+
+// Taken by the control loop around its copy of the samples and by the hand
+// over. It also masks the valley interrupt, which runs on the same core.
+static portMUX_TYPE syncedMux = portMUX_INITIALIZER_UNLOCKED;
+static uint16_t syncedSamples[ADC_CH_COUNT];
+static uint8_t nextVoltage = ADC_CH_VIN;
+static volatile bool syncedConverting = false;  // a tick converts a voltage
+
+static void setValleyInterrupt(bool enable) {
+    ESP32MCPWMDriverParams* params = (ESP32MCPWMDriverParams*)driver.params;
+    mcpwm_timer_t* timer = (mcpwm_timer_t*)params->timers[0];
+    portENTER_CRITICAL(&timer->group->spinlock);
+    mcpwm_ll_intr_enable(timer->group->hal.dev, MCPWM_LL_EVENT_TIMER_FULL(timer->timer_id), enable);
+    portEXIT_CRITICAL(&timer->group->spinlock);
+}
+
+bool adcSamplerSyncToPwm(bool sync, uint32_t tickRateHz) {
+    if (sync == pwmSynced) return true;
+    if (sync && !currentSense.initialized) return false;
+
+    bool wasRunning = samplerRunning;
+    if (sync) {
+        adcSamplerStop();
+        // Back to the RTC controller, which the valley interrupt converts with
+        for (int ch = 0; ch < ADC_CH_COUNT; ch++) {
+            adcInit(samplerPins[ch]);
+        }
+        setValleyInterrupt(true);
+        for (int ch = 0; ch < ADC_CH_COUNT; ch++) {
+            syncedSamples[ch] = adcSamplerLatest((AdcChannel)ch);
+        }
+        portENTER_CRITICAL(&syncedMux);
+        syncedRate = tickRateHz;
+        pwmSynced = true;
+        portEXIT_CRITICAL(&syncedMux);
+        samplerRunning = wasRunning;
+        return true;
+    }
+
+    // No tick starts a conversion after this, then let a started tick and a
+    // started valley conversion end
+    portENTER_CRITICAL(&syncedMux);
+    pwmSynced = false;
+    portEXIT_CRITICAL(&syncedMux);
+    while (syncedConverting) delay(1);
+    setValleyInterrupt(false);
+    delayMicroseconds(ADC_SAMPLER_VALLEY_US);
+    samplerRunning = false;
+    return wasRunning ? adcSamplerBegin() : true;
+}
+
+bool adcSamplerSyncedToPwm() {
+    return pwmSynced;
+}
+
+void adcSamplerSyncedTick() {
+    const ESP32CurrentSenseParams* params = (const ESP32CurrentSenseParams*)currentSense.params;
+    uint8_t channel = nextVoltage;
+
+    portENTER_CRITICAL(&syncedMux);
+    bool synced = pwmSynced && samplerRunning;
+    syncedConverting = synced;
+    portEXIT_CRITICAL(&syncedMux);
+    if (!synced) return;
+
+    // Converted with interrupts enabled. A valley interrupt in between starts
+    // its own conversion on the same ADC and leaves us its result, which
+    // shows as a step of its buffer index: convert again, the next valley is
+    // a PWM period away. After the last attempt the old value repeats.
+    const volatile int* valleyIndex = &params->buffer_index;
+    uint16_t voltage = 0;
+    bool converted = false;
+    for (int attempt = 0; attempt < ADC_SAMPLER_SYNCED_ATTEMPTS && !converted; attempt++) {
+        int before = *valleyIndex;
+        voltage = adcRead(samplerPins[channel]);
+        converted = *valleyIndex == before;
+    }
+
+    portENTER_CRITICAL(&syncedMux);
+    // Shunts in the order they were given to the current sense
+    syncedSamples[ADC_CH_I_SENSE1] = (uint16_t)params->adc_buffer[0];
+    syncedSamples[ADC_CH_I_SENSE2] = (uint16_t)params->adc_buffer[1];
+    if (converted) syncedSamples[channel] = voltage;
+    syncedConverting = false;
+    portEXIT_CRITICAL(&syncedMux);
+
+    nextVoltage = channel == ADC_CH_VC ? ADC_CH_VIN : channel + 1;
+    pushSampleSet(syncedSamples);
+}
+
+#else
+
+// Host backend: samples are generated on demand from a synthetic source
+static AdcSyntheticSource syntheticSource = nullptr;
+static uint32_t syntheticIndex = 0;
+
+void adcSamplerSetSyntheticSource(AdcSyntheticSource source) {
+    syntheticSource = source;
+}
+
+void adcSamplerPump(uint32_t samplesPerChannel) {
+    if (!samplerRunning || !syntheticSource) return;
+
+    for (uint32_t n = 0; n < samplesPerChannel; n++) {
+        uint16_t samples[ADC_CH_COUNT];
+        for (int ch = 0; ch < ADC_CH_COUNT; ch++) {
+            samples[ch] = syntheticSource((AdcChannel)ch, syntheticIndex);
+        }
+        pushSampleSet(samples);
+        syntheticIndex++;
+    }
+}
+
+uint16_t adcSamplerBurst(AdcChannel channel, uint16_t* raw, uint32_t* tUs, uint16_t count, uint32_t spacingUs) {
+    if (!syntheticSource) return 0;
+
+    // Sample on the HAL clock so simulated plants move between samples
+    uint32_t spacing = spacingUs ? spacingUs : ADC_SAMPLER_HOST_BURST_US;
+    uint32_t start = halMicros();
+    for (uint16_t i = 0; i < count; i++) {
+        tUs[i] = halMicros() - start;
+        raw[i] = syntheticSource(channel, i);
+        halDelayUs(spacing);
+    }
+    return count;
+}
+
+bool adcSamplerBegin() {
+    for (int ch = 0; ch < ADC_CH_COUNT; ch++) {
+        rings[ch].head = 0;
+    }
+    syntheticIndex = 0;
+    samplerRunning = true;
+    return true;
+}
+
+void adcSamplerStop() {
+    samplerRunning = false;
+}
+
+#endif
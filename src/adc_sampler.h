@@ -0,0 +1,100 @@
+#ifndef ADC_SAMPLER_H
+#define ADC_SAMPLER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Continuous background sampling of the analog channels.
+// On the ESP32 the ADC digital controller converts all channels via DMA and a
+// low priority task copies the frames into one ring buffer per channel.
+// While FOC drives the motor ADC1 belongs to the PWM synchronised current
+// sense instead and the control loop feeds the rings (see below).
+// Readers never block: they only look at the most recent samples in the ring.
+
+#define ADC_SAMPLER_RING_SIZE     256    // samples kept per channel (power of two)
+#define ADC_SAMPLER_SAMPLE_RATE   48000  // total conversions per second (all channels)
+#define ADC_SAMPLER_OVERSAMPLE    4      // conversions averaged into one ring sample
+#define ADC_SAMPLER_HOST_BURST_US 10     // sample spacing of host bursts
+#define ADC_SAMPLER_MIN_RATE      20000  // conversion rate limits of continuous mode,
+#define ADC_SAMPLER_MAX_RATE      96000  // the task wakes up once per set of channels
+#define ADC_SAMPLER_VALLEY_US     20     // longest valley interrupt conversion, ESP32
+#define ADC_SAMPLER_SYNCED_ATTEMPTS 2    // voltage conversions per synced tick a valley may spoil
+
+enum AdcChannel {
+    ADC_CH_I_SENSE1 = 0,   // PIN_I_SENSE1
+    ADC_CH_I_SENSE2,       // PIN_I_SENSE2
+    ADC_CH_VIN,            // PIN_VIN_SENSE
+    ADC_CH_VA,             // PIN_VA_SENSE
+    ADC_CH_VB,             // PIN_VB_SENSE
+    ADC_CH_VC,             // PIN_VC_SENSE
+    ADC_CH_COUNT
+};
+
+struct AdcWindowStats {
+    float average;      // mean raw value over the window
+    uint16_t min;       // smallest raw value in the window
+    uint16_t max;       // largest raw value in the window
+    uint16_t count;     // number of samples actually used
+};
+
+// Start/stop the background conversion
+bool adcSamplerBegin();
+void adcSamplerStop();
+bool adcSamplerRunning();
+
+// Change the conversion rate (all channels) and oversampling, restarts the
+// conversion if it is running. Returns false for out of range settings.
+bool adcSamplerSetRate(uint32_t sampleRate, uint8_t oversample);
+// Ring samples per second on every channel at the current settings
+uint32_t adcSamplerChannelRate();
+// New conversions per second of one channel. Below adcSamplerChannelRate()
+// for the voltages while synced to the PWM, where they take turns.
+uint32_t adcSamplerConversionRate(AdcChannel channel);
+
+// Optional consumer of every new set of samples (one value per AdcChannel),
+// called from the sampler task right after the rings were updated
+typedef void (*AdcSampleTap)(const uint16_t* samples);
+void adcSamplerSetTap(AdcSampleTap tap);
+
+// Producer side, called by the backend for every new sample
+void adcSamplerPush(AdcChannel channel, uint16_t raw);
+
+// Non-blocking readers. "window" is the number of most recent samples to use
+// and is clamped to the number of samples available.
+bool adcSamplerStats(AdcChannel channel, uint16_t window, AdcWindowStats* stats);
+float adcSamplerAverage(AdcChannel channel, uint16_t window);
+uint16_t adcSamplerLatest(AdcChannel channel);
+uint16_t adcSamplerRawWindow(AdcChannel channel, uint16_t* out, uint16_t window);
+
+// Short high-rate capture of a single channel with microsecond timestamps
+// relative to the start of the burst. Continuous sampling is suspended while
+// the burst runs. spacingUs enforces a minimum time between samples.
+uint16_t adcSamplerBurst(AdcChannel channel, uint16_t* raw, uint32_t* tUs, uint16_t count, uint32_t spacingUs = 0);
+
+// Total number of samples pushed to a channel since start (wraps)
+uint32_t adcSamplerSequence(AdcChannel channel);
+
+#ifdef ARDUINO
+// ADC1 serves either the continuous conversion or SimpleFOC's low side
+// current sense, which converts the shunts in the MCPWM interrupt at the
+// middle of the low side on time. Both cannot run at once. While synced, the
+// continuous conversion is stopped and adcSamplerSyncedTick(), called by the
+// control loop, pushes one sample set per iteration: both shunts from the
+// last PWM valley and one voltage channel converted in turn (the others
+// repeat). The channel rate is then tickRateHz and every voltage is new at
+// a quarter of it. Rate settings have no effect meanwhile and are kept for
+// later. Switching to synced fails without an initialised current sense.
+bool adcSamplerSyncToPwm(bool sync, uint32_t tickRateHz);
+bool adcSamplerSyncedToPwm();
+void adcSamplerSyncedTick();
+#endif
+
+#ifndef ARDUINO
+// Host build: samples come from a synthetic source instead of the ADC.
+// adcSamplerPump() generates the given number of samples on every channel.
+typedef uint16_t (*AdcSyntheticSource)(AdcChannel channel, uint32_t index);
+void adcSamplerSetSyntheticSource(AdcSyntheticSource source);
+void adcSamplerPump(uint32_t samplesPerChannel);
+#endif
+
+#endif
@@ -0,0 +1,97 @@
+#include "back_emf.h"
+#include <math.h>
+#include <string.h>
+
+#define BEMF_TWO_PI     6.28318531f
+#define BEMF_SQRT3      1.73205081f
+
+void backEmfBegin(BackEmfCapture* capture) {
+    memset(capture, 0, sizeof(*capture));
+}
+
+void backEmfAddEdge(BackEmfCapture* capture, uint32_t timestampUs, bool clean) {
+    // A turn starts on a clean edge and ends six clean edges later
+    if (!clean || !capture->started) {
+        capture->started = clean;
+        capture->turnStartUs = timestampUs;
+        capture->edgesInTurn = 0;
+        return;
+    }
+    if (++capture->edgesInTurn < 6) return;
+
+    if (capture->turnCount < BEMF_MAX_TURNS) {
+        BackEmfTurn& turn = capture->turns[capture->turnCount++];
+        turn.startUs = capture->turnStartUs;
+        turn.endUs = timestampUs;
+        turn.amplitudeSum = 0;
+        turn.samples = 0;
+    }
+    capture->turnStartUs = timestampUs;
+    capture->edgesInTurn = 0;
+}
+
+void backEmfAddSamples(BackEmfCapture* capture, const float* abc, uint16_t sets,
+                       float startUs, float periodUs) {
+    for (uint16_t k = 0; k < sets; k++) {
+        uint32_t t = (uint32_t)(startUs + k * periodUs);
+        while (capture->nextTurn < capture->turnCount &&
+               (int32_t)(t - capture->turns[capture->nextTurn].endUs) >= 0) {
+            capture->nextTurn++;
+        }
+        if (capture->nextTurn >= capture->turnCount) return;
+        BackEmfTurn& turn = capture->turns[capture->nextTurn];
+        if ((int32_t)(t - turn.startUs) < 0) continue;
+
+        // Phase voltages from the line to line ones (they sum to zero),
+        // then the length of their space vector
+        const float* v = &abc[3 * k];
+        float vab = v[0] - v[1];
+        float vbc = v[1] - v[2];
+        float ea = (2 * vab + vbc) / 3;
+        float eb = ea - vab;
+        float beta = (ea + 2 * eb) / BEMF_SQRT3;
+        turn.amplitudeSum += sqrtf(ea * ea + beta * beta);
+        turn.samples++;
+    }
+}
+
+bool fitBackEmf(const BackEmfCapture* capture, int polePairs, BackEmfFit* fit) {
+    memset(fit, 0, sizeof(*fit));
+
+    // Amplitude = keElectrical * speed, least squares through the origin
+    float sumXY = 0, sumXX = 0, sumY = 0;
+    uint16_t used = 0;
+    for (uint16_t i = 0; i < capture->turnCount; i++) {
+        const BackEmfTurn& turn = capture->turns[i];
+        if (turn.samples < BEMF_MIN_SAMPLES || turn.endUs == turn.startUs) continue;
+        float hz = 1e6f / (turn.endUs - turn.startUs);
+        float speed = BEMF_TWO_PI * hz;
+        float amplitude = turn.amplitudeSum / turn.samples;
+        sumXY += speed * amplitude;
+        sumXX += speed * speed;
+        sumY += amplitude;
+        if (used == 0 || hz < fit->minSpeedHz) fit->minSpeedHz = hz;
+        if (hz > fit->maxSpeedHz) fit->maxSpeedHz = hz;
+        used++;
+    }
+    fit->turns = used;
+    if (used < BEMF_MIN_TURNS || sumXX <= 0 || sumY <= 0) return false;
+    fit->keElectrical = sumXY / sumXX;
+
+    float sumError = 0;
+    for (uint16_t i = 0; i < capture->turnCount; i++) {
+        const BackEmfTurn& turn = capture->turns[i];
+        if (turn.samples < BEMF_MIN_SAMPLES || turn.endUs == turn.startUs) continue;
+        float speed = BEMF_TWO_PI * 1e6f / (turn.endUs - turn.startUs);
+        float error = turn.amplitudeSum / turn.samples - fit->keElectrical * speed;
+        sumError += error * error;
+    }
+    fit->residual = sqrtf(sumError / used) / (sumY / used);
+
+    if (polePairs > 0) {
+        fit->ke = BEMF_SQRT3 * fit->keElectrical * polePairs;
+        fit->kv = 60.0f / (BEMF_TWO_PI * fit->ke);
+    }
+    fit->valid = fit->residual <= BEMF_MAX_RESIDUAL;
+    return fit->valid;
+}
@@ -0,0 +1,61 @@
+#ifndef BACK_EMF_H
+#define BACK_EMF_H
+
+#include <stdint.h>
+
+// Back-EMF constant from a coast-down. With the bridge off the terminals
+// float and carry only the back-EMF. The three terminal voltages give the
+// line to line voltages, and from those the back-EMF space vector, whose
+// length is the phase peak amplitude at every sample: no zero crossings to
+// wait for and no neutral point needed. Hall edges give the electrical
+// speed. Amplitude is proportional to speed, so a line through the origin
+// over the slowing rotor gives Ke. Kept free of Arduino dependencies so the
+// fit can be checked on the host.
+//
+// Speed is taken per full electrical turn (six clean edges), which cancels
+// the sector width errors of misplaced hall sensors.
+
+#define BEMF_MAX_TURNS     256     // electrical turns kept, later ones are ignored
+#define BEMF_MIN_TURNS     4       // turns with samples needed for a fit
+#define BEMF_MIN_SAMPLES   3       // samples per turn for its amplitude
+#define BEMF_MAX_RESIDUAL  0.10f   // rms fit error relative to the mean amplitude
+
+struct BackEmfTurn {
+    uint32_t startUs;
+    uint32_t endUs;
+    float amplitudeSum;     // V, phase peak
+    uint16_t samples;
+};
+
+struct BackEmfCapture {
+    BackEmfTurn turns[BEMF_MAX_TURNS];
+    uint16_t turnCount;
+    uint8_t edgesInTurn;    // clean edges since the current turn started
+    bool started;
+    uint32_t turnStartUs;
+    uint16_t nextTurn;      // sample bookkeeping, samples arrive in time order
+};
+
+struct BackEmfFit {
+    bool valid;
+    float keElectrical;     // V s/rad, phase peak per electrical rad/s
+    float ke;               // V s/rad, line to line peak per mechanical rad/s
+    float kv;               // RPM/V, 60 / (2 pi ke): no-load speed per volt of bus
+    float residual;         // rms error relative to the mean amplitude
+    uint16_t turns;         // electrical turns in the fit
+    float minSpeedHz;       // electrical speed range of the coast-down
+    float maxSpeedHz;
+};
+
+void backEmfBegin(BackEmfCapture* capture);
+// Every hall edge in order; an unclean one (glitch, skipped sector) drops
+// the turn it falls in
+void backEmfAddEdge(BackEmfCapture* capture, uint32_t timestampUs, bool clean);
+// Interleaved terminal voltages va, vb, vc (V) of sets sample sets, the
+// first at startUs, periodUs apart. Call in time order.
+void backEmfAddSamples(BackEmfCapture* capture, const float* abc, uint16_t sets,
+                       float startUs, float periodUs);
+// polePairs <= 0 only gives keElectrical
+bool fitBackEmf(const BackEmfCapture* capture, int polePairs, BackEmfFit* fit);
+
+#endif
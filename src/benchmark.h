@@ -0,0 +1,22 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+// Micro benchmarks of the per sample kernels: ADC averaging and conversion,
+// hall decoding, telemetry serialization and the control sample ring. Only
+// built with -DBENCHMARK_MODE, either natively against the simulated HAL
+// (env:native_bench) or on the ESP32 before the normal startup
+// (env:esp32_bench).
+//
+// Every result is printed as one JSON object per line:
+//   {"bench":"getCurrentReading","target":"host","iterations":20000,"nsPerOp":12.5,"cyclesPerOp":null}
+// nsPerOp is the best of BENCHMARK_REPEATS runs. cyclesPerOp comes from
+// ESP.getCycleCount() and is only known on target.
+
+#define BENCHMARK_ITERATIONS  20000
+#define BENCHMARK_REPEATS     5
+
+typedef void (*BenchmarkPrint)(const char* line);
+
+void runBenchmarks(BenchmarkPrint print);
+
+#endif
@@ -0,0 +1,168 @@
+#include "control_loop.h"
+#include "main.h"
+#include "adc_sampler.h"
+
+static hw_timer_t* focTimer = nullptr;
+static TaskHandle_t focTask = nullptr;
+static portMUX_TYPE statsMux = portMUX_INITIALIZER_UNLOCKED;
+
+static ControlLoopStats stats = {FOC_LOOP_RATE_HZ, 0, 0, 0, 0, 0};
+static volatile uint32_t periodUs = 1000000 / FOC_LOOP_RATE_HZ;
+static volatile bool holdRequested = false;
+static SpscRing<ControlSample, CONTROL_SAMPLE_RING_SIZE, SPSC_OVERWRITE_OLDEST> controlSamples;
+
+// Step capture, buffer is only touched by the control task until done
+static float* volatile captureBuffer = nullptr;
+static volatile uint16_t captureCount = 0;
+static volatile uint16_t captureIndex = 0;
+static uint16_t captureStep = 0;
+static float captureTarget = 0;
+
+// Hardware timer ISR: only releases the control task
+static void ARDUINO_ISR_ATTR onFocTimer() {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(focTask, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+static void focTaskLoop(void* arg) {
+    int64_t lastStart = 0;
+    int64_t windowStart = esp_timer_get_time();
+    uint32_t windowCount = 0;
+    uint32_t decimation = 0;
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        int64_t start = esp_timer_get_time();
+
+        // Measurements and the direct drive steps of a test hold the loop,
+        // the rotation steps of a test run through it
+        if (!isMeasuring && !holdRequested) {
+            bool capturing = captureBuffer && captureIndex < captureCount;
+            if (capturing && captureIndex == captureStep) motor.target = captureTarget;
+            motor.loopFOC();
+            // Velocity and angle loops, or the torque target straight through
+            motor.move();
+            if (capturing) {
+                captureBuffer[captureIndex] = motor.current.q;
+                captureIndex = captureIndex + 1;
+            }
+        }
+        // Shunt currents of the last PWM valley and one voltage to the
+        // sampler, only while the current sense owns the ADC
+        adcSamplerSyncedTick();
+
+        // Hand a sample to the network side, lock and allocation free
+        if (++decimation >= CONTROL_SAMPLE_DECIMATION) {
+            decimation = 0;
+            ControlSample sample = {
+                (uint32_t)start,
+                motor.shaft_velocity,
+                motor.electrical_angle,
+                motor.voltage.q,
+                motor.voltage.d,
+                motor.current.q,
+                motor.current.d
+            };
+            controlSamples.push(sample);
+        }
+
+        int64_t end = esp_timer_get_time();
+        uint32_t period = periodUs;
+        uint32_t execUs = (uint32_t)(end - start);
+        uint32_t jitterUs = 0;
+        bool overrun = false;
+        if (lastStart != 0) {
+            int64_t delta = start - lastStart - period;
+            jitterUs = (uint32_t)(delta < 0 ? -delta : delta);
+            overrun = delta > (int64_t)period;
+        }
+        lastStart = start;
+        windowCount++;
+
+        portENTER_CRITICAL(&statsMux);
+        stats.iterations++;
+        if (jitterUs > stats.maxJitterUs) stats.maxJitterUs = jitterUs;
+        if (execUs > stats.maxExecUs) stats.maxExecUs = execUs;
+        if (overrun) stats.overruns++;
+        if (end - windowStart >= 1000000) {
+            stats.measuredRateHz = windowCount * 1000000.0f / (float)(end - windowStart);
+            windowStart = end;
+            windowCount = 0;
+        }
+        portEXIT_CRITICAL(&statsMux);
+    }
+}
+
+bool controlLoopBegin(uint32_t rateHz) {
+    if (focTask) return controlLoopSetRate(rateHz);
+
+    xTaskCreatePinnedToCore(focTaskLoop, "foc", 4096, nullptr, FOC_TASK_PRIORITY, &focTask, FOC_TASK_CORE);
+    if (!focTask) return false;
+
+    // 1 MHz timer base so the alarm value is the period in microseconds
+    focTimer = timerBegin(1000000);
+    if (!focTimer) return false;
+    timerAttachInterrupt(focTimer, &onFocTimer);
+    return controlLoopSetRate(rateHz);
+}
+
+bool controlLoopSetRate(uint32_t rateHz) {
+    if (!focTimer) return false;
+    rateHz = constrain(rateHz, FOC_LOOP_MIN_RATE_HZ, FOC_LOOP_MAX_RATE_HZ);
+    periodUs = 1000000 / rateHz;
+    timerAlarm(focTimer, periodUs, true, 0);
+
+    portENTER_CRITICAL(&statsMux);
+    stats.rateHz = rateHz;
+    portEXIT_CRITICAL(&statsMux);
+    resetControlLoopStats();
+    return true;
+}
+
+void controlLoopHold(bool hold) {
+    holdRequested = hold;
+}
+
+bool controlLoopStepCapture(float target, uint16_t preSamples, float* buffer, uint16_t count) {
+    if (!controlLoopCaptureDone() || preSamples >= count) return false;
+    captureBuffer = nullptr;
+    captureStep = preSamples;
+    captureTarget = target;
+    captureCount = count;
+    captureIndex = 0;
+    // Armed last, the control task sees a complete setup
+    captureBuffer = buffer;
+    return true;
+}
+
+bool controlLoopCaptureDone() {
+    return !captureBuffer || captureIndex >= captureCount;
+}
+
+ControlLoopStats getControlLoopStats() {
+    portENTER_CRITICAL(&statsMux);
+    ControlLoopStats copy = stats;
+    portEXIT_CRITICAL(&statsMux);
+    return copy;
+}
+
+void resetControlLoopStats() {
+    portENTER_CRITICAL(&statsMux);
+    stats.maxJitterUs = 0;
+    stats.maxExecUs = 0;
+    stats.overruns = 0;
+    portEXIT_CRITICAL(&statsMux);
+}
+
+size_t drainControlSamples(ControlSample* out, size_t max) {
+    return controlSamples.popBatch(out, max);
+}
+
+uint32_t controlSampleOverruns() {
+    return controlSamples.overruns();
+}
+
+uint32_t controlSamplePeriodUs() {
+    return periodUs * CONTROL_SAMPLE_DECIMATION;
+}
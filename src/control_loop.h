@@ -0,0 +1,58 @@
+#ifndef CONTROL_LOOP_H
+#define CONTROL_LOOP_H
+
+#include <Arduino.h>
+#include "spsc_ring.h"
+
+// FOC control loop running in its own task on core 1, released by a hardware
+// timer at a fixed rate. Monitoring and networking stay on core 0.
+
+#define FOC_LOOP_RATE_HZ     10000   // default control rate
+#define FOC_LOOP_MIN_RATE_HZ 1000
+#define FOC_LOOP_MAX_RATE_HZ 20000
+#define FOC_TASK_CORE        1
+#define FOC_TASK_PRIORITY    (configMAX_PRIORITIES - 1)
+
+// Motor state samples handed from the control task to the network side
+#define CONTROL_SAMPLE_DECIMATION  10    // one sample every N loop iterations
+#define CONTROL_SAMPLE_RING_SIZE   256   // power of two
+
+struct ControlLoopStats {
+    uint32_t rateHz;          // configured rate
+    float measuredRateHz;     // iterations over the last second
+    uint32_t maxJitterUs;     // worst deviation from the nominal period
+    uint32_t maxExecUs;       // longest single iteration
+    uint32_t overruns;        // iterations that started more than one period late
+    uint32_t iterations;      // total iterations since start
+};
+
+struct ControlSample {
+    uint32_t timestampUs;
+    float velocity;           // shaft velocity (rad/s)
+    float electricalAngle;    // rad
+    float voltageQ;           // V
+    float voltageD;           // V
+    float currentQ;           // A, measured in foc_current mode only
+    float currentD;           // A
+};
+
+bool controlLoopBegin(uint32_t rateHz = FOC_LOOP_RATE_HZ);
+bool controlLoopSetRate(uint32_t rateHz);
+// Temporarily skip loopFOC() while another module drives the bridge directly
+void controlLoopHold(bool hold);
+ControlLoopStats getControlLoopStats();
+void resetControlLoopStats();
+
+// One-shot capture of the q current at the full loop rate. The control
+// task sets motor.target to target after preSamples iterations, so the
+// step lands on a known sample. Returns false while a capture is running.
+bool controlLoopStepCapture(float target, uint16_t preSamples, float* buffer, uint16_t count);
+bool controlLoopCaptureDone();
+
+// Consumer side of the sample ring, never blocks the control task. Samples
+// the consumer was too slow for are overwritten and counted as overruns.
+size_t drainControlSamples(ControlSample* out, size_t max);
+uint32_t controlSampleOverruns();
+uint32_t controlSamplePeriodUs();
+
+#endif
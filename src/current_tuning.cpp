@@ -0,0 +1,25 @@
+#include "current_tuning.h"
+
+#define TUNING_TWO_PI  6.28318531f
+#define TUNING_RISE_TAUS  2.1972246f   // ln(9), 10 to 90 % of a first order rise
+
+CurrentLoopGains synthesizeCurrentGains(float resistance, float inductance, float loopRateHz,
+                                        float bandwidthHz) {
+    CurrentLoopGains gains = {false, 0, 0, 0, 0, 0};
+    if (resistance <= 0 || inductance <= 0 || loopRateHz <= 0) return gains;
+    float tau = inductance / resistance;
+    if (tau < CURRENT_LOOP_MIN_TAU_S || tau > CURRENT_LOOP_MAX_TAU_S) return gains;
+
+    float maxBandwidth = loopRateHz * CURRENT_LOOP_BANDWIDTH_RATIO;
+    if (bandwidthHz <= 0 || bandwidthHz > maxBandwidth) bandwidthHz = maxBandwidth;
+    if (bandwidthHz < CURRENT_LOOP_MIN_BANDWIDTH_HZ) bandwidthHz = CURRENT_LOOP_MIN_BANDWIDTH_HZ;
+
+    float wc = TUNING_TWO_PI * bandwidthHz;
+    gains.valid = true;
+    gains.kp = inductance * wc;
+    gains.ki = resistance * wc;
+    gains.bandwidthHz = bandwidthHz;
+    gains.filterTf = 1.0f / (CURRENT_LOOP_FILTER_RATIO * wc);
+    gains.riseTimeUs = TUNING_RISE_TAUS / wc * 1e6f;
+    return gains;
+}
@@ -0,0 +1,38 @@
+#ifndef CURRENT_TUNING_H
+#define CURRENT_TUNING_H
+
+#include <stdint.h>
+
+// Current loop PI gains from the measured phase resistance and inductance.
+// Each axis sees the phase as R + sL, the PI zero Ki / Kp is put on the
+// electrical pole R / L so the two cancel and the closed loop is first order
+// at the chosen bandwidth wc:
+//   Kp = L * wc    (V/A)
+//   Ki = R * wc    (V/A/s, SimpleFOC's I gain)
+// The sample and PWM delay of about one and a half loop periods bounds wc:
+// at a twentieth of the loop rate it costs some 30 degrees of phase margin.
+// The current filter sits a few times above wc so it adds little lag.
+// Kept free of Arduino dependencies so it can be checked on the host.
+
+#define CURRENT_LOOP_BANDWIDTH_RATIO  0.05f   // default and largest bandwidth, of the loop rate
+#define CURRENT_LOOP_MIN_BANDWIDTH_HZ 10.0f
+#define CURRENT_LOOP_FILTER_RATIO     5.0f    // filter corner over the bandwidth
+// L / R outside this span is a failed measurement rather than a motor, the
+// gains would cancel a pole that is not there
+#define CURRENT_LOOP_MIN_TAU_S        5e-6f
+#define CURRENT_LOOP_MAX_TAU_S        0.2f
+
+struct CurrentLoopGains {
+    bool valid;             // R and L known and L / R plausible
+    float kp;               // V/A
+    float ki;               // V/A/s
+    float bandwidthHz;      // after clamping to the loop rate
+    float filterTf;         // s, current low pass time constant
+    float riseTimeUs;       // 10 - 90 % of a step the design promises
+};
+
+// bandwidthHz of 0 picks the default, larger values are clamped
+CurrentLoopGains synthesizeCurrentGains(float resistance, float inductance, float loopRateHz,
+                                        float bandwidthHz = 0);
+
+#endif
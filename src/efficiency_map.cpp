@@ -0,0 +1,106 @@
+#include "efficiency_map.h"
+#include <math.h>
+
+#define MAP_SQRT3  1.7320508f
+
+EfficiencyMapGrid efficiencyMapGrid(float maxSpeed, uint8_t speedSteps, float maxCurrent, uint8_t currentSteps) {
+    EfficiencyMapGrid grid = {};
+    if (speedSteps < 1) speedSteps = 1;
+    if (speedSteps > EFFICIENCY_MAP_MAX_STEPS) speedSteps = EFFICIENCY_MAP_MAX_STEPS;
+    if (currentSteps < 1) currentSteps = 1;
+    if (currentSteps > EFFICIENCY_MAP_MAX_STEPS) currentSteps = EFFICIENCY_MAP_MAX_STEPS;
+    grid.speedSteps = speedSteps;
+    grid.currentSteps = currentSteps;
+    for (uint8_t i = 0; i < speedSteps; i++) grid.speeds[i] = maxSpeed * (i + 1) / speedSteps;
+    for (uint8_t i = 0; i < currentSteps; i++) grid.currents[i] = maxCurrent * (i + 1) / currentSteps;
+    return grid;
+}
+
+void efficiencyDwellBegin(EfficiencyMapDwell* dwell, uint32_t nowMs) {
+    *dwell = EfficiencyMapDwell();
+    dwell->startMs = nowMs;
+    dwell->blockStartMs = nowMs;
+}
+
+static float phasePower(const EfficiencyMapReading& r) {
+    return 1.5f * (r.voltageQ * r.currentQ + r.voltageD * r.currentD);
+}
+
+// Three block means in a row. A first order approach shrinks the change
+// from block to block by the same ratio every time, which tells how far it
+// still has to go: a small change on a slow ramp is not settled yet.
+// Changes of alternating sign are noise.
+static bool settled(float older, float previous, float value, float floor) {
+    float tolerance = fabsf(value) * EFFICIENCY_MAP_TOLERANCE;
+    if (tolerance < floor) tolerance = floor;
+    float earlier = previous - older, change = value - previous;
+    if (fabsf(change) > tolerance) return false;
+    if (earlier * change <= 0) return true;
+    if (fabsf(change) >= fabsf(earlier)) return false;
+    float ratio = change / earlier;
+    return fabsf(change) * ratio / (1 - ratio) <= tolerance;
+}
+
+bool efficiencyDwellAdd(EfficiencyMapDwell* dwell, const EfficiencyMapReading& reading, uint32_t nowMs) {
+    if (dwell->done) return true;
+
+    dwell->sum.velocity += reading.velocity;
+    dwell->sum.currentQ += reading.currentQ;
+    dwell->sum.currentD += reading.currentD;
+    dwell->sum.voltageQ += reading.voltageQ;
+    dwell->sum.voltageD += reading.voltageD;
+    dwell->sum.supply += reading.supply;
+    dwell->samples++;
+    if (nowMs - dwell->blockStartMs < EFFICIENCY_MAP_BLOCK_MS) return false;
+
+    float n = dwell->samples;
+    EfficiencyMapReading mean = {dwell->sum.velocity / n, dwell->sum.currentQ / n, dwell->sum.currentD / n,
+                                 dwell->sum.voltageQ / n, dwell->sum.voltageD / n, dwell->sum.supply / n};
+    bool steady = dwell->blocks >= 2 &&
+                  settled(dwell->older.velocity, dwell->last.velocity, mean.velocity, EFFICIENCY_MAP_SPEED_FLOOR) &&
+                  settled(phasePower(dwell->older), phasePower(dwell->last), phasePower(mean),
+                          EFFICIENCY_MAP_POWER_FLOOR);
+    dwell->older = dwell->last;
+    dwell->last = mean;
+    dwell->blocks++;
+    dwell->sum = EfficiencyMapReading();
+    dwell->samples = 0;
+    dwell->blockStartMs = nowMs;
+
+    dwell->converged = steady && dwell->blocks >= EFFICIENCY_MAP_MIN_BLOCKS;
+    dwell->done = dwell->converged || nowMs - dwell->startMs >= EFFICIENCY_MAP_MAX_DWELL_MS;
+    if (dwell->done) dwell->dwellMs = nowMs - dwell->startMs;
+    return dwell->done;
+}
+
+EfficiencyMapPoint efficiencyMapPoint(const EfficiencyMapDwell* dwell, float speedSetpoint, float currentLimit,
+                                      float ke, float resistance) {
+    const EfficiencyMapReading& r = dwell->last;
+    EfficiencyMapPoint point = {};
+    point.speedSetpoint = speedSetpoint;
+    point.currentLimit = currentLimit;
+    point.velocity = r.velocity;
+    point.currentQ = r.currentQ;
+    point.currentD = r.currentD;
+    point.voltageQ = r.voltageQ;
+    point.voltageD = r.voltageD;
+    point.supply = r.supply;
+    point.dwellMs = dwell->dwellMs;
+    point.converged = dwell->converged;
+    point.limited = fabsf(r.velocity) < fabsf(speedSetpoint) * EFFICIENCY_MAP_LIMITED_RATIO;
+
+    point.inputPower = phasePower(r);
+    point.inputCurrent = r.supply > 0 ? point.inputPower / r.supply : 0;
+    if (ke > 0) {
+        point.torque = MAP_SQRT3 / 2 * ke * r.currentQ;
+    } else if (fabsf(r.velocity) > EFFICIENCY_MAP_SPEED_FLOOR) {
+        float copperLoss = 1.5f * resistance * (r.currentQ * r.currentQ + r.currentD * r.currentD);
+        point.torque = (point.inputPower - copperLoss) / r.velocity;
+    }
+    point.mechanicalPower = point.torque * r.velocity;
+    if (point.inputPower > EFFICIENCY_MAP_POWER_FLOOR) {
+        point.efficiency = point.mechanicalPower / point.inputPower;
+        if (point.efficiency < 0) point.efficiency = 0;
+    }
+    return point;
+}
@@ -0,0 +1,97 @@
+#ifndef EFFICIENCY_MAP_H
+#define EFFICIENCY_MAP_H
+
+#include <stdint.h>
+
+// Speed-torque and efficiency map. A sweep runs the velocity loop in
+// foc_current mode at every point of a grid of speed setpoints and torque
+// current limits (the clamp on the velocity loop's output) and records the
+// operating point it settles at. The load comes from a brake or
+// dynamometer on the shaft: where it needs more than the limit the speed
+// falls short of the setpoint and the point is marked limited.
+//
+// Every point dwells until the means of the speed and the input power over
+// consecutive blocks agree and their trend leaves less than the tolerance
+// to go, so quick points finish in a few blocks and only slow ones use the
+// full dwell.
+//
+// The board has no DC link shunt. The input current is the power the
+// bridge puts into the phases over the measured supply
+//   Pin = 3/2 (Uq Iq + Ud Id),  Iin = Pin / Vin
+// which leaves the bridge's own losses out. The torque follows from the
+// back-EMF constant (line to line peak per mechanical rad/s)
+//   T = sqrt(3) / 2 Ke Iq
+// or, before Ke was measured, from Pin less the copper loss.
+// Kept free of Arduino dependencies so it can be checked on the host.
+
+#define EFFICIENCY_MAP_MAX_STEPS      8      // per axis
+#define EFFICIENCY_MAP_BLOCK_MS       20     // readings averaged into one block
+#define EFFICIENCY_MAP_MIN_BLOCKS     3      // the first ones are the step to the point
+#define EFFICIENCY_MAP_MAX_DWELL_MS   1500   // the point is reported unconverged after this
+#define EFFICIENCY_MAP_TOLERANCE      0.02f  // block to block change counted as settled
+#define EFFICIENCY_MAP_SPEED_FLOOR    1.0f   // rad/s, tolerance near standstill
+#define EFFICIENCY_MAP_POWER_FLOOR    0.1f   // W, tolerance near no load
+#define EFFICIENCY_MAP_LIMITED_RATIO  0.95f  // speed below this share of the setpoint: torque limited
+
+struct EfficiencyMapGrid {
+    uint8_t speedSteps;
+    uint8_t currentSteps;
+    float speeds[EFFICIENCY_MAP_MAX_STEPS];    // rad/s, ascending
+    float currents[EFFICIENCY_MAP_MAX_STEPS];  // A, ascending
+};
+
+// What the monitor task reads from the motor once per tick
+struct EfficiencyMapReading {
+    float velocity;     // rad/s mechanical
+    float currentQ;     // A
+    float currentD;
+    float voltageQ;     // V
+    float voltageD;
+    float supply;       // V
+};
+
+struct EfficiencyMapDwell {
+    uint32_t startMs;
+    uint32_t blockStartMs;
+    uint16_t blocks;               // completed
+    uint16_t samples;              // in the running block
+    EfficiencyMapReading sum;      // of the running block
+    EfficiencyMapReading last;     // means of the last completed block
+    EfficiencyMapReading older;    // and of the one before
+    bool converged;
+    bool done;
+    uint32_t dwellMs;              // when it was done
+};
+
+struct EfficiencyMapPoint {
+    float speedSetpoint;    // rad/s
+    float currentLimit;     // A
+    float velocity;         // rad/s
+    float currentQ;         // A
+    float currentD;
+    float voltageQ;         // V
+    float voltageD;
+    float supply;           // V
+    float inputCurrent;     // A
+    float inputPower;       // W
+    float torque;           // Nm
+    float mechanicalPower;  // W
+    float efficiency;       // 0 .. 1, 0 without input power
+    uint32_t dwellMs;
+    bool converged;
+    bool limited;
+};
+
+// Evenly spaced steps from max / steps up to max, clamped to 1 ..
+// EFFICIENCY_MAP_MAX_STEPS
+EfficiencyMapGrid efficiencyMapGrid(float maxSpeed, uint8_t speedSteps, float maxCurrent, uint8_t currentSteps);
+
+void efficiencyDwellBegin(EfficiencyMapDwell* dwell, uint32_t nowMs);
+// Add one reading, true once the point converged or ran out of time
+bool efficiencyDwellAdd(EfficiencyMapDwell* dwell, const EfficiencyMapReading& reading, uint32_t nowMs);
+// The point from the last block. ke in V s/rad (0 if unknown), resistance
+// per phase in ohms.
+EfficiencyMapPoint efficiencyMapPoint(const EfficiencyMapDwell* dwell, float speedSetpoint, float currentLimit,
+                                      float ke, float resistance);
+
+#endif
@@ -0,0 +1,484 @@
+#include "foc_control.h"
+#include <string.h>
+
+static const char* const torqueNames[] = {"voltage", "foc_current"};
+static const char* const motionNames[] = {"torque", "velocity", "angle"};
+
+const char* focTorqueModeName(FocTorqueMode torque) {
+    return torque <= FOC_TORQUE_CURRENT ? torqueNames[torque] : "unknown";
+}
+
+const char* focMotionName(FocMotion motion) {
+    return motion <= FOC_MOTION_ANGLE ? motionNames[motion] : "unknown";
+}
+
+bool focTorqueModeFromName(const char* name, FocTorqueMode* torque) {
+    if (!name) return false;
+    for (int i = 0; i <= FOC_TORQUE_CURRENT; i++) {
+        if (strcmp(name, torqueNames[i]) == 0) {
+            *torque = (FocTorqueMode)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool focMotionFromName(const char* name, FocMotion* motion) {
+    if (!name) return false;
+    for (int i = 0; i <= FOC_MOTION_ANGLE; i++) {
+        if (strcmp(name, motionNames[i]) == 0) {
+            *motion = (FocMotion)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+#ifdef ARDUINO
+
+#include "main.h"
+#include "motor_analysis.h"
+#include "health_monitor.h"
+#include "control_loop.h"
+#include "hall_capture.h"
+#include "hal.h"
+
+// Commands from the WebSocket handlers, taken by the monitor task
+static portMUX_TYPE pendingMux = portMUX_INITIALIZER_UNLOCKED;
+static bool modePending = false;
+static bool targetPending = false;
+static bool stopPending = false;
+static bool tunePending = false;
+static bool velocityPending = false;
+static bool mapPending = false;
+static FocTorqueMode pendingTorque;
+static FocMotion pendingMotion;
+static float pendingLimit;
+static float pendingTarget;
+static float pendingBandwidth;
+static float pendingSetpoint;
+static float pendingAmplitude;
+static EfficiencyMapGrid pendingGrid;
+
+// Only written by the monitor task
+static FocControlState state = {false, false, FOC_TORQUE_VOLTAGE, FOC_MOTION_TORQUE, 0, FOC_CURRENT_LIMIT,
+                                 {}, {}, false, FOC_TORQUE_VOLTAGE, {}, false, 0, 0, 0, ""};
+static int alignedPolePairs = 0;
+static float bandwidthHz = 0;   // of the current loop, 0 for the default
+// R and L whose gains failed the step check, not synthesized again until
+// they are remeasured or a tuning run retries them
+static float rejectedResistance = 0;
+static float rejectedInductance = 0;
+static float stepCapture[FOC_TUNE_SAMPLES];
+
+// Velocity tuning run, stepped by focControlTick()
+static RelayTune relay;
+static HallEdgeStats relayStats;
+static int8_t relayDirection;   // hall direction of positive torque, 0 until seen
+static float relayCommand;
+static unsigned long relayStartMs;
+
+// Efficiency map sweep, stepped the same way
+static EfficiencyMapGrid mapGrid;
+static EfficiencyMapDwell mapDwell;
+static EfficiencyMapPoint mapResults[FOC_MAP_MAX_POINTS];
+
+bool focControlRequest(FocTorqueMode torque, FocMotion motion, float currentLimit) {
+    if (isTestRunning) return false;
+    if (torque == FOC_TORQUE_CURRENT && !motor.current_sense) return false;
+    portENTER_CRITICAL(&pendingMux);
+    pendingTorque = torque;
+    pendingMotion = motion;
+    pendingLimit = currentLimit > 0 && currentLimit < FOC_CURRENT_LIMIT ? currentLimit : FOC_CURRENT_LIMIT;
+    modePending = true;
+    stopPending = false;
+    portEXIT_CRITICAL(&pendingMux);
+    return true;
+}
+
+void focControlSetTarget(float target) {
+    portENTER_CRITICAL(&pendingMux);
+    pendingTarget = target;
+    targetPending = true;
+    portEXIT_CRITICAL(&pendingMux);
+}
+
+bool focControlTuneCurrent(float bandwidthHz) {
+    if (isTestRunning || !motor.current_sense) return false;
+    portENTER_CRITICAL(&pendingMux);
+    pendingBandwidth = bandwidthHz;
+    tunePending = true;
+    stopPending = false;
+    portEXIT_CRITICAL(&pendingMux);
+    return true;
+}
+
+bool focControlTuneVelocity(float setpoint, float amplitude) {
+    if (isTestRunning || setpoint <= 0 || amplitude <= 0) return false;
+    portENTER_CRITICAL(&pendingMux);
+    pendingSetpoint = setpoint;
+    pendingAmplitude = amplitude;
+    velocityPending = true;
+    stopPending = false;
+    portEXIT_CRITICAL(&pendingMux);
+    return true;
+}
+
+bool focControlMapEfficiency(float maxSpeed, uint8_t speedSteps, float maxCurrent, uint8_t currentSteps) {
+    if (isTestRunning || !motor.current_sense || maxSpeed <= 0 || maxCurrent <= 0) return false;
+    if (maxCurrent > FOC_CURRENT_LIMIT) maxCurrent = FOC_CURRENT_LIMIT;
+    EfficiencyMapGrid grid = efficiencyMapGrid(maxSpeed, speedSteps, maxCurrent, currentSteps);
+    portENTER_CRITICAL(&pendingMux);
+    pendingGrid = grid;
+    mapPending = true;
+    stopPending = false;
+    portEXIT_CRITICAL(&pendingMux);
+    return true;
+}
+
+void focControlStop() {
+    portENTER_CRITICAL(&pendingMux);
+    stopPending = true;
+    modePending = false;
+    targetPending = false;
+    tunePending = false;
+    velocityPending = false;
+    mapPending = false;
+    portEXIT_CRITICAL(&pendingMux);
+}
+
+bool focControlActive() {
+    return state.active;
+}
+
+FocControlState focControlState() {
+    return state;
+}
+
+bool focControlMapPoint(uint8_t index, EfficiencyMapPoint* point) {
+    if (index >= state.mapPoints) return false;
+    *point = mapResults[index];
+    return true;
+}
+
+// Motor settings are changed with the loop held for at least one period,
+// so no iteration sees half of them
+static void holdLoop(bool hold) {
+    isMeasuring = hold;
+    if (hold) delay(1);
+}
+
+// Link the halls and find the electrical zero, again whenever the pole
+// pair count changed since
+static bool alignSensor() {
+    int polePairs = motorParams.polePairs > 0 ? motorParams.polePairs : motor.pole_pairs;
+    if (state.aligned && polePairs == alignedPolePairs) {
+        // A measurement may have left the bridge held, or tripped
+        useBridge(BRIDGE_RELEASED);
+        return true;
+    }
+
+    releaseBridge();
+    holdLoop(true);
+    motor.pole_pairs = polePairs;
+    sensor.cpr = polePairs * 6;
+    motor.voltage_sensor_align = motorParams.phaseResistance > 0 ?
+        FOC_ALIGN_CURRENT * motorParams.phaseResistance : FOC_ALIGN_VOLTAGE;
+    if (motor.voltage_sensor_align > motor.voltage_limit) motor.voltage_sensor_align = motor.voltage_limit;
+    motor.zero_electric_angle = NOT_SET;
+    motor.linkSensor(&sensor);
+    state.aligned = motor.initFOC() == 1;
+    alignedPolePairs = polePairs;
+    if (!state.aligned) {
+        // initFOC disabled the motor, it drives open loop again
+        motor.linkSensor(nullptr);
+        releaseBridge();
+    }
+    holdLoop(false);
+    return state.aligned;
+}
+
+// The synthesized current gains when valid, SimpleFOC's defaults otherwise
+static void applyCurrentGains() {
+    if (state.gains.valid) {
+        motor.PID_current_q.P = motor.PID_current_d.P = state.gains.kp;
+        motor.PID_current_q.I = motor.PID_current_d.I = state.gains.ki;
+        motor.LPF_current_q.Tf = motor.LPF_current_d.Tf = state.gains.filterTf;
+    } else {
+        motor.PID_current_q.P = motor.PID_current_d.P = DEF_PID_CURR_P;
+        motor.PID_current_q.I = motor.PID_current_d.I = DEF_PID_CURR_I;
+        motor.LPF_current_q.Tf = motor.LPF_current_d.Tf = DEF_CURR_FILTER_Tf;
+    }
+    motor.PID_current_q.D = motor.PID_current_d.D = 0;
+}
+
+static void applyMode(FocTorqueMode torque, FocMotion motion, float currentLimit) {
+    holdLoop(true);
+    motor.torque_controller = torque == FOC_TORQUE_CURRENT ?
+        TorqueControlType::foc_current : TorqueControlType::voltage;
+    motor.controller = motion == FOC_MOTION_ANGLE ? MotionControlType::angle :
+        (motion == FOC_MOTION_VELOCITY ? MotionControlType::velocity : MotionControlType::torque);
+
+    // init() sized the limits for voltage mode before the current sense was
+    // linked, the supply may have changed since
+    motor.current_limit = currentLimit;
+    motor.PID_current_q.limit = motor.voltage_limit;
+    motor.PID_current_d.limit = motor.voltage_limit;
+    motor.PID_velocity.limit = torque == FOC_TORQUE_CURRENT ? currentLimit : motor.voltage_limit;
+    motor.velocity_limit = FOC_ANGLE_VELOCITY_LIMIT;
+    motor.P_angle.limit = FOC_ANGLE_VELOCITY_LIMIT;
+    if (torque == FOC_TORQUE_CURRENT) {
+        bool rejected = motorParams.phaseResistance == rejectedResistance &&
+                        motorParams.phaseInductance == rejectedInductance;
+        state.gains = rejected ? CurrentLoopGains() :
+            synthesizeCurrentGains(motorParams.phaseResistance, motorParams.phaseInductance,
+                                   getControlLoopStats().rateHz, bandwidthHz);
+        applyCurrentGains();
+    }
+    // Tuned velocity gains only mean something in the torque mode they
+    // were found in
+    if (state.velocity.valid && torque == state.velocityTorque) {
+        motor.PID_velocity.P = state.velocity.kp;
+        motor.PID_velocity.I = state.velocity.ki;
+        motor.PID_velocity.D = 0;
+        motor.LPF_velocity.Tf = state.velocity.filterTf;
+    } else {
+        motor.PID_velocity.P = DEF_PID_VEL_P;
+        motor.PID_velocity.I = DEF_PID_VEL_I;
+        motor.PID_velocity.D = DEF_PID_VEL_D;
+        motor.LPF_velocity.Tf = DEF_VEL_FILTER_Tf;
+    }
+    motor.PID_current_q.reset();
+    motor.PID_current_d.reset();
+    motor.PID_velocity.reset();
+    motor.P_angle.reset();
+
+    // Hold still where the rotor is
+    state.target = motion == FOC_MOTION_ANGLE ? motor.shaft_angle : 0;
+    motor.target = state.target;
+    holdLoop(false);
+
+    state.torque = torque;
+    state.motion = motion;
+    state.currentLimit = currentLimit;
+}
+
+static void applyTarget(float target) {
+    // A torque current beyond the limit would only be clipped by the
+    // voltage, and that is far too late
+    if (state.torque == FOC_TORQUE_CURRENT && state.motion == FOC_MOTION_TORQUE) {
+        if (target > state.currentLimit) target = state.currentLimit;
+        if (target < -state.currentLimit) target = -state.currentLimit;
+    }
+    state.target = target;
+    motor.target = target;
+}
+
+// Step the q current from zero at the full loop rate. The rotor turns a
+// little under the step, too little in a few ms for the back-EMF to count.
+static void runCurrentStep() {
+    float step = FOC_TUNE_STEP_CURRENT;
+    if (step > state.currentLimit / 2) step = state.currentLimit / 2;
+    delay(FOC_TUNE_SETTLE_MS);
+
+    state.step = StepMetrics();
+    if (!controlLoopStepCapture(step, FOC_TUNE_PRE_SAMPLES, stepCapture, FOC_TUNE_SAMPLES)) return;
+    unsigned long start = millis();
+    while (!controlLoopCaptureDone() && millis() - start < FOC_TUNE_TIMEOUT_MS) delay(1);
+    bool complete = controlLoopCaptureDone();
+    applyTarget(0);
+    if (!complete) return;
+
+    float periodUs = 1e6f / getControlLoopStats().rateHz;
+    state.step = analyzeStepResponse(stepCapture, FOC_TUNE_SAMPLES, FOC_TUNE_PRE_SAMPLES, periodUs, step);
+}
+
+// Back to what the rotation tests and the health monitor expect
+static void stopControl() {
+    state.tuningVelocity = false;
+    state.mapping = false;
+    applyMode(FOC_TORQUE_VOLTAGE, FOC_MOTION_TORQUE, FOC_CURRENT_LIMIT);
+    state.active = false;
+}
+
+static void startVelocityTune(float setpoint, float amplitude) {
+    relayTuneBegin(&relay, setpoint, amplitude, 0);
+    hallStatsReset(&relayStats);
+    hallCaptureFlush();
+    relayDirection = 0;
+    relayStartMs = millis();
+    relayCommand = relay.bias + relay.amplitude;
+    applyTarget(relayCommand);
+    state.velocity = RelayTuneResult();
+    state.tuningVelocity = true;
+}
+
+// One relay update per new hall edge. The speed comes from the hall
+// timing rather than the sensor, so the limit cycle includes the delay the
+// tuned velocity loop will see; between edges the time since the last one
+// bounds it from above, which catches the rotor slowing down.
+static bool stepVelocityTune() {
+    HallEdge edges[16];
+    size_t count;
+    while ((count = hallCaptureDrain(edges, 16)) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            uint32_t glitches = relayStats.glitches;
+            hallStatsAccumulate(&relayStats, &edges[i], 1);
+            if (relayStats.glitches != glitches || relayStats.direction == 0) continue;
+            if (relayDirection == 0) relayDirection = relayStats.direction;
+            float velocity = hallElectricalVelocity(&relayStats, edges[i].timestampUs) * relayDirection /
+                             motor.pole_pairs;
+            relayCommand = relayTuneUpdate(&relay, velocity, edges[i].timestampUs);
+        }
+    }
+    uint32_t now = halMicros();
+    uint32_t sinceEdge = now - relayStats.lastEdgeUs;
+    if (relayDirection != 0 && relayStats.sectorPeriodUs > 0 && sinceEdge > relayStats.sectorPeriodUs) {
+        float velocity = (PI / 3) / (sinceEdge * 1e-6f) / motor.pole_pairs;
+        if (relayStats.direction != relayDirection) velocity = -velocity;
+        relayCommand = relayTuneUpdate(&relay, velocity, now);
+    }
+    applyTarget(relayCommand);
+
+    bool timedOut = millis() - relayStartMs > FOC_RELAY_TIMEOUT_MS;
+    if (!relayTuneDone(&relay) && !timedOut) return false;
+
+    state.tuningVelocity = false;
+    float sectorS = (PI / 3) / (relay.setpoint * motor.pole_pairs);
+    state.velocity = relayTuneResult(&relay, sectorS);
+    state.velocityTorque = state.torque;
+    if (!state.velocity.valid) {
+        state.error = relayDirection == 0 ? "Rotor did not turn" : "No limit cycle within the timeout";
+        applyTarget(0);
+        return true;
+    }
+    // Hand over to the tuned loop at the speed the relay held
+    applyMode(state.torque, FOC_MOTION_VELOCITY, state.currentLimit);
+    applyTarget(relay.setpoint);
+    return true;
+}
+
+// The velocity loop's output clamp is the torque current limit of the point
+static void startMapPoint() {
+    uint8_t speed = state.mapPoints % mapGrid.speedSteps;
+    uint8_t current = state.mapPoints / mapGrid.speedSteps;
+    motor.PID_velocity.limit = mapGrid.currents[current];
+    applyTarget(mapGrid.speeds[speed]);
+    efficiencyDwellBegin(&mapDwell, millis());
+}
+
+static void startEfficiencyMap(const EfficiencyMapGrid& grid) {
+    mapGrid = grid;
+    state.mapPoints = 0;
+    state.mapSpeedSteps = grid.speedSteps;
+    state.mapCurrentSteps = grid.currentSteps;
+    state.mapping = true;
+    startMapPoint();
+}
+
+// One reading per monitor tick, shared variables of the control task are
+// single floats and read whole
+static bool stepEfficiencyMap() {
+    EfficiencyMapReading reading = {motor.shaft_velocity, motor.current.q, motor.current.d,
+                                    motor.voltage.q, motor.voltage.d, measureInputVoltage()};
+    if (!efficiencyDwellAdd(&mapDwell, reading, millis())) return false;
+
+    uint8_t speed = state.mapPoints % mapGrid.speedSteps;
+    uint8_t current = state.mapPoints / mapGrid.speedSteps;
+    mapResults[state.mapPoints] = efficiencyMapPoint(&mapDwell, mapGrid.speeds[speed], mapGrid.currents[current],
+                                                     motorParams.motorKe, motorParams.phaseResistance);
+    state.mapPoints++;
+    if (state.mapPoints < mapGrid.speedSteps * mapGrid.currentSteps) {
+        startMapPoint();
+        return false;
+    }
+    stopControl();
+    return true;
+}
+
+bool focControlTick() {
+    portENTER_CRITICAL(&pendingMux);
+    bool mode = modePending, target = targetPending, stop = stopPending, tune = tunePending;
+    bool velocity = velocityPending, map = mapPending;
+    FocTorqueMode torque = pendingTorque;
+    FocMotion motion = pendingMotion;
+    float limit = pendingLimit, value = pendingTarget, bandwidth = pendingBandwidth;
+    float setpoint = pendingSetpoint, amplitude = pendingAmplitude;
+    EfficiencyMapGrid grid = pendingGrid;
+    modePending = targetPending = stopPending = tunePending = velocityPending = mapPending = false;
+    portEXIT_CRITICAL(&pendingMux);
+
+    // A test takes the bridge whatever was commanded
+    if (isTestRunning) {
+        if (!state.active) return false;
+        stopControl();
+        return true;
+    }
+
+    if (stop) {
+        if (!state.active) return false;
+        stopControl();
+        state.error = "";
+        return true;
+    }
+
+    bool changed = false;
+    if (mode || tune || velocity || map) {
+        // A health cycle may be halfway through driving the bridge
+        healthMonitorAbort();
+        state.tuningVelocity = false;
+        state.mapping = false;
+        if (!alignSensor()) {
+            state.error = "Sensor alignment failed";
+            state.active = false;
+            return true;
+        }
+        float currentLimit = state.active ? state.currentLimit : FOC_CURRENT_LIMIT;
+        if (tune) {
+            bandwidthHz = bandwidth;
+            rejectedResistance = rejectedInductance = 0;
+            applyMode(FOC_TORQUE_CURRENT, FOC_MOTION_TORQUE, currentLimit);
+        } else if (velocity) {
+            applyMode(motor.current_sense ? FOC_TORQUE_CURRENT : FOC_TORQUE_VOLTAGE, FOC_MOTION_TORQUE,
+                      currentLimit);
+        } else if (map) {
+            applyMode(FOC_TORQUE_CURRENT, FOC_MOTION_VELOCITY, FOC_CURRENT_LIMIT);
+        } else {
+            applyMode(torque, motion, limit);
+        }
+        state.active = true;
+        state.error = "";
+        if (tune) {
+            runCurrentStep();
+            if (!state.gains.valid) {
+                state.error = "Resistance and inductance not measured";
+            } else if (!state.step.valid) {
+                // Gains the step disproves are not left driving the motor.
+                // Back in voltage mode the current loops are idle, so the
+                // defaults go in without holding the loop.
+                rejectedResistance = motorParams.phaseResistance;
+                rejectedInductance = motorParams.phaseInductance;
+                stopControl();
+                state.gains = CurrentLoopGains();
+                applyCurrentGains();
+                state.error = "Current step did not settle";
+                return true;
+            }
+        }
+        if (velocity) startVelocityTune(setpoint, amplitude);
+        if (map) startEfficiencyMap(grid);
+        changed = true;
+    }
+    // The relay and the sweep own the target until they are done
+    if (state.tuningVelocity) {
+        if (stepVelocityTune()) changed = true;
+    } else if (state.mapping) {
+        if (stepEfficiencyMap()) changed = true;
+    } else if (target && state.active) {
+        applyTarget(value);
+        changed = true;
+    }
+    return changed;
+}
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef FOC_CONTROL_H
+#define FOC_CONTROL_H
+
+#include <stdint.h>
+#include "current_tuning.h"
+#include "step_response.h"
+#include "relay_tune.h"
+#include "efficiency_map.h"
+
+// Closed-loop FOC commanded from the web UI. The torque is either the
+// q-axis voltage (SimpleFOC's voltage mode, what the rotation tests use) or
+// the q-axis current held by the current PI loops on the low-side shunts
+// (foc_current), optionally under a velocity or angle loop. Commands come in
+// from any task and are applied by focControlTick() on the monitor task:
+// the first closed-loop command aligns the hall sensor to the electrical
+// angle once (initFOC), which blocks that task for about a second. Tests
+// and the health monitor hand the bridge back to voltage mode by stopping
+// it. ESP32 only.
+//
+// In foc_current mode the current PI gains are synthesized from the
+// measured R and L (current_tuning.h), SimpleFOC's defaults stay while
+// those are unknown or L / R is implausible. A tuning run applies them and
+// checks them with a current step captured at the full loop rate; a step
+// that does not settle stops control and puts the defaults back, and the
+// same R and L are not synthesized again until remeasured or retuned.
+//
+// The velocity loop is tuned by relay feedback (relay_tune.h): the relay
+// drives the torque command around a setpoint speed taken from the hall
+// timing, one step per monitor tick, until enough limit cycles were seen.
+// The gains are in the units of the torque mode it ran in and are only used
+// by velocity and angle control in that mode.
+//
+// An efficiency map sweep (efficiency_map.h) steps the velocity loop
+// through its grid the same way, one dwell per point, and keeps the points
+// for the monitor task to stream as they finish.
+
+#define FOC_CURRENT_LIMIT         10.0f  // A, velocity and angle loops and the torque target
+#define FOC_ALIGN_CURRENT         2.0f   // A at the alignment, the voltage follows from the phase resistance
+#define FOC_ALIGN_VOLTAGE         1.0f   // V at the alignment when the resistance is unknown
+#define FOC_ANGLE_VELOCITY_LIMIT  50.0f  // rad/s, the angle loop's approach speed
+#define FOC_TUNE_STEP_CURRENT     2.0f   // A, q current step of a tuning run, at most half the limit
+#define FOC_TUNE_SETTLE_MS        20     // at zero current before the step
+#define FOC_TUNE_PRE_SAMPLES      16     // loop periods captured before the step
+#define FOC_TUNE_SAMPLES          192    // ten time constants down to a fifth of the default bandwidth
+#define FOC_TUNE_TIMEOUT_MS       100
+#define FOC_RELAY_SETPOINT        100.0f // rad/s, default of a velocity tuning run
+#define FOC_RELAY_AMPLITUDE       0.5f   // V or A of relay swing, default
+#define FOC_RELAY_TIMEOUT_MS      5000
+#define FOC_MAP_SPEED             200.0f // rad/s, default top speed of a map
+#define FOC_MAP_SPEED_STEPS       6
+#define FOC_MAP_CURRENT           4.0f   // A, default top current limit of a map
+#define FOC_MAP_CURRENT_STEPS     4
+#define FOC_MAP_MAX_POINTS        (EFFICIENCY_MAP_MAX_STEPS * EFFICIENCY_MAP_MAX_STEPS)
+
+enum FocTorqueMode {
+    FOC_TORQUE_VOLTAGE,     // target in V
+    FOC_TORQUE_CURRENT      // target in A, needs the current sense
+};
+
+enum FocMotion {
+    FOC_MOTION_TORQUE,      // target is the torque command itself
+    FOC_MOTION_VELOCITY,    // rad/s
+    FOC_MOTION_ANGLE        // rad
+};
+
+struct FocControlState {
+    bool active;
+    bool aligned;           // sensor linked and aligned by initFOC
+    FocTorqueMode torque;
+    FocMotion motion;
+    float target;
+    float currentLimit;     // A
+    CurrentLoopGains gains; // in use in foc_current mode when valid
+    StepMetrics step;       // of the last tuning run
+    bool tuningVelocity;    // relay running
+    FocTorqueMode velocityTorque;  // mode the velocity gains were tuned in
+    RelayTuneResult velocity;      // of the last velocity tuning run
+    bool mapping;           // efficiency map sweep running
+    uint8_t mapPoints;      // finished points of the last sweep
+    uint8_t mapSpeedSteps;  // its grid
+    uint8_t mapCurrentSteps;
+    const char* error;      // why the last command was refused, or ""
+};
+
+// Safe from any task, false while a test owns the bridge or the mode needs
+// a current sense the board does not have
+bool focControlRequest(FocTorqueMode torque, FocMotion motion, float currentLimit = FOC_CURRENT_LIMIT);
+void focControlSetTarget(float target);
+// Synthesize the current gains for bandwidthHz (0 for the default), then
+// step the q current and measure the response. Leaves foc_current torque
+// control running at zero current, or stopped when the step did not settle.
+bool focControlTuneCurrent(float bandwidthHz = 0);
+// Relay autotune of the velocity loop around setpoint (rad/s) with the
+// given torque swing, in current mode when there is a current sense. When
+// the cycle was found the tuned velocity loop holds the setpoint.
+bool focControlTuneVelocity(float setpoint = FOC_RELAY_SETPOINT, float amplitude = FOC_RELAY_AMPLITUDE);
+// Efficiency map over speedSteps speeds up to maxSpeed (rad/s) times
+// currentSteps limits up to maxCurrent (A), speeds first. Needs the current
+// sense, stops the motor when done.
+bool focControlMapEfficiency(float maxSpeed = FOC_MAP_SPEED, uint8_t speedSteps = FOC_MAP_SPEED_STEPS,
+                             float maxCurrent = FOC_MAP_CURRENT, uint8_t currentSteps = FOC_MAP_CURRENT_STEPS);
+void focControlStop();
+
+bool focControlActive();
+FocControlState focControlState();
+// Point index of the last sweep, grid position from index % speedSteps
+// (speed) and index / speedSteps (current). Monitor task only.
+bool focControlMapPoint(uint8_t index, EfficiencyMapPoint* point);
+
+// Apply pending commands, on the monitor task. Returns true when the state
+// changed and should be published.
+bool focControlTick();
+
+const char* focTorqueModeName(FocTorqueMode torque);
+const char* focMotionName(FocMotion motion);
+bool focTorqueModeFromName(const char* name, FocTorqueMode* torque);
+bool focMotionFromName(const char* name, FocMotion* motion);
+
+#endif
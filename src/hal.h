@@ -0,0 +1,47 @@
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+
+// Thin hardware abstraction for the measurement code.
+// hal_esp32.cpp forwards to the SimpleFOC driver/motor and the GPIOs,
+// hal_sim.cpp runs a simulated three-phase BLDC on a virtual clock so the
+// analysis routines can run on Linux faster than real time.
+// Analog inputs go through adc_sampler, whose host backend is fed by the
+// simulator.
+
+// Clock
+uint32_t halMicros();
+uint32_t halMillis();
+void halDelayMs(uint32_t ms);
+void halDelayUs(uint32_t us);
+
+// Hall sensors, packed as A << 2 | B << 1 | C like the rest of the code
+uint8_t halReadHalls();
+#define HALL_STATE_A(state) (((state) >> 2) & 1)
+#define HALL_STATE_B(state) (((state) >> 1) & 1)
+#define HALL_STATE_C(state) ((state) & 1)
+// Start feeding every hall transition to hallCaptureRecord() (hall_capture.h)
+void halHallCaptureBegin();
+
+// Bridge output, phase voltages in volts relative to ground
+void halSetPwm(float ua, float ub, float uc);
+void halDriverEnable();
+// Short the current amplifier inputs (DRV8302 DC_CAL) to measure their offset
+void halDcCal(bool enable);
+// Driver fault line asserted (overcurrent, undervoltage, overtemperature)
+bool halFaultActive();
+
+// FOC motor commands used by the rotation tests
+void halMotorEnable();
+void halMotorDisable();
+// Keep the FOC loop off the bridge while a measurement drives it with halSetPwm()
+void halHoldFoc(bool hold);
+void halMotorMove(float target);
+void halSetVoltageLimit(float voltage);
+
+#ifndef ARDUINO
+#include "hal_host.h"
+#endif
+
+#endif
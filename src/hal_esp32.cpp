@@ -0,0 +1,99 @@
+#ifdef ARDUINO
+
+#include "hal.h"
+#include "main.h"
+#include "hall_capture.h"
+#include "control_loop.h"
+#include "adc_sampler.h"
+
+uint32_t halMicros() {
+    return micros();
+}
+
+uint32_t halMillis() {
+    return millis();
+}
+
+void halDelayMs(uint32_t ms) {
+    delay(ms);
+}
+
+void halDelayUs(uint32_t us) {
+    delayMicroseconds(us);
+}
+
+uint8_t halReadHalls() {
+    return (digitalRead(sensor.pinA) << 2) |
+           (digitalRead(sensor.pinB) << 1) |
+            digitalRead(sensor.pinC);
+}
+
+static void ARDUINO_ISR_ATTR onHallA() { sensor.handleA(); }
+static void ARDUINO_ISR_ATTR onHallB() { sensor.handleB(); }
+static void ARDUINO_ISR_ATTR onHallC() { sensor.handleC(); }
+
+// Called by the HallSensor ISR whenever hall_state changes
+static void ARDUINO_ISR_ATTR onHallSector(int) {
+    hallCaptureRecord(sensor.hall_state, (uint32_t)esp_timer_get_time());
+}
+
+void halHallCaptureBegin() {
+    sensor.init();
+    sensor.enableInterrupts(onHallA, onHallB, onHallC);
+    sensor.attachSectorCallback(onHallSector);
+}
+
+void halSetPwm(float ua, float ub, float uc) {
+    driver.setPwm(ua, ub, uc);
+}
+
+void halDriverEnable() {
+    driver.enable();
+}
+
+void halDcCal(bool enable) {
+    digitalWrite(PIN_DC_CAL, enable ? HIGH : LOW);
+}
+
+bool halFaultActive() {
+    // Open drain, pulled up in setup()
+    return digitalRead(PIN_FAULT) == LOW;
+}
+
+// ADC1 follows the bridge: PWM synchronised while FOC drives it, continuous
+// for the measurements and for the coast-down after FOC let go
+static bool focEnabled = true;
+static bool focHeld = false;
+
+static void updateAdcOwner() {
+    adcSamplerSyncToPwm(focEnabled && !focHeld, getControlLoopStats().rateHz);
+}
+
+void halMotorEnable() {
+    motor.enable();
+    focEnabled = true;
+    updateAdcOwner();
+}
+
+void halMotorDisable() {
+    motor.disable();
+    focEnabled = false;
+    updateAdcOwner();
+}
+
+void halHoldFoc(bool hold) {
+    controlLoopHold(hold);
+    focHeld = hold;
+    updateAdcOwner();
+}
+
+// The control task runs move() every period
+void halMotorMove(float target) {
+    motor.target = target;
+}
+
+void halSetVoltageLimit(float voltage) {
+    motor.voltage_limit = voltage;
+}
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef HAL_HOST_H
+#define HAL_HOST_H
+
+// Host (Linux) side of the HAL: the simulated motor and the handful of
+// Arduino names the portable analysis code relies on, mapped onto the
+// simulator's virtual clock.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+struct BldcSimParams {
+    float supplyVoltage;      // V
+    float phaseResistance;    // ohm, phase to neutral
+    float phaseInductance;    // H, phase to neutral
+    float backEmfConstant;    // V per mechanical rad/s, phase peak
+    int polePairs;
+    float inertia;            // kg m^2
+    float viscousFriction;    // N m s / rad
+    float coulombFriction;    // N m
+    float loadRipple;         // N m, once per revolution load (eccentric rotor, bearing damage)
+    float hallOffset;         // electrical rad between rotor and hall placement
+    float rotorEccentricity;  // once per revolution change of the flux, also shifts the hall edges (rad)
+    float hallGlitchRate;     // probability that a hall read or a simulation step sees a wrong bit
+    float currentNoise;       // A rms added to the shunt readings
+    float currentOffset;      // V at the current amplifier outputs for zero current
+    float voltageNoise;       // V rms added to the voltage readings
+    float faultCurrent;       // A, the driver reports a fault above this phase current
+    uint32_t seed;            // noise generator seed
+};
+
+struct BldcSimState {
+    float ia, ib, ic;         // phase currents (A)
+    float thetaMech;          // rotor angle (rad), 0 .. 2 pi
+    float omegaMech;          // rotor speed (rad/s)
+    float ua, ub, uc;         // bridge output (V)
+    bool bridgeEnabled;
+    uint64_t timeUs;          // virtual time since reset
+};
+
+BldcSimParams defaultSimParams();
+// Configure the plant and reset time and state
+void halSimConfigure(const BldcSimParams& params);
+BldcSimState halSimState();
+// Advance the simulation without touching the outputs
+void halSimAdvanceUs(uint64_t us);
+
+// Arduino compatibility on the virtual clock
+inline uint32_t millis() { return halMillis(); }
+inline uint32_t micros() { return halMicros(); }
+inline void delay(uint32_t ms) { halDelayMs(ms); }
+inline void delayMicroseconds(uint32_t us) { halDelayUs(us); }
+inline void yield() { halDelayUs(10); }
+
+#define PI 3.1415926535897932384626433832795
+
+template <typename T>
+inline T min(T a, T b) { return b < a ? b : a; }
+
+template <typename T, typename L, typename H>
+inline T constrain(T value, L low, H high) {
+    return value < low ? (T)low : (value > high ? (T)high : value);
+}
+
+// Minimal Arduino String for the result and error messages
+class String {
+  public:
+    String(const char* s = "") : str(s ? s : "") {}
+    String(const std::string& s) : str(s) {}
+    String(int value) : str(std::to_string(value)) {}
+    String(unsigned int value) : str(std::to_string(value)) {}
+    String(long value) : str(std::to_string(value)) {}
+    String(unsigned long value) : str(std::to_string(value)) {}
+    String(double value, int decimals = 2) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.*f", decimals, value);
+        str = buf;
+    }
+
+    unsigned int length() const { return str.length(); }
+    const char* c_str() const { return str.c_str(); }
+
+    String& operator+=(const String& other) { str += other.str; return *this; }
+    String& operator+=(const char* other) { str += other; return *this; }
+    bool operator==(const String& other) const { return str == other.str; }
+    bool operator!=(const String& other) const { return str != other.str; }
+
+    friend String operator+(const String& a, const String& b) { return String(a.str + b.str); }
+    friend String operator+(const char* a, const String& b) { return String(std::string(a) + b.str); }
+    friend String operator+(const String& a, const char* b) { return String(a.str + b); }
+
+  private:
+    std::string str;
+};
+
+#endif
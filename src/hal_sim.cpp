@@ -0,0 +1,337 @@
+#ifndef ARDUINO
+
+#include "hal.h"
+#include "main.h"
+#include "adc_sampler.h"
+#include "adc_calibration.h"
+#include "hall_capture.h"
+#include <math.h>
+
+// Simulated three-phase star connected BLDC with sinusoidal back-EMF driven
+// by an ideal averaged bridge (no PWM ripple). Time only advances through
+// the HAL delays, so a test runs as fast as the host can integrate.
+
+#define SIM_MIN_STEP_US      1      // integration step bounds, the actual step
+#define SIM_MAX_STEP_US      20     // is 1/50 of the electrical time constant
+#define SIM_TWO_PI           6.2831853f
+#define SIM_TWO_PI_3         2.0943951f
+
+static BldcSimParams params;
+static BldcSimState state;
+static bool motorEnabled = true;
+static bool focActive = false;
+static bool focHeld = false;
+static float focTarget = 0;
+static float voltageLimit = 12.0f;
+static uint64_t nextAdcUs = 0;
+static uint32_t stepUs = SIM_MIN_STEP_US;
+static uint32_t rng = 1;
+static bool hallCapture = false;
+static bool dcCal = false;
+static uint8_t capturedHalls = 0;
+// The rotor angle is integrated in double: float steps round differently
+// in every binade of the turn and leave a once per turn position error of
+// their own, which the pole pair sweep would take for the rotor's signature
+static double mechAngle = 0;
+
+static float randomUniform() {
+    // xorshift32, deterministic per seed
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return (rng >> 8) * (1.0f / 16777216.0f);
+}
+
+static float randomGaussian() {
+    // Sum of uniforms is close enough for sensor noise
+    float sum = 0;
+    for (int i = 0; i < 4; i++) sum += randomUniform();
+    return (sum - 2.0f) * 1.7320508f;
+}
+
+static float electricalAngle() {
+    return state.thetaMech * params.polePairs;
+}
+
+static float fluxScale() {
+    // An eccentric rotor widens and narrows the air gap once per revolution
+    return 1.0f + params.rotorEccentricity * sinf(state.thetaMech);
+}
+
+static uint8_t trueHallState() {
+    float theta = electricalAngle() + params.hallOffset + params.rotorEccentricity * sinf(state.thetaMech);
+    return ((sinf(theta) > 0) << 2) |
+           ((sinf(theta - SIM_TWO_PI_3) > 0) << 1) |
+            (sinf(theta + SIM_TWO_PI_3) > 0);
+}
+
+static void captureHallEdges() {
+    // A glitch shows up as a one step pulse on a single sensor
+    uint8_t halls = trueHallState();
+    if (params.hallGlitchRate > 0 && randomUniform() < params.hallGlitchRate) {
+        halls ^= 1 << (int)(randomUniform() * 3);
+    }
+    if (halls != capturedHalls) {
+        capturedHalls = halls;
+        hallCaptureRecord(halls, (uint32_t)state.timeUs);
+    }
+}
+
+static void backEmf(float* e) {
+    float theta = electricalAngle();
+    float k = -params.backEmfConstant * fluxScale() * state.omegaMech;
+    e[0] = k * sinf(theta);
+    e[1] = k * sinf(theta - SIM_TWO_PI_3);
+    e[2] = k * sinf(theta + SIM_TWO_PI_3);
+}
+
+static void applyFocVoltage() {
+    // Voltage mode FOC with an ideal angle sensor, like motor.move() + loopFOC()
+    float uq = constrain(focTarget, -voltageLimit, voltageLimit);
+    float theta = electricalAngle();
+    float ualpha = -uq * sinf(theta);
+    float ubeta = uq * cosf(theta);
+    float center = params.supplyVoltage / 2;
+    state.ua = center + ualpha;
+    state.ub = center - 0.5f * ualpha + 0.8660254f * ubeta;
+    state.uc = center - 0.5f * ualpha - 0.8660254f * ubeta;
+}
+
+static void integrateStep(float dt) {
+    float e[3];
+    backEmf(e);
+
+    if (state.bridgeEnabled) {
+        if (focActive) applyFocVoltage();
+
+        float u[3] = {
+            constrain(state.ua, 0.0f, params.supplyVoltage),
+            constrain(state.ub, 0.0f, params.supplyVoltage),
+            constrain(state.uc, 0.0f, params.supplyVoltage)
+        };
+        float neutral = (u[0] + u[1] + u[2] - (e[0] + e[1] + e[2])) / 3.0f;
+        float* i[3] = {&state.ia, &state.ib, &state.ic};
+        for (int k = 0; k < 3; k++) {
+            float di = (u[k] - neutral - params.phaseResistance * *i[k] - e[k]) / params.phaseInductance;
+            *i[k] += di * dt;
+        }
+        // Keep the star point constraint exact
+        float mean = (state.ia + state.ib + state.ic) / 3.0f;
+        state.ia -= mean;
+        state.ib -= mean;
+        state.ic -= mean;
+    } else {
+        // Bridge off: the freewheel diodes clear the current almost at once
+        state.ia = state.ib = state.ic = 0;
+    }
+
+    float theta = electricalAngle();
+    float torque = -params.backEmfConstant * fluxScale() * (state.ia * sinf(theta) +
+                                              state.ib * sinf(theta - SIM_TWO_PI_3) +
+                                              state.ic * sinf(theta + SIM_TWO_PI_3));
+    float drive = torque - params.viscousFriction * state.omegaMech - params.loadRipple * sinf(state.thetaMech);
+
+    // Coulomb friction with stiction at standstill
+    if (fabsf(state.omegaMech) < 1e-3f && fabsf(drive) <= params.coulombFriction) {
+        state.omegaMech = 0;
+    } else {
+        float sign = state.omegaMech != 0 ? (state.omegaMech > 0 ? 1.0f : -1.0f) : (drive > 0 ? 1.0f : -1.0f);
+        state.omegaMech += (drive - sign * params.coulombFriction) / params.inertia * dt;
+    }
+    // Kept within one turn
+    mechAngle += (double)state.omegaMech * dt;
+    if (mechAngle >= SIM_TWO_PI) mechAngle -= SIM_TWO_PI;
+    if (mechAngle < 0) mechAngle += SIM_TWO_PI;
+    state.thetaMech = (float)mechAngle;
+}
+
+// Nominal ADC line, what adc_calibration uses without eFuse data
+static uint16_t toAdc(float volts) {
+    float raw = volts / ADC_REFERENCE * ADC_MAX_VALUE;
+    return (uint16_t)constrain(raw, 0.0f, (float)ADC_MAX_VALUE);
+}
+
+static float shuntCurrent(float phaseCurrent, float phaseVoltage) {
+    // Low side shunt, averaged over the PWM period: it only conducts while the
+    // low side switch is on and sees current leaving the motor
+    float duty = constrain(phaseVoltage / params.supplyVoltage, 0.0f, 1.0f);
+    return -phaseCurrent * (1.0f - duty);
+}
+
+static float terminalVoltage(float phaseVoltage, float emf) {
+    if (state.bridgeEnabled) return phaseVoltage;
+    return params.supplyVoltage / 2 + emf;
+}
+
+static uint16_t simAdcSource(AdcChannel channel, uint32_t) {
+    float e[3];
+    backEmf(e);
+
+    switch (channel) {
+        case ADC_CH_I_SENSE1: {
+            // DC_CAL shorts the amplifier inputs, only its offset remains
+            float i = state.bridgeEnabled && !dcCal ? shuntCurrent(state.ia, state.ua) : 0;
+            return toAdc((i + params.currentNoise * randomGaussian()) * CURRENT_SENSE_RATIO + params.currentOffset);
+        }
+        case ADC_CH_I_SENSE2: {
+            float i = state.bridgeEnabled && !dcCal ? shuntCurrent(state.ib, state.ub) : 0;
+            return toAdc((i + params.currentNoise * randomGaussian()) * CURRENT_SENSE_RATIO + params.currentOffset);
+        }
+        case ADC_CH_VIN:
+            return toAdc((params.supplyVoltage + params.voltageNoise * randomGaussian()) / VIN_SCALE_FACTOR);
+        case ADC_CH_VA:
+            return toAdc((terminalVoltage(state.ua, e[0]) + params.voltageNoise * randomGaussian()) / VIN_SCALE_FACTOR);
+        case ADC_CH_VB:
+            return toAdc((terminalVoltage(state.ub, e[1]) + params.voltageNoise * randomGaussian()) / VIN_SCALE_FACTOR);
+        case ADC_CH_VC:
+            return toAdc((terminalVoltage(state.uc, e[2]) + params.voltageNoise * randomGaussian()) / VIN_SCALE_FACTOR);
+        default:
+            return 0;
+    }
+}
+
+BldcSimParams defaultSimParams() {
+    BldcSimParams p;
+    p.supplyVoltage = 24.0f;
+    p.phaseResistance = 0.5f;
+    p.phaseInductance = 0.0005f;
+    p.backEmfConstant = 0.02f;
+    p.polePairs = 7;
+    p.inertia = 2e-5f;
+    p.viscousFriction = 1e-5f;
+    p.coulombFriction = 2e-3f;
+    p.loadRipple = 0;
+    p.hallOffset = 0;
+    p.rotorEccentricity = 0.002f;
+    p.hallGlitchRate = 0;
+    p.currentNoise = 0.01f;
+    p.currentOffset = 0;
+    p.voltageNoise = 0.02f;
+    p.faultCurrent = 30.0f;
+    p.seed = 1;
+    return p;
+}
+
+void halSimConfigure(const BldcSimParams& p) {
+    params = p;
+    state = BldcSimState();
+    mechAngle = 0;
+    state.bridgeEnabled = true;
+    motorEnabled = true;
+    focActive = false;
+    focHeld = false;
+    focTarget = 0;
+    nextAdcUs = 0;
+    rng = p.seed ? p.seed : 1;
+    hallCapture = false;
+    dcCal = false;
+
+    float tauUs = p.phaseInductance / p.phaseResistance * 1e6f / 50;
+    stepUs = (uint32_t)constrain(tauUs, (float)SIM_MIN_STEP_US, (float)SIM_MAX_STEP_US);
+
+    adcCalibrationBegin();
+    adcSamplerSetSyntheticSource(simAdcSource);
+    adcSamplerBegin();
+}
+
+BldcSimState halSimState() {
+    return state;
+}
+
+void halSimAdvanceUs(uint64_t us) {
+    if (params.phaseInductance <= 0) halSimConfigure(defaultSimParams());
+
+    uint64_t end = state.timeUs + us;
+    while (state.timeUs < end) {
+        uint64_t step = end - state.timeUs < stepUs ? end - state.timeUs : stepUs;
+        integrateStep(step * 1e-6f);
+        state.timeUs += step;
+        if (hallCapture) captureHallEdges();
+
+        // Feed the sampler ring at its configured per channel rate
+        if (state.timeUs >= nextAdcUs) {
+            adcSamplerPump(1);
+            nextAdcUs += 1000000 / adcSamplerChannelRate();
+        }
+    }
+}
+
+uint32_t halMicros() {
+    return (uint32_t)state.timeUs;
+}
+
+uint32_t halMillis() {
+    return (uint32_t)(state.timeUs / 1000);
+}
+
+void halDelayMs(uint32_t ms) {
+    halSimAdvanceUs((uint64_t)ms * 1000);
+}
+
+void halDelayUs(uint32_t us) {
+    halSimAdvanceUs(us);
+}
+
+uint8_t halReadHalls() {
+    uint8_t hallState = trueHallState();
+    if (params.hallGlitchRate > 0 && randomUniform() < params.hallGlitchRate) {
+        hallState ^= 1 << (int)(randomUniform() * 3);
+    }
+    return hallState;
+}
+
+void halHallCaptureBegin() {
+    hallCapture = true;
+    capturedHalls = trueHallState();
+}
+
+void halSetPwm(float ua, float ub, float uc) {
+    focActive = false;
+    state.ua = ua;
+    state.ub = ub;
+    state.uc = uc;
+}
+
+void halDriverEnable() {
+    state.bridgeEnabled = true;
+}
+
+void halDcCal(bool enable) {
+    dcCal = enable;
+}
+
+bool halFaultActive() {
+    return fabsf(state.ia) > params.faultCurrent ||
+           fabsf(state.ib) > params.faultCurrent ||
+           fabsf(state.ic) > params.faultCurrent;
+}
+
+void halMotorEnable() {
+    motorEnabled = true;
+    state.bridgeEnabled = true;
+}
+
+void halMotorDisable() {
+    motorEnabled = false;
+    focActive = false;
+    state.bridgeEnabled = false;
+    state.ua = state.ub = state.uc = 0;
+}
+
+void halMotorMove(float target) {
+    // motor.move() does nothing while the motor is disabled
+    if (!motorEnabled) return;
+    focTarget = target;
+    focActive = !focHeld;
+}
+
+void halHoldFoc(bool hold) {
+    focHeld = hold;
+    focActive = !hold && motorEnabled;
+}
+
+void halSetVoltageLimit(float voltage) {
+    voltageLimit = voltage;
+}
+
+#endif
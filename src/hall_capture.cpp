@@ -0,0 +1,137 @@
+#include "hall_capture.h"
+#include "hal.h"
+#include "spsc_ring.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#define HALL_ISR_ATTR ARDUINO_ISR_ATTR
+#else
+#define HALL_ISR_ATTR
+#endif
+
+#define HALL_PI_3 1.0471976f
+
+static SpscRing<HallEdge, HALL_CAPTURE_RING_SIZE, SPSC_OVERWRITE_OLDEST> edges;
+static volatile uint8_t lastState = 0;
+static volatile HallEdgeTap edgeTap = nullptr;
+
+// Same order as SimpleFOC's ELECTRIC_SECTORS
+static const int8_t sectors[8] = {-1, 0, 4, 5, 2, 1, 3, -1};
+
+void hallCaptureBegin() {
+    halHallCaptureBegin();
+    lastState = halReadHalls();
+    hallCaptureFlush();
+}
+
+void HALL_ISR_ATTR hallCaptureRecord(uint8_t state, uint32_t timestampUs) {
+    uint8_t previous = lastState;
+    if (state == previous) return;
+    lastState = state;
+
+    HallEdge edge = {timestampUs, state, previous};
+    edges.push(edge);
+
+    HallEdgeTap tap = edgeTap;
+    if (tap) tap(state, timestampUs);
+}
+
+void hallCaptureSetTap(HallEdgeTap tap) {
+    edgeTap = tap;
+}
+
+size_t hallCaptureDrain(HallEdge* out, size_t max) {
+    return edges.popBatch(out, max);
+}
+
+void hallCaptureFlush() {
+    HallEdge discard[16];
+    while (edges.popBatch(discard, 16) > 0) {
+    }
+}
+
+uint8_t hallCaptureState() {
+    return lastState;
+}
+
+uint32_t hallCaptureEdges() {
+    return edges.pushed();
+}
+
+uint32_t hallCaptureOverruns() {
+    return edges.overruns();
+}
+
+int hallSector(uint8_t state) {
+    return sectors[state & 7];
+}
+
+void hallStatsReset(HallEdgeStats* stats) {
+    *stats = HallEdgeStats();
+}
+
+void hallStatsAccumulate(HallEdgeStats* stats, const HallEdge* batch, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const HallEdge& edge = batch[i];
+        uint8_t changed = edge.state ^ edge.previous;
+        uint32_t intervalUs = edge.timestampUs - stats->lastEdgeUs;
+        bool first = stats->edges == 0;
+
+        stats->edges++;
+        if (changed & 4) stats->toggles[0]++;
+        if (changed & 2) stats->toggles[1]++;
+        if (changed & 1) stats->toggles[2]++;
+
+        int from = hallSector(edge.previous);
+        int to = hallSector(edge.state);
+        int step = 0;
+        if (from >= 0 && to >= 0) {
+            step = (to - from + 6) % 6;
+            step = step == 1 ? 1 : (step == 5 ? -1 : 0);
+        }
+
+        bool singleBit = changed == 1 || changed == 2 || changed == 4;
+        bool clean = to >= 0 && singleBit && step != 0 && (first || intervalUs >= HALL_GLITCH_MIN_US);
+
+        if (to < 0) stats->invalidStates++;
+        if (!clean) {
+            stats->glitches++;
+            // Whatever timing was running is no longer trustworthy
+            stats->direction = 0;
+        } else {
+            // Only a clean edge following a clean edge in the same direction
+            // spans a whole sector
+            if (!first && stats->direction == step) {
+                stats->sectorPeriodUs = intervalUs;
+                if (stats->minSectorUs == 0 || intervalUs < stats->minSectorUs) stats->minSectorUs = intervalUs;
+                if (intervalUs > stats->maxSectorUs) stats->maxSectorUs = intervalUs;
+                stats->dwellUs[from] += intervalUs;
+                stats->dwellCount[from]++;
+            }
+            stats->direction = step;
+        }
+        stats->lastEdgeUs = edge.timestampUs;
+    }
+}
+
+size_t hallCaptureDrainStats(HallEdgeStats* stats) {
+    HallEdge batch[16];
+    size_t total = 0;
+    size_t count;
+    while ((count = hallCaptureDrain(batch, 16)) > 0) {
+        hallStatsAccumulate(stats, batch, count);
+        total += count;
+    }
+    return total;
+}
+
+float hallElectricalVelocity(const HallEdgeStats* stats, uint32_t nowUs) {
+    if (stats->direction == 0 || stats->sectorPeriodUs == 0) return 0;
+    if (nowUs - stats->lastEdgeUs > HALL_VELOCITY_TIMEOUT_US) return 0;
+    return stats->direction * HALL_PI_3 / (stats->sectorPeriodUs * 1e-6f);
+}
+
+uint32_t hallSectorDwellUs(const HallEdgeStats* stats, int sector) {
+    if (sector < 0 || sector > 5 || stats->dwellCount[sector] == 0) return 0;
+    return stats->dwellUs[sector] / stats->dwellCount[sector];
+}
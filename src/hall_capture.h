@@ -0,0 +1,73 @@
+#ifndef HALL_CAPTURE_H
+#define HALL_CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Interrupt driven hall capture. Every transition of the packed hall state
+// (A << 2 | B << 1 | C) is timestamped in the sensor ISR and pushed into a
+// lock-free ring, so edges much shorter than a monitor tick are not missed.
+// On the ESP32 the ISR is the SimpleFOC HallSensor sector callback, on the
+// host the simulator records its edges on the virtual clock.
+//
+// The ring has a single consumer at a time: the health monitor, or the
+// measurement routine that currently owns the motor (it flushes the ring
+// first). The health monitor steps aside while a test or measurement runs.
+// Whatever has to react within the edge itself (commutation) installs a
+// tap, which runs in the ISR after the edge was recorded.
+
+#define HALL_CAPTURE_RING_SIZE   256
+#define HALL_GLITCH_MIN_US       20       // edges closer than this count as glitches
+#define HALL_VELOCITY_TIMEOUT_US 100000   // no edge for this long reads as standstill
+
+struct HallEdge {
+    uint32_t timestampUs;
+    uint8_t state;      // hall state after the edge
+    uint8_t previous;   // hall state before the edge
+};
+
+// Derived from a stream of edges, accumulated over any number of batches
+struct HallEdgeStats {
+    uint32_t edges;
+    uint32_t toggles[3];        // per sensor A, B, C
+    uint32_t invalidStates;     // 000 or 111
+    uint32_t glitches;          // too short, more than one bit or a skipped sector
+    int8_t direction;           // +1 / -1 from the last clean edge, 0 if unknown
+    uint32_t lastEdgeUs;
+    uint32_t sectorPeriodUs;    // time between the last two clean edges
+    uint32_t minSectorUs;
+    uint32_t maxSectorUs;
+    uint32_t dwellUs[6];        // summed clean periods, per sector the rotor left
+    uint32_t dwellCount[6];
+};
+
+// Start the capture, attaches the hall interrupts on the ESP32
+void hallCaptureBegin();
+
+// Producer side, called from the hall ISR (or the simulator)
+void hallCaptureRecord(uint8_t state, uint32_t timestampUs);
+
+// Optional hook on every recorded edge, called in interrupt context: keep it
+// short and in IRAM
+typedef void (*HallEdgeTap)(uint8_t state, uint32_t timestampUs);
+void hallCaptureSetTap(HallEdgeTap tap);
+
+// Consumer side
+size_t hallCaptureDrain(HallEdge* out, size_t max);
+void hallCaptureFlush();
+uint8_t hallCaptureState();      // latest captured hall state
+uint32_t hallCaptureEdges();     // edges recorded since boot
+uint32_t hallCaptureOverruns();  // edges lost because the consumer fell behind
+
+// Edge analysis
+int hallSector(uint8_t state);   // 0..5 in SimpleFOC order, -1 for invalid states
+void hallStatsReset(HallEdgeStats* stats);
+void hallStatsAccumulate(HallEdgeStats* stats, const HallEdge* edges, size_t count);
+// Drain everything pending into stats, returns the number of edges consumed
+size_t hallCaptureDrainStats(HallEdgeStats* stats);
+// Signed electrical velocity in rad/s, 0 once the edges stop
+float hallElectricalVelocity(const HallEdgeStats* stats, uint32_t nowUs);
+// Mean time spent in sector (0..5), 0 before a clean period was seen there
+uint32_t hallSectorDwellUs(const HallEdgeStats* stats, int sector);
+
+#endif
@@ -0,0 +1,231 @@
+#include "health_monitor.h"
+#include "scope_capture.h"
+
+// The monitor is ticked and read from the monitor task only, so the working
+// and published snapshots need no locking.
+static HealthMonitorState state = HEALTH_IDLE;
+static uint32_t checkInterval = HEALTH_CHECK_INTERVAL;
+static unsigned long cycleStart = 0;
+static unsigned long stepStart = 0;
+static int currentPair = 0;
+static float pairResistance[3];
+static HallEdgeStats hallStats;
+static volatile bool spectrumRequested = false;
+static float spectrumHallHz = 0;    // fe from the halls when the capture started
+static uint32_t spectrumTimeoutMs = 0;
+
+static MotorHealth working;
+static MotorHealth latest = {
+    .phases = {true, true, true, 0.0, 0.0, 0.0},
+    .halls = {true, true, true, false, false, false},
+    .inductanceOK = false,
+    .motorTemperatureOK = true,
+    .spectrum = SpectralHealth(),
+    .errorMessage = ""
+};
+static uint32_t snapshots = 0;
+
+static float hallElectricalHz() {
+    return fabsf(hallElectricalVelocity(&hallStats, halMicros())) / (2 * PI);
+}
+
+static void analyzeSpectrumCapture() {
+    ScopeCaptureInfo info;
+    if (!scopeCaptureInfo(&info) || info.length < SPECTRAL_POINTS) return;
+
+    // Only needed for the moment, the window is 32 kB as complex floats
+    float* data = (float*)malloc(sizeof(float) * 2 * SPECTRAL_POINTS);
+    if (!data) return;
+    if (scopeReadValues(0, data, SPECTRAL_POINTS) == SPECTRAL_POINTS) {
+        float electricalHz = (spectrumHallHz + hallElectricalHz()) / 2;
+        analyzeCurrentSpectrum(data, SPECTRAL_POINTS, info.sampleRateHz, electricalHz,
+                               motorParams.polePairs, &working.spectrum);
+    }
+    free(data);
+}
+
+void healthMonitorBegin(uint32_t intervalMs) {
+    checkInterval = intervalMs;
+    state = HEALTH_IDLE;
+    cycleStart = millis();
+}
+
+void healthMonitorSetInterval(uint32_t intervalMs) {
+    checkInterval = intervalMs;
+}
+
+bool healthMonitorTick() {
+    unsigned long now = millis();
+
+    switch (state) {
+        case HEALTH_IDLE:
+            if (spectrumRequested) {
+                spectrumRequested = false;
+                working = latest;
+                working.spectrum = SpectralHealth();
+                hallCaptureFlush();
+                hallStatsReset(&hallStats);
+                halMotorMove(SPECTRAL_TEST_VOLTAGE);
+                stepStart = now;
+                state = HEALTH_SPECTRUM_SETTLE;
+                break;
+            }
+            if (now - cycleStart < checkInterval) break;
+            cycleStart = now;
+            working = {
+                .phases = {true, true, true, 0.0, 0.0, 0.0},
+                .halls = {true, true, true, false, false, false},
+                .inductanceOK = false,
+                .motorTemperatureOK = true,
+                .spectrum = latest.spectrum,
+                .errorMessage = ""
+            };
+            currentPair = 0;
+            state = HEALTH_PHASE_EXCITE;
+            break;
+
+        case HEALTH_PHASE_EXCITE:
+            // Take the bridge away from the FOC task for this pair only
+            halHoldFoc(true);
+            applyPhasePair(currentPair, HEALTH_PHASE_TEST_VOLTAGE);
+            stepStart = now;
+            state = HEALTH_PHASE_SETTLE;
+            break;
+
+        case HEALTH_PHASE_SETTLE: {
+            if (now - stepStart < HEALTH_PHASE_SETTLE_MS) break;
+            // Current through the shunt in the pair's low phase
+            AdcChannel sense = phasePairs[currentPair].sense;
+            float current = adcAverageToUnits(sense, adcSamplerAverage(sense, PHASE_PAIR_AVERAGE_WINDOW));
+            pairResistance[currentPair] = phasePairResistance(HEALTH_PHASE_TEST_VOLTAGE, current);
+            halSetPwm(0, 0, 0);
+            stepStart = now;
+            state = HEALTH_PHASE_RELEASE;
+            break;
+        }
+
+        case HEALTH_PHASE_RELEASE:
+            if (now - stepStart < HEALTH_PHASE_RELEASE_MS) break;
+            currentPair++;
+            if (currentPair < 3) {
+                state = HEALTH_PHASE_EXCITE;
+            } else {
+                halHoldFoc(false);
+                storePairResistances(&working.phases, pairResistance);
+                state = HEALTH_HALL_START;
+            }
+            break;
+
+        case HEALTH_HALL_START:
+            // Edges are timestamped by the hall ISR, only count new ones
+            hallCaptureFlush();
+            hallStatsReset(&hallStats);
+            // Slowly turn the rotor, the FOC task keeps commutating
+            halMotorMove(HEALTH_HALL_TEST_VOLTAGE);
+            stepStart = now;
+            state = HEALTH_HALL_OBSERVE;
+            break;
+
+        case HEALTH_HALL_OBSERVE:
+            hallCaptureDrainStats(&hallStats);
+            working.halls.hallA_changing = hallStats.toggles[0] > 0;
+            working.halls.hallB_changing = hallStats.toggles[1] > 0;
+            working.halls.hallC_changing = hallStats.toggles[2] > 0;
+
+            // Stop observing early once every sensor has toggled
+            if (now - stepStart < HEALTH_HALL_WINDOW_MS &&
+                !(working.halls.hallA_changing && working.halls.hallB_changing &&
+                  working.halls.hallC_changing)) {
+                break;
+            }
+            halMotorMove(0);
+            working.halls.hallA_OK = working.halls.hallA_changing;
+            working.halls.hallB_OK = working.halls.hallB_changing;
+            working.halls.hallC_OK = working.halls.hallC_changing;
+            validateHallPatterns(&working.halls);
+            state = HEALTH_PUBLISH;
+            break;
+
+        case HEALTH_SPECTRUM_SETTLE: {
+            hallCaptureDrainStats(&hallStats);
+            if (now - stepStart < SPECTRAL_SETTLE_MS) break;
+
+            // Sample fast enough for the harmonics, slow enough that the
+            // window resolves the once per revolution sidebands
+            spectrumHallHz = hallElectricalHz();
+            ScopeConfig config = defaultScopeConfig();
+            config.channelMask = 1 << ADC_CH_I_SENSE1;
+            config.sampleRateHz = (uint32_t)(spectrumHallHz * SPECTRAL_RATE_PER_FE);
+            config.length = SPECTRAL_POINTS;
+            config.preTrigger = 0;
+            config.source = SCOPE_TRIGGER_IMMEDIATE;
+            config.timeoutMs = 0;
+            if (spectrumHallHz <= 0 || !scopeArm(config)) {
+                halMotorMove(0);
+                state = HEALTH_PUBLISH;
+                break;
+            }
+            spectrumTimeoutMs = (uint32_t)(1000.0f * SPECTRAL_POINTS / config.sampleRateHz) + HEALTH_SPECTRUM_SLACK_MS;
+            stepStart = now;
+            state = HEALTH_SPECTRUM_CAPTURE;
+            break;
+        }
+
+        case HEALTH_SPECTRUM_CAPTURE:
+            hallCaptureDrainStats(&hallStats);
+            if (scopeState() != SCOPE_DONE) {
+                if (now - stepStart < spectrumTimeoutMs) break;
+                scopeStop();
+            } else {
+                analyzeSpectrumCapture();
+            }
+            halMotorMove(0);
+            state = HEALTH_PUBLISH;
+            break;
+
+        case HEALTH_PUBLISH:
+            buildHealthMessage(&working);
+            latest = working;
+            snapshots++;
+            state = HEALTH_IDLE;
+            return true;
+    }
+
+    return false;
+}
+
+void healthMonitorAbort() {
+    if (state == HEALTH_IDLE) return;
+
+    if (state == HEALTH_PHASE_SETTLE || state == HEALTH_PHASE_RELEASE) {
+        halSetPwm(0, 0, 0);
+    } else if (state == HEALTH_HALL_OBSERVE || state == HEALTH_SPECTRUM_SETTLE) {
+        halMotorMove(0);
+    } else if (state == HEALTH_SPECTRUM_CAPTURE) {
+        scopeStop();
+        halMotorMove(0);
+    }
+    halHoldFoc(false);
+    state = HEALTH_IDLE;
+    cycleStart = millis();
+}
+
+void healthMonitorRequestSpectrum() {
+    spectrumRequested = true;
+}
+
+bool healthMonitorBusy() {
+    return state != HEALTH_IDLE;
+}
+
+HealthMonitorState healthMonitorState() {
+    return state;
+}
+
+MotorHealth getLatestHealth() {
+    return latest;
+}
+
+uint32_t healthSnapshotCount() {
+    return snapshots;
+}
@@ -0,0 +1,52 @@
+#ifndef HEALTH_MONITOR_H
+#define HEALTH_MONITOR_H
+
+#include <Arduino.h>
+#include "motor_analysis.h"
+
+// Incremental motor health monitor. Each call to healthMonitorTick() advances
+// the check by at most one small step and returns immediately, so the control
+// loop and telemetry keep running while a health cycle is in progress.
+// A spectral run (spectral_analysis.h) is only done on request: the rotor
+// spins at constant voltage while the scope records one phase current window.
+
+#define HEALTH_CHECK_INTERVAL     1000  // ms between the start of two cycles
+#define HEALTH_PHASE_TEST_VOLTAGE 0.5f  // V across one phase pair (phasePairs)
+#define HEALTH_PHASE_SETTLE_MS    100   // current and rotor settle time per pair
+#define HEALTH_PHASE_RELEASE_MS   50    // decay time after each pair
+#define HEALTH_HALL_TEST_VOLTAGE  1.0f  // V used to turn the rotor
+#define HEALTH_HALL_WINDOW_MS     1000  // hall observation window
+#define HEALTH_SPECTRUM_SLACK_MS  1000  // capture time allowed beyond the window length
+
+enum HealthMonitorState {
+    HEALTH_IDLE,
+    HEALTH_PHASE_EXCITE,
+    HEALTH_PHASE_SETTLE,
+    HEALTH_PHASE_RELEASE,
+    HEALTH_HALL_START,
+    HEALTH_HALL_OBSERVE,
+    HEALTH_SPECTRUM_SETTLE,
+    HEALTH_SPECTRUM_CAPTURE,
+    HEALTH_PUBLISH
+};
+
+void healthMonitorBegin(uint32_t intervalMs = HEALTH_CHECK_INTERVAL);
+void healthMonitorSetInterval(uint32_t intervalMs);
+
+// Advance the state machine; returns true when a new snapshot was published
+bool healthMonitorTick();
+
+// Abort a running cycle and release the bridge
+void healthMonitorAbort();
+
+// Run a spectral check as the next cycle, safe to call from any task
+void healthMonitorRequestSpectrum();
+
+bool healthMonitorBusy();
+HealthMonitorState healthMonitorState();
+
+// Last completed snapshot and the number of cycles completed so far
+MotorHealth getLatestHealth();
+uint32_t healthSnapshotCount();
+
+#endif
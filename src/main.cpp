@@ -2,22 +2,57 @@
 #include <WiFi.h>
 #include <AsyncTCP.h>
 #include <ESPAsyncWebServer.h>
+#include <LittleFS.h>
 #include "main.h"
 #include "webserver.h"
 #include "motor_analysis.h"
+#include "control_loop.h"
+#include "health_monitor.h"
+#include "scope_capture.h"
+#include "test_sequencer.h"
+#include "results_log.h"
+#include "foc_control.h"
+#ifdef BENCHMARK_MODE
+#include "benchmark.h"
+#endif
 
 // Global objects
 BLDCMotor motor = BLDCMotor(7); // Default to 7 pole pairs
 BLDCDriver3PWM driver = BLDCDriver3PWM(PIN_PWM_AH, PIN_PWM_BH, PIN_PWM_CH, PIN_EN_GATE);
 HallSensor sensor = HallSensor(PIN_HALL_A, PIN_HALL_B, PIN_HALL_C, 7); // Default to 7 pole pairs
+LowsideCurrentSense currentSense = LowsideCurrentSense(CURRENT_SENSE_RATIO * 1000, PIN_I_SENSE1, PIN_I_SENSE2);
 
 // Add these global variables at the top with other globals
-unsigned long lastCheckTime = 0;
-const unsigned long CHECK_INTERVAL = 1000; // Check every 1 second
-bool isTestRunning = false;
-bool isMeasuring = false;
+volatile bool isTestRunning = false;
+volatile bool isMeasuring = false;
 unsigned long lastVoltageCheck = 0;
 const unsigned long VOLTAGE_CHECK_INTERVAL = 1000; // Check every second
+unsigned long lastLoopStatsTime = 0;
+const unsigned long LOOP_STATS_INTERVAL = 1000; // Report control loop stats every second
+unsigned long lastTelemetryTime = 0;
+const unsigned long TELEMETRY_INTERVAL = 10; // Stream voltage and current at 100 Hz
+String lastHealthMessage = "";
+
+// Scope records go out a few chunks per pass, as fast as the clients take them
+const int SCOPE_CHUNKS_PER_PASS = 4;
+volatile bool scopeStreamRequested = false;
+int scopeNextChunk = -1;  // -1 while there is nothing to send
+int scopeChunkCount = 0;
+
+// Efficiency map points go out as the sweep finishes them
+int mapNextPoint = 0;
+
+// Manual saves to the results log, taken by the monitor task
+volatile bool resultsSaveRequested = false;
+char resultsSaveSerial[TEST_SERIAL_LENGTH];
+
+// Monitoring, JSON building and WebSocket traffic run on core 0
+TaskHandle_t monitorTaskHandle = nullptr;
+void monitorTask(void* arg);
+void runMonitoring();
+void streamScopeCapture();
+void streamEfficiencyMap();
+void logResults();
 
 void setup() {
   Serial.begin(115200);
@@ -26,9 +61,21 @@ void setup() {
   WiFi.mode(WIFI_AP);
   WiFi.softAP("BLDC-Tester", "password123");
   
+  // Characterise the ADC, then start background sampling of current and
+  // voltage channels
+  Serial.printf("ADC calibration: %s\n", adcCalSchemeName(adcCalibrationBegin()));
+  adcSamplerBegin();
+  
   // Initialize motor hardware
   driver.init();
   motor.linkDriver(&driver);
+  pinMode(PIN_FAULT, INPUT_PULLUP);
+  
+  // Current amplifier offsets while the gates are still off
+  pinMode(PIN_DC_CAL, OUTPUT);
+  if (!adcCalibrateOffsets()) {
+    Serial.println("Current offset calibration failed");
+  }
   
   // Default motor configuration
   motor.voltage_limit = 12;
@@ -37,6 +84,38 @@ void setup() {
   // Initialize motor
   motor.init();
   
+  // Phase currents sampled in the PWM valley. SimpleFOC sets ADC1 up for its
+  // interrupt, the sampler hands the unit over and takes its feed from the
+  // control loop from here on.
+  adcSamplerStop();
+  currentSense.linkDriver(&driver);
+  if (currentSense.init()) {
+    // The amplifiers see the current leaving the motor
+    currentSense.gain_a *= -1;
+    currentSense.gain_b *= -1;
+    // Wiring and polarity are fixed by the board, initFOC need not probe them
+    currentSense.skip_align = true;
+    motor.linkCurrentSense(&currentSense);
+    adcSamplerSyncToPwm(true, FOC_LOOP_RATE_HZ);
+  } else {
+    Serial.println("Current sense init failed, FOC runs without currents");
+  }
+  adcSamplerBegin();
+  
+  // Timestamp every hall edge in the sensor ISR
+  hallCaptureBegin();
+  
+#ifdef BENCHMARK_MODE
+  // Kernel timings, before the control and monitor tasks compete for the CPU
+  runBenchmarks([](const char* line) { Serial.println(line); });
+#endif
+  
+  // Stored production test plan and the results of earlier units
+  testSequencerBegin();
+  if (!LittleFS.begin(true) || !resultsLogBegin("/littlefs/results")) {
+    Serial.println("Results log unavailable");
+  }
+  
   // Setup web server
   setupWebServer();
   
@@ -44,52 +123,113 @@ void setup() {
   StaticJsonDocument<200> doc;
   doc["voltageLimit"] = motor.voltage_limit;
   doc["direction"] = (motor.sensor_direction == Direction::CW) ? "CW" : "CCW";
-  String jsonString;
-  serializeJson(doc, jsonString);
-  broadcastJson(jsonString);
+  broadcastJson(doc);
+  
+  // Start the fixed-rate FOC task on core 1 and the monitor task on core 0
+  controlLoopBegin(FOC_LOOP_RATE_HZ);
+  healthMonitorBegin(HEALTH_CHECK_INTERVAL);
+  xTaskCreatePinnedToCore(monitorTask, "monitor", 8192, nullptr, 1, &monitorTaskHandle, 0);
 }
 
 void loop() {
-    // Basic FOC loop
-    motor.loopFOC();
+    // All work happens in the control and monitor tasks
+    vTaskDelete(NULL);
+}
+
+void monitorTask(void* arg) {
+    for (;;) {
+        runMonitoring();
+        vTaskDelay(1); // Health monitor polls halls once per tick
+    }
+}
 
+void runMonitoring() {
     // Current time
     unsigned long currentTime = millis();
 
-    // Regular monitoring when not running tests
-    if (!isTestRunning && !isMeasuring && (currentTime - lastCheckTime >= CHECK_INTERVAL)) {
-        lastCheckTime = currentTime;
+    // Closed-loop commands from the web UI
+    if (focControlTick()) {
+        broadcastFocControl();
+    }
+
+    // Advance the health check by one step, tests, measurements and
+    // closed-loop control own the motor
+    bool healthReady = false;
+    if (isTestRunning || isMeasuring || focControlActive()) {
+        healthMonitorAbort();
+    } else {
+        healthReady = healthMonitorTick();
+    }
+
+    // Publish completed health snapshots
+    if (healthReady) {
+        MotorHealth health = getLatestHealth();
         
-        // Get motor health status
-        MotorHealth health = checkMotorHealth();
+        uint16_t flags = 0;
+        if (health.phases.phaseA_OK) flags |= HEALTH_FLAG_PHASE_A;
+        if (health.phases.phaseB_OK) flags |= HEALTH_FLAG_PHASE_B;
+        if (health.phases.phaseC_OK) flags |= HEALTH_FLAG_PHASE_C;
+        if (health.halls.hallA_OK) flags |= HEALTH_FLAG_HALL_A;
+        if (health.halls.hallB_OK) flags |= HEALTH_FLAG_HALL_B;
+        if (health.halls.hallC_OK) flags |= HEALTH_FLAG_HALL_C;
+        float resistances[3] = {
+            health.phases.phaseA_resistance,
+            health.phases.phaseB_resistance,
+            health.phases.phaseC_resistance
+        };
+        broadcastTelemetry(TELEMETRY_CH_HEALTH, flags, resistances, 3);
+
+        // Spectral indicators of the last spectral run
+        const SpectralHealth& spectrum = health.spectrum;
+        uint16_t spectrumFlags = 0;
+        if (spectrum.valid) spectrumFlags |= SPECTRUM_FLAG_VALID;
+        if (spectrum.spectrumOK) spectrumFlags |= SPECTRUM_FLAG_OK;
+        float spectrumValues[7 + SPECTRAL_HARMONICS] = {
+            spectrum.electricalHz, spectrum.sampleRateHz, spectrum.fundamental, spectrum.thd,
+            spectrum.sidebandRatio, spectrum.mechanicalRatio, spectrum.noiseRatio
+        };
+        for (int i = 0; i < SPECTRAL_HARMONICS; i++) spectrumValues[7 + i] = spectrum.harmonics[i];
+        broadcastTelemetry(TELEMETRY_CH_SPECTRUM, spectrumFlags, spectrumValues, 7 + SPECTRAL_HARMONICS);
         
-        // If there are issues, broadcast to web clients
-        if (!health.phases.phaseA_OK || !health.phases.phaseB_OK || !health.phases.phaseC_OK ||
-            !health.halls.hallA_OK || !health.halls.hallB_OK || !health.halls.hallC_OK) {
-            
-            // Create JSON with health status
-            String json = "{\"health\":{" 
-                         "\"phases\":{" 
-                         "\"phaseA_OK\":" + String(health.phases.phaseA_OK ? "true" : "false") + ","
-                         "\"phaseB_OK\":" + String(health.phases.phaseB_OK ? "true" : "false") + ","
-                         "\"phaseC_OK\":" + String(health.phases.phaseC_OK ? "true" : "false") + "},"
-                         "\"halls\":{" 
-                         "\"hallA_OK\":" + String(health.halls.hallA_OK ? "true" : "false") + ","
-                         "\"hallB_OK\":" + String(health.halls.hallB_OK ? "true" : "false") + ","
-                         "\"hallC_OK\":" + String(health.halls.hallC_OK ? "true" : "false") + "},"
-                         "\"errorMessage\":\"" + health.errorMessage + "\""
-                         "}}";
-            
-            // Broadcast to all connected clients
-            // We'll need to implement this in webserver.cpp
-            broadcastJson(json);
+        // The text message only goes out when it changes
+        if (health.errorMessage != lastHealthMessage) {
+            lastHealthMessage = health.errorMessage;
+            StaticJsonDocument<384> doc;
+            doc["healthMessage"] = health.errorMessage;
+            broadcastJson(doc);
         }
+    }
+
+    // Stream voltage and current
+    if (currentTime - lastTelemetryTime >= TELEMETRY_INTERVAL) {
+        lastTelemetryTime = currentTime;
+        float analog[2] = {measureInputVoltage(), getCurrentReading()};
+        broadcastTelemetry(TELEMETRY_CH_ANALOG, 0, analog, 2);
 
-        // Monitor current
-        float current = getCurrentReading();
-        if (current > 0.1) { // Only send if there's significant current
-            String json = "{\"current\":" + String(current, 3) + "}";
-            broadcastJson(json);
+        // Drain the control task's samples in batches of up to 16
+        ControlSample samples[TELEMETRY_MAX_VALUES / 4];
+        size_t count;
+        while ((count = drainControlSamples(samples, TELEMETRY_MAX_VALUES / 4)) > 0) {
+            float values[TELEMETRY_MAX_VALUES];
+            for (size_t i = 0; i < count; i++) {
+                values[i * 4] = samples[i].velocity;
+                values[i * 4 + 1] = samples[i].electricalAngle;
+                values[i * 4 + 2] = samples[i].voltageQ;
+                values[i * 4 + 3] = samples[i].voltageD;
+            }
+            broadcastTelemetry(TELEMETRY_CH_MOTOR_STATE, controlSamplePeriodUs(), values, count * 4,
+                               samples[0].timestampUs);
+
+            // The current loop of the same samples, while it is closed
+            if (!focControlActive()) continue;
+            for (size_t i = 0; i < count; i++) {
+                values[i * 4] = samples[i].currentQ;
+                values[i * 4 + 1] = samples[i].currentD;
+                values[i * 4 + 2] = samples[i].voltageQ;
+                values[i * 4 + 3] = samples[i].voltageD;
+            }
+            broadcastTelemetry(TELEMETRY_CH_CURRENT_LOOP, controlSamplePeriodUs(), values, count * 4,
+                               samples[0].timestampUs);
         }
     }
 
@@ -98,18 +238,155 @@ void loop() {
         lastVoltageCheck = currentTime;
         float voltage = measureInputVoltage();
         
-        // Create JSON for WebSocket
-        String json = "{\"voltage\":" + String(voltage, 2) + "}";
-        broadcastJson(json);
-        
         // Update motor voltage limit if it changed significantly
         if (abs(motor.voltage_limit - voltage) > 0.5) {
             motor.voltage_limit = voltage;
         }
     }
 
-    // Handle any pending web requests
-    // This is handled by ESPAsyncWebServer automatically
+    // Report control loop rate and jitter
+    if (currentTime - lastLoopStatsTime >= LOOP_STATS_INTERVAL) {
+        lastLoopStatsTime = currentTime;
+        ControlLoopStats stats = getControlLoopStats();
+        float loopValues[6] = {
+            (float)stats.rateHz, stats.measuredRateHz, (float)stats.maxJitterUs,
+            (float)stats.maxExecUs, (float)stats.overruns, (float)controlSampleOverruns()
+        };
+        broadcastTelemetry(TELEMETRY_CH_CONTROL_LOOP, 0, loopValues, 6);
+
+        // Heap and broadcast pool counters, to spot leaks and fragmentation
+        BroadcastStats broadcast = getBroadcastStats();
+        float systemValues[7] = {
+            (float)ESP.getFreeHeap(), (float)ESP.getMinFreeHeap(), (float)ESP.getMaxAllocHeap(),
+            (float)broadcast.messages, (float)broadcast.bufferAllocations,
+            (float)broadcast.bufferReuses, (float)broadcast.poolExhausted
+        };
+        broadcastTelemetry(TELEMETRY_CH_SYSTEM, 0, systemValues, 7);
+
+        // Queue depth and losses of every WebSocket client
+        PublisherClientStats clients[PUBLISHER_MAX_CLIENTS];
+        size_t clientCount = getPublisherClientStats(clients, PUBLISHER_MAX_CLIENTS);
+        float clientValues[PUBLISHER_MAX_CLIENTS * 5];
+        for (size_t i = 0; i < clientCount; i++) {
+            clientValues[i * 5] = clients[i].id;
+            clientValues[i * 5 + 1] = clients[i].queued;
+            clientValues[i * 5 + 2] = clients[i].sent;
+            clientValues[i * 5 + 3] = clients[i].coalesced;
+            clientValues[i * 5 + 4] = clients[i].dropped;
+        }
+        broadcastTelemetry(TELEMETRY_CH_CLIENTS, 0, clientValues, clientCount * 5);
+    }
+
+    // Scope timeout and streaming of finished records
+    if (scopeTick()) {
+        restartScopeStream();
+    }
+    streamScopeCapture();
+    streamEfficiencyMap();
+
+    logResults();
+
+    // Hand the newest telemetry to clients that were too busy for it
+    flushTelemetry();
+}
+
+void restartScopeStream() {
+    scopeStreamRequested = true;
+}
+
+void requestResultsSave(const char* serial) {
+    strncpy(resultsSaveSerial, serial ? serial : "", TEST_SERIAL_LENGTH - 1);
+    resultsSaveSerial[TEST_SERIAL_LENGTH - 1] = 0;
+    resultsSaveRequested = true;
+}
+
+void logResults() {
+    // Appended here because the health snapshot belongs to this task
+    ResultRecord record;
+    TestRecord unit;
+    bool ready = false;
+    if (testSequencerTakeRecord(&unit)) {
+        fillResultRecord(&record, unit.serial, &unit, motorParams, getLatestHealth());
+        ready = true;
+    } else if (resultsSaveRequested) {
+        resultsSaveRequested = false;
+        fillResultRecord(&record, resultsSaveSerial, nullptr, motorParams, getLatestHealth());
+        ready = true;
+    }
+    if (!ready) return;
+
+    StaticJsonDocument<128> doc;
+    JsonObject logged = doc.createNestedObject("resultsLogged");
+    logged["serial"] = record.serial;
+    logged["stored"] = resultsLogAppend(&record);
+    logged["sequence"] = record.sequence;
+    logged["records"] = resultsLogCount();
+    broadcastJson(doc);
+}
+
+void streamScopeCapture() {
+    ScopeCaptureInfo info;
+    if (!scopeCaptureInfo(&info)) {
+        scopeNextChunk = -1;
+        return;
+    }
+
+    if (scopeStreamRequested) {
+        scopeStreamRequested = false;
+        uint32_t values = (uint32_t)info.length * info.channels;
+        scopeChunkCount = 1 + (values + TELEMETRY_MAX_VALUES - 1) / TELEMETRY_MAX_VALUES;
+        scopeNextChunk = 0;
+    }
+
+    for (int pass = 0; pass < SCOPE_CHUNKS_PER_PASS; pass++) {
+        if (scopeNextChunk < 0 || scopeNextChunk >= scopeChunkCount) return;
+        // Chunks are never coalesced, so wait until every client can take one
+        if (!telemetryEventRoom()) return;
+
+        float values[TELEMETRY_MAX_VALUES];
+        uint8_t count;
+        if (scopeNextChunk == 0) {
+            values[0] = info.channelMask;
+            values[1] = info.sampleRateHz;
+            values[2] = info.length;
+            values[3] = info.triggerIndex;
+            values[4] = scopeChunkCount;
+            values[5] = info.source;
+            values[6] = info.forced ? 1 : 0;
+            values[7] = info.voltageRateHz;
+            count = 8;
+        } else {
+            count = scopeReadValues((uint32_t)(scopeNextChunk - 1) * TELEMETRY_MAX_VALUES,
+                                    values, TELEMETRY_MAX_VALUES);
+        }
+
+        if (!broadcastTelemetry(TELEMETRY_CH_SCOPE, scopeNextChunk, values, count, info.triggerTimeUs)) return;
+        scopeNextChunk++;
+    }
+}
+
+void streamEfficiencyMap() {
+    FocControlState state = focControlState();
+    // A new sweep started over
+    if (state.mapPoints < mapNextPoint) mapNextPoint = 0;
+
+    EfficiencyMapPoint point;
+    while (mapNextPoint < state.mapPoints && focControlMapPoint(mapNextPoint, &point)) {
+        // Rows are never coalesced either
+        if (!telemetryEventRoom()) return;
+        uint16_t status = mapNextPoint & MAP_POINT_INDEX_MASK;
+        if (point.converged) status |= MAP_FLAG_CONVERGED;
+        if (point.limited) status |= MAP_FLAG_LIMITED;
+        if (mapNextPoint + 1 == state.mapSpeedSteps * state.mapCurrentSteps) status |= MAP_FLAG_LAST;
+        float values[16] = {
+            (float)state.mapSpeedSteps, (float)state.mapCurrentSteps, point.speedSetpoint, point.currentLimit,
+            point.velocity, point.currentQ, point.currentD, point.voltageQ, point.voltageD, point.supply,
+            point.inputCurrent, point.inputPower, point.torque, point.mechanicalPower, point.efficiency,
+            (float)point.dwellMs
+        };
+        if (!broadcastTelemetry(TELEMETRY_CH_EFFICIENCY_MAP, status, values, 16)) return;
+        mapNextPoint++;
+    }
 }
 
 void setupDriver() {
@@ -146,15 +423,6 @@ void setupMotor() {
 }
 
 float readSupplyVoltage() {
-    const int samples = 10;  // Average over 10 samples for stability
-    float voltageSum = 0;
-    
-    for(int i = 0; i < samples; i++) {
-        int adcValue = analogRead(PIN_VIN_SENSE);
-        float voltage = (adcValue * 3.2f / ADC_MAX_VALUE) * VIN_SCALE_FACTOR;
-        voltageSum += voltage;
-        delay(1);
-    }
-    
-    return voltageSum / samples;
+    // Average over the most recent sampler values for stability
+    return adcAverageToUnits(ADC_CH_VIN, adcSamplerAverage(ADC_CH_VIN, VOLTAGE_AVERAGE_WINDOW));
 }
\ No newline at end of file
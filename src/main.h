@@ -1,8 +1,11 @@
 #ifndef MAIN_H
 #define MAIN_H
 
+#ifdef ARDUINO
 #include <Arduino.h>
 #include <SimpleFOC.h>
+#endif
+#include "hal.h"
 
 // LED (LED pins)
 #define PIN_LED1 2
@@ -41,15 +44,35 @@
 #define ADC_BITS        12                // ESP32 ADC resolution
 #define ADC_MAX_VALUE   ((1 << ADC_BITS) - 1)  // 4095 for 12-bit
 
+// Nominal full scale at 11 dB, adc_calibration replaces it with the chip's
+// eFuse characterisation where available
+#define ADC_REFERENCE   3.2f
+
+// Current sense amplifier output in volts per amp (DRV8302 gain 10, 5 mOhm shunt)
+#define CURRENT_SENSE_RATIO 0.05f
+
+#ifdef ARDUINO
 // Motor driver instance
 extern BLDCDriver3PWM driver;
 extern BLDCMotor motor;
 extern HallSensor sensor;
+extern LowsideCurrentSense currentSense;
+#endif
+
+// Shared between the control task (core 1) and the monitor task (core 0)
+extern volatile bool isTestRunning;
+extern volatile bool isMeasuring;
 
+#ifdef ARDUINO
 // Function declarations
 void setupMotor();
 void setupDriver();
 void setupHallSensor();
 float readSupplyVoltage();
+// Stream the finished scope record (again) from its first chunk
+void restartScopeStream();
+// Store the current parameters and health in the results log
+void requestResultsSave(const char* serial);
+#endif
 
 #endif // MAIN_H 
\ No newline at end of file
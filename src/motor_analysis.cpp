@@ -1,39 +1,94 @@
 #include "motor_analysis.h"
 #include "main.h"
+#include "scope_capture.h"
+#include <string.h>
 // Add these function prototypes
 void checkHallSensors(HallStatus* halls);
-void validateHallPatterns(HallStatus* halls);
 String getPhaseError(float resistance);
 String getHallError(bool changing);
-float getCurrentReading();
-float measureInputVoltage();
+String getSpectrumError(const SpectralHealth& spectrum);
+float waitForFreshAverage(AdcChannel channel, uint16_t samples);
+float measurePairTimeConstant(int pair, float voltage, float tauHint, float maxTau);
 
 // Global variables for measurement results
 MotorParameters motorParams = {
     .phaseResistance = 0.0,
     .phaseInductance = 0.0,
     .polePairs = 0,
-    .hallValid = false
+    .hallValid = false,
+    .inputVoltage = 0.0,
+    .motorKv = 0.0,
+    .pairInductance = {0.0, 0.0, 0.0},
+    .motorKe = 0.0,
+    .polePairConfidence = 0.0,
+    .measured = 0
 };
 
+// Coast-down turns, too large for the caller's stack
+static BackEmfCapture coastDown;
+
+static BridgeMode bridgeMode = BRIDGE_RELEASED;
+
+void useBridge(BridgeMode mode) {
+    if (mode == bridgeMode) return;
+
+    switch (mode) {
+        case BRIDGE_DIRECT:
+            // Take the bridge away from FOC and let the rotor come to rest
+            halHoldFoc(true);
+            halMotorDisable();
+            halDriverEnable();
+            halSetPwm(0, 0, 0);
+            delay(BRIDGE_SETTLE_MS);
+            break;
+        case BRIDGE_FOC:
+            halSetPwm(0, 0, 0);
+            halMotorEnable();
+            halHoldFoc(false);
+            halMotorMove(0);
+            break;
+        case BRIDGE_TRIPPED:
+            // Stays held, only the next mode or releaseBridge() lets FOC back
+            halHoldFoc(true);
+            halMotorDisable();
+            break;
+        case BRIDGE_RELEASED:
+            releaseBridge();
+            return;
+    }
+    bridgeMode = mode;
+}
+
+void releaseBridge() {
+    halSetPwm(0, 0, 0);
+    halMotorEnable();
+    halHoldFoc(false);
+    halMotorMove(0);
+    bridgeMode = BRIDGE_RELEASED;
+}
+
 bool measureMotorParameters() {
-    // Disable FOC control during measurement
-    motor.disable();
-    delay(500);
+    motorParams.measured = 0;
 
     // Measure phase resistance
     motorParams.phaseResistance = measurePhaseResistance();
     
     // Check if resistance is within reasonable bounds
     if (motorParams.phaseResistance < 0.01 || motorParams.phaseResistance > 100.0) {
+        releaseBridge();
         return false;
     }
+    motorParams.measured |= MEASURED_RESISTANCE;
 
-    // Measure inductance (simplified method)
+    // Measure inductance from the current step response of each phase pair
     motorParams.phaseInductance = measurePhaseInductance();
+    if (motorParams.phaseInductance > 0) motorParams.measured |= MEASURED_INDUCTANCE;
     
     // Detect pole pairs using hall sensors
     motorParams.polePairs = detectPolePairs();
+    if (motorParams.polePairs > 0 && motorParams.polePairConfidence >= POLE_MIN_CONFIDENCE) {
+        motorParams.measured |= MEASURED_POLE_PAIRS;
+    }
     
     // Verify hall sensor functionality
     motorParams.hallValid = verifyHallSensors();
@@ -42,43 +97,102 @@ bool measureMotorParameters() {
     motorParams.inputVoltage = measureInputVoltage();
     
     // Update motor voltage limit
-    motor.voltage_limit = motorParams.inputVoltage;
+    halSetVoltageLimit(motorParams.inputVoltage);
     
-    return true;
+    releaseBridge();
+    return motorParams.measured == MEASURED_ALL;
+}
+
+const PhasePair phasePairs[3] = {
+    {1.0f, 0.0f, 0.5f, ADC_CH_I_SENSE2},   // A -> B
+    {0.5f, 0.0f, 1.0f, ADC_CH_I_SENSE2},   // C -> B (pair BC)
+    {0.0f, 0.5f, 1.0f, ADC_CH_I_SENSE1}    // C -> A (pair CA)
+};
+
+void applyPhasePair(int pair, float voltage) {
+    const PhasePair& p = phasePairs[pair];
+    halSetPwm(voltage * p.ua, voltage * p.ub, voltage * p.uc);
+}
+
+float phasePairResistance(float voltage, float current) {
+    if (current < PHASE_PAIR_MIN_CURRENT) return INFINITY;
+    return voltage / current;
+}
+
+void storePairResistances(PhaseStatus* phases, const float pairResistance[3]) {
+    // Phase k is in pairs k and k + 2, the pair k + 1 is the other two
+    bool open[3];
+    for (int k = 0; k < 3; k++) {
+        open[k] = isinf(pairResistance[k]) && isinf(pairResistance[(k + 2) % 3]);
+    }
+
+    float resistance[3];
+    for (int k = 0; k < 3; k++) {
+        float own = pairResistance[k], other = pairResistance[(k + 2) % 3];
+        if (open[k]) {
+            resistance[k] = INFINITY;
+        } else if (isinf(own) || isinf(other)) {
+            // The open pair leads to an open phase, the remaining pair is
+            // this phase and the good one in series
+            resistance[k] = (isinf(own) ? other : own) / 2;
+        } else {
+            resistance[k] = (own + other - pairResistance[(k + 1) % 3]) / 2;
+        }
+    }
+
+    phases->phaseA_resistance = resistance[0];
+    phases->phaseB_resistance = resistance[1];
+    phases->phaseC_resistance = resistance[2];
+    phases->phaseA_OK = resistance[0] >= 0.01 && resistance[0] <= 100.0;
+    phases->phaseB_OK = resistance[1] >= 0.01 && resistance[1] <= 100.0;
+    phases->phaseC_OK = resistance[2] >= 0.01 && resistance[2] <= 100.0;
+}
+
+// Average current of a pair once it stopped changing. The rise of a slow
+// motor and the rotor swinging onto the field both outlast a fixed wait.
+static float settledCurrent(AdcChannel channel) {
+    float previous = adcAverageToUnits(channel, waitForFreshAverage(channel, RESISTANCE_SETTLE_WINDOW));
+    unsigned long start = millis();
+    while (millis() - start < RESISTANCE_SETTLE_TIMEOUT_MS) {
+        float average = adcAverageToUnits(channel, waitForFreshAverage(channel, RESISTANCE_SETTLE_WINDOW));
+        bool settled = fabsf(average - previous) <= RESISTANCE_SETTLED * fabsf(average) + PHASE_PAIR_MIN_CURRENT;
+        previous = average;
+        if (settled) break;
+    }
+    return previous;
 }
 
 float measurePhaseResistance() {
-    const float testVoltage = 0.5; // Reduced to 0.5V for safer testing
-    const int samples = 100;
-    
-    // Configure ADC for current sensing
-    analogReadResolution(12); // ESP32 12-bit ADC
-    analogSetAttenuation(ADC_11db); // For 3.3V range
-    
-    // Apply test voltage to phase A
-    driver.setPwm(testVoltage, 0, 0);
-    delay(100); // Wait for current to stabilize
-    
-    // Sample current through ADC
-    float totalCurrent = 0;
-    for(int i = 0; i < samples; i++) {
-        int adcValue = analogRead(CURRENT_SENSE_PIN);
-        float voltage = (adcValue * 3.3) / 4095.0; // Convert to voltage
-        float current = voltage / CURRENT_SENSE_RATIO; // Convert to amperes
-        totalCurrent += current;
-        delay(1);
+    const float probeVoltage = 0.5; // Reduced to 0.5V for safer testing
+    float supply = measureInputVoltage();
+    float maxVoltage = supply > 0 ? supply / 2 : probeVoltage;
+    
+    // Drive A -> B with C at the neutral point, the current returns through
+    // the phase B low-side shunt
+    const PhasePair& pair = phasePairs[0];
+    useBridge(BRIDGE_DIRECT);
+    
+    // The probe pulls the rotor onto the pair's field, where it stands still
+    // for the measurement, and sizes the voltage for the test current
+    applyPhasePair(0, probeVoltage);
+    float probeCurrent = settledCurrent(pair.sense);
+    float testVoltage = probeVoltage;
+    if (probeCurrent >= PHASE_PAIR_MIN_CURRENT) {
+        testVoltage = min(probeVoltage * RESISTANCE_TEST_CURRENT / probeCurrent, maxVoltage);
     }
-    float averageCurrent = totalCurrent / samples;
+    applyPhasePair(0, testVoltage);
+    float averageCurrent = settledCurrent(pair.sense);
     
     // Disable output
-    driver.setPwm(0, 0, 0);
+    halSetPwm(0, 0, 0);
     
     // R = V/I
-    if(averageCurrent < 0.001) { // Avoid division by zero
+    if(averageCurrent < PHASE_PAIR_MIN_CURRENT) { // Avoid division by zero
         return 0.0; // Indicates an error condition
     }
     
-    float resistance = testVoltage / averageCurrent;
+    // Two phases in series
+    float resistance = testVoltage / averageCurrent / 2;
     
     // Sanity check the measured resistance
     if (resistance < 0.01 || resistance > 100.0) {
@@ -88,89 +202,385 @@ float measurePhaseResistance() {
     return resistance;
 }
 
-float measurePhaseInductance() {
-    // Simplified inductance measurement
-    // This is a placeholder - proper implementation would require
-    // voltage step response analysis
-    return 0.001; // Default value in Henries
+static uint16_t stepRaw[INDUCTANCE_BURST_SAMPLES];
+static uint32_t stepTime[INDUCTANCE_BURST_SAMPLES];
+static uint16_t interleaveRaw[INDUCTANCE_BURST_SAMPLES / INDUCTANCE_INTERLEAVE];
+static uint32_t interleaveTime[INDUCTANCE_BURST_SAMPLES / INDUCTANCE_INTERLEAVE];
+
+static void waitUs(uint32_t us) {
+    delay(us / 1000);
+    delayMicroseconds(us % 1000);
 }
 
-int detectPolePairs() {
-    // Initialize variables to store hall sensor states
-    int hallState1, hallState2;
-    int transitions = 0;
-    unsigned long startTime = millis();
-    const unsigned long timeout = 5000; // 5 second timeout
-    
-    // Apply a small voltage to slowly rotate the motor
-    motor.move(1.0); // Small constant voltage
-    delay(100);
-    
-    // Get initial hall state
-    hallState1 = (digitalRead(HALL_A) << 2) | 
-                 (digitalRead(HALL_B) << 1) | 
-                  digitalRead(HALL_C);
-    
-    // Count hall state transitions
-    while ((millis() - startTime) < timeout) {
-        hallState2 = (digitalRead(HALL_A) << 2) | 
-                    (digitalRead(HALL_B) << 1) | 
-                     digitalRead(HALL_C);
-        
-        if (hallState1 != hallState2) {
-            transitions++;
-            hallState1 = hallState2;
+// One step of the pair into stepRaw/stepTime, the bridge is back at zero
+// afterwards. With interleave > 1 the step is repeated that many times, each
+// capture starting spacingUs / interleave later, and the captures are merged
+// into one at that finer spacing. Returns the samples captured, 0 if the
+// sampler delivered none.
+static uint16_t captureStep(int pair, float voltage, uint32_t spacingUs, uint8_t interleave, float* baseline) {
+    const PhasePair& p = phasePairs[pair];
+
+    // Zero current reference right before the step
+    halSetPwm(0, 0, 0);
+    uint16_t n = adcSamplerBurst(p.sense, stepRaw, stepTime, INDUCTANCE_BASELINE_SAMPLES);
+    if (n < INDUCTANCE_BASELINE_SAMPLES) return 0;
+    *baseline = 0;
+    for (uint16_t i = 0; i < n; i++) *baseline += stepRaw[i];
+    *baseline /= n;
+
+    if (interleave <= 1) {
+        applyPhasePair(pair, voltage);
+        n = adcSamplerBurst(p.sense, stepRaw, stepTime, INDUCTANCE_BURST_SAMPLES, spacingUs);
+        halSetPwm(0, 0, 0);
+        return n < INDUCTANCE_BASELINE_SAMPLES ? 0 : n;
+    }
+
+    uint16_t perCapture = INDUCTANCE_BURST_SAMPLES / interleave;
+    for (uint8_t k = 0; k < interleave; k++) {
+        uint32_t offsetUs = k * spacingUs / interleave;
+        applyPhasePair(pair, voltage);
+        delayMicroseconds(offsetUs);
+        n = adcSamplerBurst(p.sense, interleaveRaw, interleaveTime, perCapture, spacingUs);
+        halSetPwm(0, 0, 0);
+        if (n < perCapture) return 0;
+        for (uint16_t i = 0; i < perCapture; i++) {
+            stepRaw[i * interleave + k] = interleaveRaw[i];
+            stepTime[i * interleave + k] = interleaveTime[i] + offsetUs;
         }
-        
-        // One mechanical rotation should give us 6 hall state transitions
-        // per pole pair
-        if (transitions >= 6) {
+        // The rise settled within the capture, so does the decay
+        waitUs(interleaveTime[perCapture - 1]);
+    }
+    return perCapture * interleave;
+}
+
+static float burstMean(AdcChannel channel, uint16_t count, uint32_t spacingUs) {
+    uint16_t n = adcSamplerBurst(channel, stepRaw, stepTime, count, spacingUs);
+    float sum = 0;
+    for (uint16_t i = 0; i < n; i++) sum += stepRaw[i];
+    return n ? sum / n : -1;
+}
+
+// Pull the rotor onto the pair's field, where the steps exert no torque, so
+// no back-EMF bends the rise. A rotor with a strong back-EMF and a low
+// resistance creeps onto the field for a long time, the current only stops
+// changing once it is there. Returns after the current decayed again, false
+// if the sampler delivered nothing.
+static bool alignToPair(int pair, float voltage, float maxTau) {
+    const PhasePair& p = phasePairs[pair];
+    applyPhasePair(pair, voltage);
+    delay(INDUCTANCE_ALIGN_MS);
+    float aligned = burstMean(p.sense, INDUCTANCE_ALIGN_SAMPLES, INDUCTANCE_ALIGN_SPACING_US);
+    if (aligned < 0) {
+        halSetPwm(0, 0, 0);
+        return false;
+    }
+    unsigned long start = millis();
+    while (millis() - start < INDUCTANCE_ALIGN_TIMEOUT_MS) {
+        float mean = burstMean(p.sense, INDUCTANCE_ALIGN_SAMPLES, INDUCTANCE_ALIGN_SPACING_US);
+        bool settled = fabsf(mean - aligned) <= RESISTANCE_SETTLED * mean;
+        aligned = mean;
+        if (settled) break;
+    }
+    float alignedCurrent = adcAverageToUnits(p.sense, aligned);
+    halSetPwm(0, 0, 0);
+
+    uint32_t decayStart = micros();
+    uint32_t timeoutUs = (uint32_t)(maxTau * 1e6f * INDUCTANCE_DECAY_TAUS);
+    while (micros() - decayStart < timeoutUs) {
+        float current = adcAverageToUnits(p.sense, burstMean(p.sense, INDUCTANCE_DECAY_SAMPLES, 0));
+        if (current < INDUCTANCE_DECAY_LEFT * alignedCurrent) break;
+    }
+    return true;
+}
+
+// Time constant of one pair in s, 0 if the fit failed and -1 if the sampler
+// delivered no capture at all. The window starts at tauHint (0 for the
+// burst's own rate) and grows until the rise settles, up to maxTau.
+float measurePairTimeConstant(int pair, float voltage, float tauHint, float maxTau) {
+    if (!alignToPair(pair, voltage, maxTau)) return -1;
+    uint32_t spacingUs = (uint32_t)(tauHint * 1e6f * INDUCTANCE_WINDOW_TAUS / INDUCTANCE_BURST_SAMPLES);
+    uint8_t interleave = 1;
+
+    for (;;) {
+        float baseline;
+        uint16_t n = captureStep(pair, voltage, spacingUs, interleave, &baseline);
+        if (n == 0) return -1;
+
+        RLFitResult fit = fitRLStep(stepTime, stepRaw, n, baseline);
+        uint32_t windowUs = stepTime[n - 1];
+        uint32_t actualSpacing = (windowUs + n - 2) / (n - 1);
+
+        if (fit.valid) {
+            waitUs((uint32_t)(fit.tau * 1e6f * INDUCTANCE_DECAY_TAUS));
+            return fit.tau;
+        }
+        if (fit.tooFast && interleave == 1) {
+            // Settled within a few samples: from a hint that was too long
+            // at the burst's own rate first, then interleaved at that rate
+            waitUs(windowUs);
+            if (spacingUs > 0) {
+                spacingUs = 0;
+            } else {
+                spacingUs = actualSpacing;
+                interleave = INDUCTANCE_INTERLEAVE;
+            }
+            continue;
+        }
+        if (fit.settled || fit.finalValue <= 0 || interleave > 1 ||
+            windowUs >= maxTau * 1e6f * INDUCTANCE_WINDOW_TAUS) {
+            // Fit failed on a settled capture, no current at all, or the
+            // window already covers the longest plausible rise
+            waitUs(windowUs);
             break;
         }
-        delay(1);
+
+        // Rise slower than the capture window, stretch the window. The
+        // wait lasts as long as the next capture, whose rise has to start
+        // from zero.
+        spacingUs = actualSpacing * INDUCTANCE_WINDOW_GROWTH;
+        waitUs(windowUs * INDUCTANCE_WINDOW_GROWTH);
     }
-    
-    // Stop the motor
-    motor.move(0);
-    
-    // Calculate pole pairs based on transitions
-    // In one mechanical rotation, we should see 6 transitions per pole pair
-    if (transitions == 0) return 7; // Default if detection fails
-    
-    return transitions / 6;
+
+    return 0.0;
+}
+
+float measurePhaseInductance() {
+    // L = R * tau, needs the phase resistance from measurePhaseResistance()
+    if (motorParams.phaseResistance <= 0) {
+        return 0.0;
+    }
+
+    // The same current whatever the resistance, within half the supply
+    float supply = measureInputVoltage();
+    float maxVoltage = supply > 0 ? supply / 2 : INDUCTANCE_TEST_VOLTAGE;
+    float voltage = min(INDUCTANCE_TEST_CURRENT * 2 * motorParams.phaseResistance, maxVoltage);
+    float maxTau = INDUCTANCE_MAX_H / motorParams.phaseResistance;
+
+    // Capture bursts back to back instead of restarting the sampler each time
+    bool samplerWasRunning = adcSamplerRunning();
+    useBridge(BRIDGE_DIRECT);
+    adcSamplerStop();
+
+    float inductanceSum = 0;
+    int validPairs = 0;
+    bool captured = true;
+    float tauHint = 0;
+    for (int pair = 0; pair < 3; pair++) {
+        // The pairs of one motor are alike, the last one sizes the window
+        float tau = captured ? measurePairTimeConstant(pair, voltage, tauHint, maxTau) : 0;
+        if (tau < 0) {
+            // No samples (sampler PWM synced or without a source), the
+            // other pairs would not get any either
+            captured = false;
+            tau = 0;
+        }
+        motorParams.pairInductance[pair] = motorParams.phaseResistance * tau;
+        if (tau > 0) {
+            inductanceSum += motorParams.pairInductance[pair];
+            validPairs++;
+            tauHint = tau;
+        }
+    }
+
+    halSetPwm(0, 0, 0);
+    if (!captured) releaseBridge();
+    if (samplerWasRunning) {
+        // Whatever reads the sampler next expects a full window
+        adcSamplerBegin();
+        delay(VOLTAGE_AVERAGE_WINDOW * 1000 / adcSamplerChannelRate() + 1);
+    }
+
+    if (validPairs == 0) {
+        return 0.0; // Indicates an error condition
+    }
+    return inductanceSum / validPairs;
+}
+
+// Open-loop voltage vector at electrical angle theta, every phase stays
+// between 0 and 2 * amplitude
+static void setSweepVector(float amplitude, float theta) {
+    halSetPwm(amplitude * (1 + cosf(theta)),
+              amplitude * (1 + cosf(theta - 2 * PI / 3)),
+              amplitude * (1 + cosf(theta + 2 * PI / 3)));
+}
+
+PolePairResult measurePolePairs() {
+    PolePairResult result = {
+        .polePairs = 0,
+        .confidence = 0,
+        .source = POLE_SOURCE_NONE,
+        .locked = false,
+        .amplitude = 0,
+        .sixths = 0
+    };
+    // Too large for the stack of the task running the tests
+    static PoleFeature hallSixths[POLE_SWEEP_SIXTHS];
+    static PoleFeature currentSixths[POLE_SWEEP_SIXTHS];
+    memset(hallSixths, 0, sizeof(hallSixths));
+    memset(currentSixths, 0, sizeof(currentSixths));
+
+    // Standstill voltage for the sweep current, plus a V/f boost against
+    // the back-EMF, all within half the supply
+    float supply = measureInputVoltage();
+    float baseVoltage = motorParams.phaseResistance > 0
+        ? POLE_SWEEP_CURRENT * motorParams.phaseResistance : POLE_SWEEP_VOLTAGE;
+    float maxVoltage = supply / 2;
+    if (maxVoltage <= 0) return result;
+
+    // Pull the rotor onto the field at angle 0
+    useBridge(BRIDGE_DIRECT);
+    setSweepVector(min(baseVoltage, maxVoltage), 0);
+    delay(POLE_SWEEP_ALIGN_MS);
+
+    // Phase currents over the measured turns
+    uint32_t measureUs = poleSweepMeasureStartUs();
+    uint32_t durationUs = poleSweepDurationUs();
+    ScopeConfig config = defaultScopeConfig();
+    config.channelMask = (1 << ADC_CH_I_SENSE1) | (1 << ADC_CH_I_SENSE2);
+    config.length = POLE_SWEEP_TURN_SAMPLES * POLE_SWEEP_TURNS;
+    config.sampleRateHz = POLE_SWEEP_TURN_SAMPLES * POLE_SWEEP_HZ;
+    config.preTrigger = 0;
+    config.source = SCOPE_TRIGGER_IMMEDIATE;
+    config.timeoutMs = 0;
+    bool armed = false;
+
+    HallEdgeStats hallStats;
+    hallStatsReset(&hallStats);
+    hallCaptureFlush();
+    uint32_t cleanEdges = 0;
+    double deviationSum[6] = {}, deviationSquares[6] = {};
+    uint32_t sectorEdges[6] = {};
+    bool haveReference = false;
+    float reference = 0;
+
+    uint32_t startUs = micros();
+    uint32_t elapsedUs = 0;
+    while (elapsedUs < durationUs) {
+        float theta = poleSweepAngle(elapsedUs);
+        float boost = POLE_SWEEP_BOOST * supply * poleSweepFrequency(elapsedUs) / POLE_SWEEP_HZ;
+        setSweepVector(min(baseVoltage + boost, maxVoltage), theta);
+        if (!armed && elapsedUs >= measureUs) {
+            armed = scopeArm(config);
+        }
+
+        // Where each hall edge falls against the commanded angle. The edges
+        // are a sixth of an electrical turn apart on the rotor, counted from
+        // the first one. Sector widths and the hall placement repeat every
+        // electrical turn and are fitted out, the rotor's own signature stays.
+        HallEdge edges[16];
+        size_t count;
+        while ((count = hallCaptureDrain(edges, 16)) > 0) {
+            for (size_t i = 0; i < count; i++) {
+                uint32_t glitches = hallStats.glitches;
+                hallStatsAccumulate(&hallStats, &edges[i], 1);
+                int sector = hallSector(edges[i].state);
+                if (hallStats.glitches != glitches || sector < 0) continue;
+                float edgeTheta = poleSweepAngle(edges[i].timestampUs - startUs);
+                if (edgeTheta < poleSweepStartAngle()) continue;
+                if (!haveReference) {
+                    reference = edgeTheta;
+                    haveReference = true;
+                }
+                float rotorTheta = reference + roundf((edgeTheta - reference) / (PI / 3)) * (PI / 3);
+                float deviation = edgeTheta - rotorTheta;
+                poleFeatureAdd(hallSixths, rotorTheta + PI / 6, deviation);
+                deviationSum[sector] += deviation;
+                deviationSquares[sector] += deviation * deviation;
+                sectorEdges[sector]++;
+                cleanEdges++;
+            }
+        }
+
+        delayMicroseconds(POLE_SWEEP_STEP_US);
+        elapsedUs = micros() - startUs;
+    }
+    halSetPwm(0, 0, 0);
+
+    // Without halls the current amplitude per turn carries the back-EMF
+    ScopeCaptureInfo info;
+    if (armed && scopeState() == SCOPE_DONE && scopeCaptureInfo(&info)) {
+        float periodUs = 1e6f / info.sampleRateHz;
+        float firstUs = info.triggerTimeUs - info.triggerIndex * periodUs;
+        float values[2 * 64];
+        for (uint16_t set = 0; set < info.length; set += 64) {
+            uint16_t sets = scopeReadValues(set * 2, values, 2 * 64) / 2;
+            for (uint16_t k = 0; k < sets; k++) {
+                float ia = values[2 * k];
+                float ib = values[2 * k + 1];
+                float amplitude = 2 / sqrtf(3) * sqrtf(ia * ia + ia * ib + ib * ib);
+                uint32_t t = (uint32_t)(firstUs + (set + k) * periodUs);
+                poleFeatureAdd(currentSixths, poleSweepAngle(t - startUs), amplitude);
+            }
+        }
+    } else {
+        scopeStop();
+    }
+
+    // Halls that kept pace with the field, and close behind it, vouch for
+    // the rotor following it. A rotor hunting around the field leaves a
+    // pattern of its own, so the edges may only spread so far around where
+    // each hall sits.
+    float expectedEdges = 6.0f * POLE_SWEEP_TURNS;
+    double squares = 0;
+    for (int sector = 0; sector < 6; sector++) {
+        if (sectorEdges[sector] == 0) continue;
+        squares += deviationSquares[sector] - deviationSum[sector] * deviationSum[sector] / sectorEdges[sector];
+    }
+    float spread = cleanEdges > 0 ? sqrtf(fmax(squares, 0.0) / cleanEdges) : 0;
+    result.locked = fabsf(cleanEdges - expectedEdges) <= POLE_LOCK_TOLERANCE * expectedEdges
+        && spread <= POLE_LOCK_MAX_SPREAD;
+    bool hallsPresent = hallStats.edges > 0;
+
+    float confidence, amplitude;
+    uint16_t sixths;
+    if (result.locked) {
+        float edgeJitter = 2 * PI * POLE_SWEEP_HZ * POLE_EDGE_JITTER_US * 1e-6f;
+        int pp = findPolePairs(hallSixths, POLE_SWEEP_SIXTHS, edgeJitter, &confidence, &amplitude, &sixths);
+        if (pp > 0) {
+            result = {pp, confidence, POLE_SOURCE_HALLS, true, amplitude, sixths};
+        }
+    }
+    if (result.locked || !hallsPresent) {
+        int pp = findPolePairs(currentSixths, POLE_SWEEP_SIXTHS, 0, &confidence, &amplitude, &sixths);
+        if (pp > 0 && confidence > result.confidence) {
+            result = {pp, confidence, POLE_SOURCE_CURRENT, result.locked, amplitude, sixths};
+        }
+    }
+    return result;
+}
+
+int detectPolePairs() {
+    PolePairResult result = measurePolePairs();
+    motorParams.polePairConfidence = result.confidence;
+    return result.polePairs;
 }
 
 bool verifyHallSensors() {
     unsigned long startTime = millis();
     const unsigned long timeout = 1000; // 1 second timeout
-    bool hallAChanged = false;
-    bool hallBChanged = false;
-    bool hallCChanged = false;
+    HallEdgeStats hallStats;
     
-    // Store initial states
-    bool hallAState = digitalRead(HALL_A);
-    bool hallBState = digitalRead(HALL_B);
-    bool hallCState = digitalRead(HALL_C);
+    hallCaptureFlush();
+    hallStatsReset(&hallStats);
     
     // Apply a small voltage to rotate the motor slowly
-    motor.move(1.0);
+    useBridge(BRIDGE_FOC);
+    halMotorMove(1.0);
     
-    // Monitor for changes in hall sensor states
+    // Wait for every sensor to toggle at least once
     while ((millis() - startTime) < timeout) {
-        if (digitalRead(HALL_A) != hallAState) hallAChanged = true;
-        if (digitalRead(HALL_B) != hallBState) hallBChanged = true;
-        if (digitalRead(HALL_C) != hallCState) hallCChanged = true;
+        hallCaptureDrainStats(&hallStats);
         
         // If all sensors have changed, we're done
-        if (hallAChanged && hallBChanged && hallCChanged) {
-            motor.move(0);
+        if (hallStats.toggles[0] && hallStats.toggles[1] && hallStats.toggles[2]) {
+            halMotorMove(0);
             return true;
         }
         delay(1);
     }
     
     // Stop the motor
-    motor.move(0);
+    halMotorMove(0);
     
     return false;
 }
@@ -181,6 +591,7 @@ MotorHealth checkMotorHealth() {
         .halls = {true, true, true, false, false, false},
         .inductanceOK = false,
         .motorTemperatureOK = true,
+        .spectrum = SpectralHealth(),
         .errorMessage = ""
     };
     
@@ -191,32 +602,42 @@ MotorHealth checkMotorHealth() {
     checkHallSensors(&health.halls);
     
     // Build detailed error message
-    if (!health.phases.phaseA_OK) {
-        health.errorMessage += "Phase A: " + getPhaseError(health.phases.phaseA_resistance) + ". ";
+    buildHealthMessage(&health);
+    
+    return health;
+}
+
+void buildHealthMessage(MotorHealth* health) {
+    health->errorMessage = "";
+    
+    if (!health->phases.phaseA_OK) {
+        health->errorMessage += "Phase A: " + getPhaseError(health->phases.phaseA_resistance) + ". ";
     }
-    if (!health.phases.phaseB_OK) {
-        health.errorMessage += "Phase B: " + getPhaseError(health.phases.phaseB_resistance) + ". ";
+    if (!health->phases.phaseB_OK) {
+        health->errorMessage += "Phase B: " + getPhaseError(health->phases.phaseB_resistance) + ". ";
     }
-    if (!health.phases.phaseC_OK) {
-        health.errorMessage += "Phase C: " + getPhaseError(health.phases.phaseC_resistance) + ". ";
+    if (!health->phases.phaseC_OK) {
+        health->errorMessage += "Phase C: " + getPhaseError(health->phases.phaseC_resistance) + ". ";
     }
     
-    if (!health.halls.hallA_OK) {
-        health.errorMessage += "Hall A: " + getHallError(health.halls.hallA_changing) + ". ";
+    if (!health->halls.hallA_OK) {
+        health->errorMessage += "Hall A: " + getHallError(health->halls.hallA_changing) + ". ";
     }
-    if (!health.halls.hallB_OK) {
-        health.errorMessage += "Hall B: " + getHallError(health.halls.hallB_changing) + ". ";
+    if (!health->halls.hallB_OK) {
+        health->errorMessage += "Hall B: " + getHallError(health->halls.hallB_changing) + ". ";
     }
-    if (!health.halls.hallC_OK) {
-        health.errorMessage += "Hall C: " + getHallError(health.halls.hallC_changing) + ". ";
+    if (!health->halls.hallC_OK) {
+        health->errorMessage += "Hall C: " + getHallError(health->halls.hallC_changing) + ". ";
     }
     
-    // If no errors found
-    if (health.errorMessage.length() == 0) {
-        health.errorMessage = "All systems operational";
+    if (health->spectrum.valid && !health->spectrum.spectrumOK) {
+        health->errorMessage += "Current spectrum: " + getSpectrumError(health->spectrum) + ". ";
     }
     
-    return health;
+    // If no errors found
+    if (health->errorMessage.length() == 0) {
+        health->errorMessage = "All systems operational";
+    }
 }
 
 String getPhaseError(float resistance) {
@@ -230,6 +651,18 @@ String getPhaseError(float resistance) {
     return "Unknown error";
 }
 
+String getSpectrumError(const SpectralHealth& spectrum) {
+    if (spectrum.sidebandRatio > SPECTRAL_SIDEBAND_LIMIT) {
+        return "Sidebands at " + String(spectrum.sidebandRatio * 100, 0) + "% - possible rotor eccentricity";
+    } else if (spectrum.mechanicalRatio > SPECTRAL_MECHANICAL_LIMIT) {
+        return "Once per revolution load at " + String(spectrum.mechanicalRatio * 100, 0) +
+               "% - possible imbalance or bearing damage";
+    } else if (spectrum.noiseRatio > SPECTRAL_NOISE_LIMIT) {
+        return "Broadband noise at " + String(spectrum.noiseRatio * 100, 0) + "% - possible bearing wear";
+    }
+    return "Unknown error";
+}
+
 String getHallError(bool changing) {
     if (!changing) {
         return "No state changes detected - sensor may be stuck";
@@ -239,82 +672,52 @@ String getHallError(bool changing) {
 
 void checkPhaseConnections(PhaseStatus* phases) {
     const float testVoltage = 0.5;  // Small test voltage
+    float pairResistance[3];
     
-    // Disable motor control
-    motor.disable();
-    delay(100);
+    // Hold FOC, keep the bridge for the test pulses
+    useBridge(BRIDGE_DIRECT);
     
-    // Test each phase
-    for (int phase = 0; phase < 3; phase++) {
-        float current = 0;
-        
-        // Apply voltage to single phase
-        switch (phase) {
-            case 0:
-                driver.setPwm(testVoltage, 0, 0);
-                break;
-            case 1:
-                driver.setPwm(0, testVoltage, 0);
-                break;
-            case 2:
-                driver.setPwm(0, 0, testVoltage);
-                break;
-        }
-        
-        delay(50);  // Wait for current to stabilize
-        
-        // Measure current
-        current = getCurrentReading();
+    // Test each phase pair, reading the shunt in its low phase
+    for (int pair = 0; pair < 3; pair++) {
+        applyPhasePair(pair, testVoltage);
+        delay(100);  // Wait for current to stabilize and the rotor to align
         
-        // Calculate resistance
-        float resistance = testVoltage / current;
-        
-        // Store resistance and check if it's within acceptable range
-        switch (phase) {
-            case 0:
-                phases->phaseA_resistance = resistance;
-                phases->phaseA_OK = (resistance >= 0.01 && resistance <= 100.0);
-                break;
-            case 1:
-                phases->phaseB_resistance = resistance;
-                phases->phaseB_OK = (resistance >= 0.01 && resistance <= 100.0);
-                break;
-            case 2:
-                phases->phaseC_resistance = resistance;
-                phases->phaseC_OK = (resistance >= 0.01 && resistance <= 100.0);
-                break;
-        }
+        AdcChannel sense = phasePairs[pair].sense;
+        float current = adcAverageToUnits(sense, adcSamplerAverage(sense, PHASE_PAIR_AVERAGE_WINDOW));
+        pairResistance[pair] = phasePairResistance(testVoltage, current);
         
         // Reset output
-        driver.setPwm(0, 0, 0);
+        halSetPwm(0, 0, 0);
         delay(50);
     }
+    
+    storePairResistances(phases, pairResistance);
 }
 
 void checkHallSensors(HallStatus* halls) {
     unsigned long startTime = millis();
     const unsigned long timeout = 1000; // 1 second timeout
+    HallEdgeStats hallStats;
     
-    // Store initial states
-    bool hallAState = digitalRead(HALL_A);
-    bool hallBState = digitalRead(HALL_B);
-    bool hallCState = digitalRead(HALL_C);
+    hallCaptureFlush();
+    hallStatsReset(&hallStats);
     
     // Apply a small voltage to rotate the motor slowly
-    motor.move(1.0);
+    useBridge(BRIDGE_FOC);
+    halMotorMove(1.0);
     
-    // Monitor for changes in hall sensor states
+    // Collect the captured edges while the rotor turns
     while ((millis() - startTime) < timeout) {
-        // Check for state changes
-        halls->hallA_changing |= (digitalRead(HALL_A) != hallAState);
-        halls->hallB_changing |= (digitalRead(HALL_B) != hallBState);
-        halls->hallC_changing |= (digitalRead(HALL_C) != hallCState);
-        
+        hallCaptureDrainStats(&hallStats);
         delay(1);
     }
     
     // Stop the motor
-    motor.move(0);
+    halMotorMove(0);
+    
+    halls->hallA_changing |= hallStats.toggles[0] > 0;
+    halls->hallB_changing |= hallStats.toggles[1] > 0;
+    halls->hallC_changing |= hallStats.toggles[2] > 0;
     
     // Validate hall sensor operation
     halls->hallA_OK = halls->hallA_changing;
@@ -326,22 +729,8 @@ void checkHallSensors(HallStatus* halls) {
 }
 
 void validateHallPatterns(HallStatus* halls) {
-    // Valid hall patterns (60° spacing)
-    const uint8_t validPatterns[] = {1, 3, 2, 6, 4, 5};
-    bool validPatternFound = false;
-    
-    // Read current hall state
-    uint8_t hallState = (digitalRead(HALL_A) << 2) | 
-                       (digitalRead(HALL_B) << 1) | 
-                        digitalRead(HALL_C);
-    
-    // Check if current state is valid
-    for (int i = 0; i < 6; i++) {
-        if (hallState == validPatterns[i]) {
-            validPatternFound = true;
-            break;
-        }
-    }
+    // Valid hall patterns (60° spacing) map to a sector, 000 and 111 do not
+    bool validPatternFound = hallSector(hallCaptureState()) >= 0;
     
     // Update hall status if pattern is invalid
     if (!validPatternFound) {
@@ -351,146 +740,127 @@ void validateHallPatterns(HallStatus* halls) {
     }
 }
 
-float getCurrentReading() {
-    const int samples = 10;
-    float totalCurrent = 0;
-    
-    for (int i = 0; i < samples; i++) {
-        int adcValue = analogRead(CURRENT_SENSE_PIN);
-        float voltage = (adcValue * 3.3) / 4095.0;
-        float current = voltage / CURRENT_SENSE_RATIO;
-        totalCurrent += current;
-        delay(1);
+float waitForFreshAverage(AdcChannel channel, uint16_t samples) {
+    // Only wait for samples converted after this call, the ring is refilled
+    // continuously in the background so this takes samples / 2 kHz at most
+    if (samples > ADC_SAMPLER_RING_SIZE / 2) samples = ADC_SAMPLER_RING_SIZE / 2;
+    uint32_t start = adcSamplerSequence(channel);
+    unsigned long startTime = millis();
+    while ((uint32_t)(adcSamplerSequence(channel) - start) < samples) {
+        if (!adcSamplerRunning() || millis() - startTime > 500) break;
+        yield();
     }
-    
-    return totalCurrent / samples;
+    return adcSamplerAverage(channel, samples);
+}
+
+float getCurrentReading() {
+    // Average of the most recent samples, never blocks
+    return adcAverageToUnits(ADC_CH_I_SENSE1, adcSamplerAverage(ADC_CH_I_SENSE1, CURRENT_AVERAGE_WINDOW));
 }
 
 float measureInputVoltage() {
-    const int samples = 10;  // Number of samples for averaging
-    float voltageSum = 0;
-    
-    for(int i = 0; i < samples; i++) {
-        // Read ADC value
-        int adcValue = analogRead(VOLTAGE_SENSE_PIN);
-        
-        // Convert ADC reading to voltage
-        float measuredVoltage = (adcValue / ADC_RESOLUTION) * ADC_REFERENCE;
-        
-        // Calculate actual voltage using voltage divider formula
-        float inputVoltage = measuredVoltage * (VOLTAGE_DIVIDER_R1 + VOLTAGE_DIVIDER_R2) / VOLTAGE_DIVIDER_R2;
-        
-        voltageSum += inputVoltage;
-        delay(1);
-    }
-    
-    return voltageSum / samples;
+    return adcAverageToUnits(ADC_CH_VIN, adcSamplerAverage(ADC_CH_VIN, VOLTAGE_AVERAGE_WINDOW));
 }
 
 OpenLoopTestResult runOpenLoopTest(float dutyCycle, uint32_t duration) {
-    OpenLoopTestResult result = {
-        .success = false,
-        .maxCurrent = 0.0,
-        .avgCurrent = 0.0,
-        .currentLimitExceeded = false,
-        .hallsWorking = false,
-        .errorMessage = ""
-    };
-    
-    const float CURRENT_LIMIT = 10.0;  // 10A max current
-    const float MIN_DUTY = 0.0;
-    const float MAX_DUTY = 0.5;        // 50% max duty cycle for safety
-    
-    // Validate duty cycle
-    dutyCycle = constrain(dutyCycle, MIN_DUTY, MAX_DUTY);
-    
-    // Variables for current monitoring
-    float currentSum = 0.0;
-    int samples = 0;
-    
-    // Variables for hall sensor monitoring
-    bool hallAChanged = false;
-    bool hallBChanged = false;
-    bool hallCChanged = false;
-    uint8_t initialHallState = (digitalRead(HALL_A) << 2) | 
-                              (digitalRead(HALL_B) << 1) | 
-                              digitalRead(HALL_C);
-    
-    // Start time
+    OpenLoopTestResult result = {};
+    result.errorMessage = "";
+
+    // Fraction of the supply, full duty is what takes the motor to its
+    // rated speed
+    dutyCycle = constrain(dutyCycle, 0.0f, 1.0f);
+    float voltage = dutyCycle * measureInputVoltage();
+    if (voltage <= 0) {
+        result.errorMessage = "No supply voltage";
+        return result;
+    }
+
+    // The first half ramps the motor up to speed, the second is measured
+    HallEdgeStats hallStats;
+    HallEdgeStats steadyStats;
+    hallStatsReset(&hallStats);
+    hallStatsReset(&steadyStats);
+    bool steady = false;
+    float startupPeak = 0;
+
+    // Hold FOC, the six-step task commutates on hall edges from here on
+    useBridge(BRIDGE_DIRECT);
+    hallCaptureFlush();
+    sixStepBegin(0, 1, OPEN_LOOP_CURRENT_LIMIT);
+
     unsigned long startTime = millis();
-    
-    // Disable FOC control
-    motor.disable();
-    delay(100);
-    
-    // Apply voltage using simple 6-step commutation
-    while ((millis() - startTime) < duration) {
-        // Read current
-        float current = getCurrentReading();
-        currentSum += current;
-        samples++;
-        
-        // Update max current
-        if (current > result.maxCurrent) {
-            result.maxCurrent = current;
+    HallEdge batch[16];
+    while ((millis() - startTime) < duration && !sixStepTripped()) {
+        size_t count;
+        while ((count = hallCaptureDrain(batch, 16)) > 0) {
+            hallStatsAccumulate(&hallStats, batch, count);
+            if (steady) hallStatsAccumulate(&steadyStats, batch, count);
         }
-        
-        // Check for current limit
-        if (current > CURRENT_LIMIT) {
-            result.currentLimitExceeded = true;
-            result.errorMessage = "Current limit exceeded: " + String(current, 2) + "A";
-            motor.disable();
-            return result;
+        if (!steady) {
+            // Voltage rises with the back-EMF, full duty at standstill would
+            // only trip the current limit
+            float ramp = (float)(millis() - startTime) / (duration / 2);
+            sixStepSetVoltage(voltage * constrain(ramp, 0.0f, 1.0f));
         }
-        
-        // Monitor hall sensors
-        uint8_t hallState = (digitalRead(HALL_A) << 2) | 
-                           (digitalRead(HALL_B) << 1) | 
-                           digitalRead(HALL_C);
-                           
-        if ((hallState >> 2) != (initialHallState >> 2)) hallAChanged = true;
-        if (((hallState >> 1) & 1) != ((initialHallState >> 1) & 1)) hallBChanged = true;
-        if ((hallState & 1) != (initialHallState & 1)) hallCChanged = true;
-        
-        // Simple 6-step commutation based on hall state
-        switch (hallState) {
-            case 1: // 001
-                driver.setPwm(dutyCycle, 0, 0);
-                break;
-            case 3: // 011
-                driver.setPwm(0, dutyCycle, 0);
-                break;
-            case 2: // 010
-                driver.setPwm(0, dutyCycle, 0);
-                break;
-            case 6: // 110
-                driver.setPwm(0, 0, dutyCycle);
-                break;
-            case 4: // 100
-                driver.setPwm(0, 0, dutyCycle);
-                break;
-            case 5: // 101
-                driver.setPwm(dutyCycle, 0, 0);
-                break;
-            default:
-                // Invalid hall state
-                result.errorMessage = "Invalid hall state detected: " + String(hallState);
-                motor.disable();
-                return result;
+        if (!steady && (millis() - startTime) >= duration / 2) {
+            startupPeak = sixStepCurrent().peak;
+            sixStepResetCurrent();
+            steady = true;
         }
-        
-        delay(1);
+        delay(OPEN_LOOP_POLL_MS);
     }
-    
-    // Stop motor
-    motor.disable();
-    
-    // Calculate average current
-    result.avgCurrent = currentSum / samples;
-    
+    sixStepStop();
+
+    SixStepCurrent current = sixStepCurrent();
+    if (current.tripped) {
+        result.currentLimitExceeded = true;
+        result.maxCurrent = current.tripCurrent;
+        result.errorMessage = "Current limit exceeded: " + String(current.tripCurrent, 2) + "A";
+        useBridge(BRIDGE_TRIPPED);
+        return result;
+    }
+
+    // All phases low brake the rotor, the next measurement starts from rest.
+    // The bridge stays ready for it.
+    halSetPwm(0, 0, 0);
+    unsigned long brakeStart = millis();
+    while (millis() - brakeStart < OPEN_LOOP_BRAKE_MS) {
+        hallCaptureDrainStats(&hallStats);
+        if (hallElectricalVelocity(&hallStats, micros()) == 0) break;
+        delay(OPEN_LOOP_POLL_MS);
+    }
+
+    result.maxCurrent = fmaxf(startupPeak, current.peak);
+    result.avgCurrent = current.mean;
+    result.currentRipple = current.ripple;
+
+    // Speed from the time one electrical turn takes, sector by sector
+    uint32_t turnUs = 0;
+    bool allSectors = true;
+    for (int sector = 0; sector < 6; sector++) {
+        result.sectorDwellUs[sector] = hallSectorDwellUs(&steadyStats, sector);
+        turnUs += result.sectorDwellUs[sector];
+        if (result.sectorDwellUs[sector] == 0) allSectors = false;
+    }
+    if (allSectors) {
+        result.electricalHz = 1e6f / turnUs;
+        if (motorParams.polePairs > 0) result.speedRpm = 60.0f * result.electricalHz / motorParams.polePairs;
+    }
+
     // Check if all hall sensors changed state
+    bool hallAChanged = hallStats.toggles[0] > 0;
+    bool hallBChanged = hallStats.toggles[1] > 0;
+    bool hallCChanged = hallStats.toggles[2] > 0;
     result.hallsWorking = hallAChanged && hallBChanged && hallCChanged;
-    
+    result.hallGlitches = hallStats.glitches;
+    result.minSectorUs = hallStats.minSectorUs;
+
+    if (hallStats.invalidStates > 0) {
+        // The table has nothing to drive there, the rotor coasted through
+        result.errorMessage = "Invalid hall state detected. ";
+        return result;
+    }
+
     // Set success status
     result.success = true;
     if (!result.hallsWorking) {
@@ -499,11 +869,85 @@ OpenLoopTestResult runOpenLoopTest(float dutyCycle, uint32_t duration) {
         if (!hallBChanged) result.errorMessage += "Hall B stuck. ";
         if (!hallCChanged) result.errorMessage += "Hall C stuck. ";
     }
-    
+
     return result;
 }
 
 float calculateMotorKv(float voltage, float rpm) {
     if (voltage <= 0) return 0;
     return rpm / voltage;
-}
\ No newline at end of file
+}
+
+float measureMotorKv(float voltage, uint32_t settleMs) {
+    if (voltage <= 0) {
+        return 0.0;
+    }
+
+    // Spin up at constant voltage
+    useBridge(BRIDGE_FOC);
+    halMotorMove(voltage);
+    delay(settleMs);
+
+    // Terminal voltages over the whole scope buffer
+    ScopeConfig config = defaultScopeConfig();
+    config.channelMask = (1 << ADC_CH_VA) | (1 << ADC_CH_VB) | (1 << ADC_CH_VC);
+    config.sampleRateHz = KV_COAST_RATE_HZ;
+    config.length = SCOPE_BUFFER_SAMPLES / 3;
+    config.preTrigger = 0;
+    config.source = SCOPE_TRIGGER_IMMEDIATE;
+    config.timeoutMs = 0;
+    uint32_t timeoutMs = 1000UL * config.length / config.sampleRateHz + KV_COAST_SLACK_MS;
+
+    // Let go of the rotor, from here on the terminals only carry the back-EMF
+    HallEdgeStats hallStats;
+    hallStatsReset(&hallStats);
+    backEmfBegin(&coastDown);
+    hallCaptureFlush();
+    halMotorDisable();
+    bridgeMode = BRIDGE_RELEASED;
+    bool armed = scopeArm(config);
+
+    // Edges are timed by the hall ISR, only their cleanliness is judged here
+    unsigned long startTime = millis();
+    bool capturing = armed;
+    while (capturing) {
+        capturing = scopeState() != SCOPE_DONE && (millis() - startTime) < timeoutMs;
+        HallEdge edges[16];
+        size_t count;
+        while ((count = hallCaptureDrain(edges, 16)) > 0) {
+            for (size_t i = 0; i < count; i++) {
+                uint32_t glitches = hallStats.glitches;
+                hallStatsAccumulate(&hallStats, &edges[i], 1);
+                backEmfAddEdge(&coastDown, edges[i].timestampUs, hallStats.glitches == glitches);
+            }
+        }
+        if (capturing) delay(1);
+    }
+
+    // Stop the rotor under FOC again
+    releaseBridge();
+
+    ScopeCaptureInfo info;
+    if (!armed || scopeState() != SCOPE_DONE || !scopeCaptureInfo(&info)) {
+        scopeStop();
+        return 0.0;
+    }
+
+    // Samples are evenly spaced around the trigger, matched to the turns in
+    // the hall time base
+    float periodUs = 1e6f / info.sampleRateHz;
+    float firstUs = info.triggerTimeUs - info.triggerIndex * periodUs;
+    float values[3 * 64];
+    for (uint16_t set = 0; set < info.length; set += 64) {
+        uint16_t sets = scopeReadValues(set * 3, values, 3 * 64) / 3;
+        backEmfAddSamples(&coastDown, values, sets, firstUs + set * periodUs, periodUs);
+    }
+
+    BackEmfFit fit;
+    if (!fitBackEmf(&coastDown, motorParams.polePairs, &fit)) {
+        return 0.0;
+    }
+    motorParams.motorKe = fit.ke;
+    motorParams.motorKv = fit.kv;
+    return motorParams.motorKv;
+}
@@ -1,14 +1,92 @@
 #ifndef MOTOR_ANALYSIS_H
 #define MOTOR_ANALYSIS_H
 
-#include <Arduino.h>
-#include <SimpleFOC.h>
 #include "main.h"
+#include "hal.h"
+#include "adc_sampler.h"
+#include "adc_calibration.h"
+#include "step_response.h"
+#include "hall_capture.h"
+#include "spectral_analysis.h"
+#include "back_emf.h"
+#include "pole_pairs.h"
+#include "six_step.h"
 
-// Declare external objects from main.cpp
-extern BLDCMotor motor;
-extern BLDCDriver3PWM driver;
-extern HallSensor sensor;
+// Number of sampler samples averaged for the periodic readings
+#define CURRENT_AVERAGE_WINDOW 16
+#define VOLTAGE_AVERAGE_WINDOW 32
+
+// Phase resistance at a fixed current, once the current stopped changing
+#define RESISTANCE_TEST_CURRENT    2.0f  // A, within half the supply
+#define RESISTANCE_SETTLE_WINDOW   64    // samples per average compared
+#define RESISTANCE_SETTLED         0.002f // change between two averages counted as settled
+#define RESISTANCE_SETTLE_TIMEOUT_MS 1500
+
+// Inductance step response capture. The step is sized for the same current
+// whatever the resistance, and the rotor is first aligned to every pair's
+// field so it stays still during the steps. The window starts at the burst's own rate, or at
+// the time constant of the pair before, and grows until the rise settles, up
+// to the time constant of INDUCTANCE_MAX_H at the measured resistance. Rises
+// within a few samples are captured interleaved.
+#define INDUCTANCE_TEST_CURRENT    2.0f  // A once the step settled
+#define INDUCTANCE_TEST_VOLTAGE    1.0f  // V, largest step while the supply is unknown
+#define INDUCTANCE_BURST_SAMPLES   256   // samples per step capture
+#define INDUCTANCE_BASELINE_SAMPLES 32   // zero current reference, also the fit's minimum
+#define INDUCTANCE_MAX_H           10e-3f // H, longest rise the window grows to
+#define INDUCTANCE_WINDOW_TAUS     6     // capture length in time constants
+#define INDUCTANCE_WINDOW_GROWTH   4     // window stretch after an unsettled capture
+#define INDUCTANCE_INTERLEAVE      8     // captures merged for a rise within a few samples
+#define INDUCTANCE_DECAY_TAUS      5     // wait for the current to decay after a step
+#define INDUCTANCE_ALIGN_MS        100   // rotor onto the pair's field, at least
+#define INDUCTANCE_ALIGN_TIMEOUT_MS 1500 // and at most, until the current settles
+#define INDUCTANCE_ALIGN_SAMPLES   64    // per settle check,
+#define INDUCTANCE_ALIGN_SPACING_US 300  // spread over 19 ms
+#define INDUCTANCE_DECAY_SAMPLES   8     // per check of the decay after the alignment
+#define INDUCTANCE_DECAY_LEFT      0.01f // of the alignment current, decayed enough
+
+// Two phase measurements (resistance, connections, inductance) drive one
+// pair at a time. The third phase is held at the neutral point so it carries
+// no current, and the low phase sits at 0 duty so its low-side shunt
+// conducts for the whole PWM period.
+#define PHASE_PAIR_MIN_CURRENT     0.001f // A, below this the pair is open
+#define PHASE_PAIR_AVERAGE_WINDOW  64     // samples, 32 ms at the default rate, the end of the settle time
+
+struct PhasePair {
+    float ua, ub, uc;       // fraction of the test voltage per phase
+    AdcChannel sense;       // shunt in the low phase
+};
+
+extern const PhasePair phasePairs[3];   // AB, BC, CA
+
+// Bridge hand over between the FOC task and the measurements
+#define BRIDGE_SETTLE_MS           100   // rotor and currents settle after FOC lets go
+
+// Kv from the back-EMF while the rotor coasts down, the capture fills the
+// scope buffer: 2730 samples per terminal voltage, 340 ms
+#define KV_COAST_RATE_HZ           8000  // per channel
+#define KV_COAST_SLACK_MS          200   // capture timeout on top of its length
+
+// Hall commutated open-loop test
+#define OPEN_LOOP_CURRENT_LIMIT    10.0f // A, largest phase current
+#define OPEN_LOOP_POLL_MS          5     // supervision only, the six-step task commutates
+#define OPEN_LOOP_BRAKE_MS         1000  // longest wait for the rotor to stop afterwards
+
+// Who drives the bridge. Every measurement claims the mode it needs and only
+// a change of mode costs a hand over, so measurements run back to back.
+enum BridgeMode {
+    BRIDGE_RELEASED,   // FOC task in charge, or state unknown
+    BRIDGE_DIRECT,     // FOC held and disabled, measurements use halSetPwm()
+    BRIDGE_FOC,        // FOC enabled, rotation tests use halMotorMove()
+    BRIDGE_TRIPPED     // FOC held and the driver disabled after an over-current trip
+};
+
+// Fields of MotorParameters measureMotorParameters() could measure
+enum MeasuredField {
+    MEASURED_RESISTANCE = 1 << 0,
+    MEASURED_INDUCTANCE = 1 << 1,
+    MEASURED_POLE_PAIRS = 1 << 2,   // at POLE_MIN_CONFIDENCE, a lower count is only a guess
+    MEASURED_ALL = MEASURED_RESISTANCE | MEASURED_INDUCTANCE | MEASURED_POLE_PAIRS
+};
 
 struct MotorParameters {
     float phaseResistance;    // in ohms
@@ -17,6 +95,10 @@ struct MotorParameters {
     bool hallValid;           // hall sensor status
     float inputVoltage;        // Add this line
     float motorKv;    // Motor KV rating (RPM/V)
+    float pairInductance[3];  // per phase inductance from pairs AB, BC, CA (H)
+    float motorKe;            // back-EMF constant, line to line peak (V s/rad mechanical)
+    float polePairConfidence; // 0 .. 1, from the pole pair sweep
+    uint8_t measured;         // MeasuredField bits of the last measureMotorParameters()
 };
 
 extern MotorParameters motorParams;
@@ -45,6 +127,7 @@ struct MotorHealth {
     HallStatus halls;
     bool inductanceOK;
     bool motorTemperatureOK;
+    SpectralHealth spectrum;  // last spectral run, carried into later snapshots
     String errorMessage;
 };
 
@@ -54,20 +137,50 @@ struct OpenLoopTestResult {
     float avgCurrent;
     bool currentLimitExceeded;
     bool hallsWorking;
+    uint32_t hallGlitches;    // from the captured hall edges
+    uint32_t minSectorUs;     // shortest clean sector, i.e. the top speed reached
+    float currentRipple;      // A rms around avgCurrent
+    float electricalHz;       // speed over the second half of the run
+    float speedRpm;           // mechanical, needs motorParams.polePairs
+    uint32_t sectorDwellUs[6];  // mean time in each hall sector, second half
     String errorMessage;
 };
 
 // Function declarations
+void useBridge(BridgeMode mode);
+void releaseBridge();            // back to normal FOC operation, motor stopped
 MotorHealth checkMotorHealth();  // Returns detailed health status
-bool measureMotorParameters();    // Original function for basic measurements
+// Resistance, inductance, pole pairs, halls and supply. False unless every
+// MEASURED_ALL field was measured, motorParams.measured tells which were.
+bool measureMotorParameters();
 float measurePhaseResistance();
 float measurePhaseInductance();
+// Open-loop sweep over POLE_SWEEP_TURNS electrical turns, see pole_pairs.h.
+// detectPolePairs() returns 0 when the sweep gave nothing usable and
+// stores the confidence in motorParams.
+PolePairResult measurePolePairs();
 int detectPolePairs();
 bool verifyHallSensors();
 void checkPhaseConnections(PhaseStatus* phases);
+// Apply voltage across phasePairs[pair], the bridge must be BRIDGE_DIRECT
+void applyPhasePair(int pair, float voltage);
+// Line to line resistance from the low phase current, INFINITY when no
+// current flows
+float phasePairResistance(float voltage, float current);
+// Per phase resistances and OK flags from the three pair resistances. A
+// phase in two open pairs is open, the others then follow from their
+// remaining pair.
+void storePairResistances(PhaseStatus* phases, const float pairResistance[3]);
+void validateHallPatterns(HallStatus* halls);
+void buildHealthMessage(MotorHealth* health);
+// Six-step from the hall edges at dutyCycle of the supply. Current, ripple
+// and speed are taken over the second half, once the motor is up to speed.
 OpenLoopTestResult runOpenLoopTest(float dutyCycle, uint32_t duration = 5000);
 float getCurrentReading();
 float measureInputVoltage();
 float calculateMotorKv(float voltage, float rpm);
+// Spin up at voltage, then fit the back-EMF of the coasting rotor. Sets
+// motorKe and motorKv, Kv needs motorParams.polePairs.
+float measureMotorKv(float voltage, uint32_t settleMs);
 
 #endif
\ No newline at end of file
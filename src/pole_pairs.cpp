@@ -0,0 +1,238 @@
+#include "pole_pairs.h"
+#include <math.h>
+
+#define POLE_TWO_PI      6.28318531f
+#define POLE_PI          3.14159265f
+#define POLE_NUISANCE_COLUMNS       7       // a level per sixth of the electrical turn and a slope
+#define POLE_MAX_NOISE_CORRELATION  0.95f   // of neighbouring sixths, bounds the samples they are worth
+
+float poleSweepFrequency(uint32_t elapsedUs) {
+    float t = elapsedUs * 1e-6f;
+    float ramp = POLE_SWEEP_RAMP_MS * 1e-3f;
+    return t < ramp ? POLE_SWEEP_HZ * t / ramp : POLE_SWEEP_HZ;
+}
+
+float poleSweepAngle(uint32_t elapsedUs) {
+    // Frequency rises linearly over the ramp, then stays constant
+    float t = elapsedUs * 1e-6f;
+    float ramp = POLE_SWEEP_RAMP_MS * 1e-3f;
+    if (t < ramp) return POLE_PI * POLE_SWEEP_HZ * t * t / ramp;
+    return POLE_PI * POLE_SWEEP_HZ * ramp + POLE_TWO_PI * POLE_SWEEP_HZ * (t - ramp);
+}
+
+uint32_t poleSweepMeasureStartUs() {
+    return POLE_SWEEP_RAMP_MS * 1000UL + (uint32_t)(1e6f * POLE_SWEEP_SETTLE_TURNS / POLE_SWEEP_HZ);
+}
+
+float poleSweepStartAngle() {
+    return POLE_PI * POLE_SWEEP_HZ * POLE_SWEEP_RAMP_MS * 1e-3f + POLE_TWO_PI * POLE_SWEEP_SETTLE_TURNS;
+}
+
+uint32_t poleSweepDurationUs() {
+    return poleSweepMeasureStartUs() + (uint32_t)(1e6f * POLE_SWEEP_TURNS / POLE_SWEEP_HZ);
+}
+
+void poleFeatureAdd(PoleFeature* sixths, float angle, float value) {
+    float sixth = (angle - poleSweepStartAngle()) / (POLE_TWO_PI / 6);
+    if (sixth < 0 || sixth >= POLE_SWEEP_SIXTHS) return;
+    PoleFeature& feature = sixths[(int)sixth];
+    feature.sum += value;
+    feature.count++;
+}
+
+// Least squares residual of v over the valid sixths after what repeats
+// every electrical turn (one level per sixth of the turn) and a straight
+// line are taken out. The normal equations are small enough to solve
+// directly.
+static void removeElectrical(float* v, const bool* valid, uint16_t count) {
+    const int columns = POLE_NUISANCE_COLUMNS;
+    double a[columns][columns + 1] = {};
+    double span = count > 1 ? count - 1 : 1;
+    for (uint16_t j = 0; j < count; j++) {
+        if (!valid[j]) continue;
+        double row[columns] = {};
+        row[j % 6] = 1;
+        row[6] = j / span - 0.5;
+        for (int r = 0; r < columns; r++) {
+            if (row[r] == 0) continue;
+            for (int c = 0; c < columns; c++) a[r][c] += row[r] * row[c];
+            a[r][columns] += row[r] * v[j];
+        }
+    }
+    // Gaussian elimination with partial pivoting, a level without any
+    // valid sixth keeps a zero coefficient
+    double beta[columns] = {};
+    int pivotColumn[columns];
+    for (int r = 0; r < columns; r++) pivotColumn[r] = -1;
+    for (int c = 0; c < columns; c++) {
+        int pivot = -1;
+        for (int r = 0; r < columns; r++) {
+            if (pivotColumn[r] < 0 && (pivot < 0 || fabs(a[r][c]) > fabs(a[pivot][c]))) pivot = r;
+        }
+        if (pivot < 0 || fabs(a[pivot][c]) < 1e-12) continue;
+        pivotColumn[pivot] = c;
+        for (int r = 0; r < columns; r++) {
+            if (r == pivot) continue;
+            double factor = a[r][c] / a[pivot][c];
+            for (int k = c; k <= columns; k++) a[r][k] -= factor * a[pivot][k];
+        }
+    }
+    for (int r = 0; r < columns; r++) {
+        int c = pivotColumn[r];
+        if (c >= 0) beta[c] = a[r][columns] / a[r][c];
+    }
+    for (uint16_t j = 0; j < count; j++) {
+        if (!valid[j]) continue;
+        v[j] -= (float)(beta[j % 6] + beta[6] * (j / span - 0.5));
+    }
+}
+
+static float sumOfSquares(const float* v, const bool* valid, uint16_t count) {
+    double sum = 0;
+    for (uint16_t j = 0; j < count; j++) {
+        if (valid[j]) sum += (double)v[j] * v[j];
+    }
+    return (float)sum;
+}
+
+struct SignatureFit {
+    float rss;          // residual sum of squares left by the sinusoid
+    float split;        // further reduction when either half of the sweep has its own
+    float amplitude;
+};
+
+// Least squares coefficients of x on the regressors c and s over the valid
+// sixths from .. to, and the sum of squares they explain
+static double fitSinusoid(const float* x, const float* c, const float* s, const bool* valid,
+                          uint16_t from, uint16_t to, double* a, double* b) {
+    double cc = 0, ss = 0, cs = 0, cx = 0, sx = 0;
+    for (uint16_t j = from; j < to; j++) {
+        if (!valid[j]) continue;
+        cc += (double)c[j] * c[j];
+        ss += (double)s[j] * s[j];
+        cs += (double)c[j] * s[j];
+        cx += (double)c[j] * x[j];
+        sx += (double)s[j] * x[j];
+    }
+    double det = cc * ss - cs * cs;
+    if (det <= 1e-9 * cc * ss) {
+        *a = *b = 0;
+        return 0;
+    }
+    *a = (cx * ss - sx * cs) / det;
+    *b = (sx * cc - cx * cs) / det;
+    return *a * cx + *b * sx;
+}
+
+// Once per turn sinusoid of period 6 P sixths fitted to the residual x,
+// over the whole sweep and over either half. The fit goes to fit when given.
+static SignatureFit fitSignature(const float* x, const bool* valid, uint16_t count, int polePairs,
+                                 float* fit) {
+    static float c[POLE_SWEEP_SIXTHS];
+    static float s[POLE_SWEEP_SIXTHS];
+    for (uint16_t j = 0; j < count; j++) {
+        float phase = POLE_TWO_PI * j / (6 * polePairs);
+        c[j] = cosf(phase);
+        s[j] = sinf(phase);
+    }
+    // The sinusoid as far as the electrical part cannot explain it already
+    removeElectrical(c, valid, count);
+    removeElectrical(s, valid, count);
+
+    double a, b, a1, b1, a2, b2;
+    double explained = fitSinusoid(x, c, s, valid, 0, count, &a, &b);
+    double halves = fitSinusoid(x, c, s, valid, 0, count / 2, &a1, &b1) +
+                    fitSinusoid(x, c, s, valid, count / 2, count, &a2, &b2);
+    if (fit) {
+        for (uint16_t j = 0; j < count; j++) fit[j] = valid[j] ? (float)(a * c[j] + b * s[j]) : 0;
+    }
+    double rss = sumOfSquares(x, valid, count) - explained;
+    SignatureFit result;
+    result.rss = rss > 0 ? (float)rss : 0;
+    result.split = halves > explained ? (float)(halves - explained) : 0;
+    result.amplitude = (float)sqrt(a * a + b * b);
+    return result;
+}
+
+int findPolePairs(const PoleFeature* sixths, uint16_t count, float noiseFloor, float* confidence,
+                  float* amplitude, uint16_t* used) {
+    static float x[POLE_SWEEP_SIXTHS];
+    static float fit[POLE_SWEEP_SIXTHS];   // of the best candidate, then the residual
+    static bool valid[POLE_SWEEP_SIXTHS];
+    if (count > POLE_SWEEP_SIXTHS) count = POLE_SWEEP_SIXTHS;
+
+    uint16_t n = 0;
+    for (uint16_t j = 0; j < count; j++) {
+        valid[j] = sixths[j].count > 0;
+        x[j] = valid[j] ? sixths[j].sum / sixths[j].count : 0;
+        if (valid[j]) n++;
+    }
+    *used = n;
+    *confidence = 0;
+    *amplitude = 0;
+    // Two mechanical turns at the most pole pairs, and room for the noise
+    if (n < 2 * 6 * POLE_PAIRS_MAX) return 0;
+    removeElectrical(x, valid, count);
+
+    float rssFlat = sumOfSquares(x, valid, count);
+    SignatureFit fits[POLE_PAIRS_MAX + 1];
+    int best = 0;
+    float rssBest = rssFlat;
+    for (int pp = 2; pp <= POLE_PAIRS_MAX; pp++) {
+        fits[pp] = fitSignature(x, valid, count, pp, nullptr);
+        if (fits[pp].rss < rssBest) {
+            rssBest = fits[pp].rss;
+            best = pp;
+        }
+    }
+
+    // Noise left after the best explanation. Neighbouring sixths share the
+    // rotor's hunting around the field, which makes the residual smoother
+    // than white noise and each sixth worth less than a whole sample.
+    if (best > 0) fitSignature(x, valid, count, best, fit);
+    for (uint16_t j = 0; j < count; j++) fit[j] = best > 0 ? x[j] - fit[j] : x[j];
+    double lag = 0, zero = 0;
+    for (uint16_t j = 0; j + 1 < count; j++) {
+        if (!valid[j] || !valid[j + 1]) continue;
+        lag += (double)fit[j] * fit[j + 1];
+        zero += (double)fit[j] * fit[j];
+    }
+    float rho = zero > 0 ? (float)(lag / zero) : 0;
+    if (rho < 0) rho = 0;
+    if (rho > POLE_MAX_NOISE_CORRELATION) rho = POLE_MAX_NOISE_CORRELATION;
+    float samplesPerSixth = (1 - rho) / (1 + rho);
+    float effective = n * samplesPerSixth;
+    float variance = rssBest / (n - POLE_NUISANCE_COLUMNS - 2);
+    if (variance < noiseFloor * noiseFloor) variance = noiseFloor * noiseFloor;
+    variance /= samplesPerSixth;
+    if (variance <= 0) return 0;
+
+    // Bayesian information criterion: every candidate pays for its two
+    // coefficients, the flat rotor for none. The rotor's signature stays put
+    // over the sweep, hunting locked to the drive drifts: a candidate that
+    // explains clearly more with its own coefficients per half is hunting,
+    // and explains nothing.
+    float score[POLE_PAIRS_MAX + 1];
+    score[1] = -rssFlat / (2 * variance);
+    float top = score[1];
+    for (int pp = 2; pp <= POLE_PAIRS_MAX; pp++) {
+        bool drifts = fits[pp].split / (2 * variance) > logf(effective);
+        score[pp] = drifts ? score[1] - logf(effective) : -fits[pp].rss / (2 * variance) - logf(effective);
+        if (score[pp] > top) top = score[pp];
+    }
+    float total = 0;
+    for (int pp = 1; pp <= POLE_PAIRS_MAX; pp++) total += expf(score[pp] - top);
+
+    int winner = 1;
+    for (int pp = 2; pp <= POLE_PAIRS_MAX; pp++) {
+        if (score[pp] > score[winner]) winner = pp;
+    }
+    float weight = expf(score[winner] - top) / total;
+    if (winner == 1) {
+        *confidence = POLE_FLAT_CONFIDENCE * weight;
+        return 1;
+    }
+    *confidence = weight;
+    *amplitude = fits[winner].amplitude;
+    return winner;
+}
@@ -0,0 +1,85 @@
+#ifndef POLE_PAIRS_H
+#define POLE_PAIRS_H
+
+#include <stdint.h>
+
+// Pole pairs from an open-loop sweep. The bridge turns the field through a
+// known number of electrical turns and the rotor follows it. Everything
+// electrical (hall sequence, back-EMF, current) then repeats once per
+// electrical turn whatever the pole count, so the mechanical turn has to be
+// found from the rotor itself: an eccentric rotor, and the spread of its
+// magnets, shifts the hall edges and modulates the back-EMF once per
+// mechanical turn. Per sixth of an electrical turn one value is taken
+//   - halls: position of the hall edge against the commanded angle
+//   - sensorless: mean current amplitude, which carries the back-EMF
+// What repeats every electrical turn (sector widths, hall placement, the
+// six-step ripple) and a slow drift are fitted out, and every candidate
+// count P is tried as a once per turn sinusoid of period 6 P sixths. The
+// candidates, and the rotor without a visible signature, are weighed by how
+// well they explain the sequence against the noise left over, and the
+// confidence is the share of the winner. A rotor without a signature reads
+// as one pole pair, which looks exactly the same, so that answer never
+// claims much. Only the fundamental is fitted: a signature whose second
+// harmonic outweighs it can read as half the count.
+// Kept free of Arduino dependencies so the analysis can be checked on the
+// host.
+
+#define POLE_PAIRS_MAX          14
+#define POLE_SWEEP_TURNS        (6 * POLE_PAIRS_MAX)    // six mechanical turns at the most pole pairs
+#define POLE_SWEEP_SIXTHS       (6 * POLE_SWEEP_TURNS)
+#define POLE_SWEEP_HZ           25      // electrical, after the ramp: a whole number of steps per turn
+#define POLE_SWEEP_ALIGN_MS     150     // rotor pulled onto the field first
+#define POLE_SWEEP_RAMP_MS      250     // linear frequency ramp up to POLE_SWEEP_HZ
+#define POLE_SWEEP_SETTLE_TURNS 2       // at constant speed before the measured turns
+#define POLE_SWEEP_STEP_US      200     // commanded angle update
+#define POLE_SWEEP_TURN_SAMPLES 48      // current samples per turn, a whole number so ripple averages out
+#define POLE_SWEEP_CURRENT      2.0f    // A at standstill, the voltage follows from the phase resistance
+#define POLE_SWEEP_VOLTAGE      1.0f    // V at standstill when the resistance is unknown
+#define POLE_SWEEP_BOOST        0.1f    // of the supply, added in proportion to the frequency
+#define POLE_MIN_CONFIDENCE     0.9f    // below this the count is not known
+#define POLE_FLAT_CONFIDENCE    0.25f   // the most a sweep without any signature can claim
+#define POLE_LOCK_TOLERANCE     0.1f    // hall edges per commanded turn within 6 +- 10 %
+#define POLE_LOCK_MAX_SPREAD    0.05f   // rad rms of the hall edges around where each hall sits
+#define POLE_EDGE_JITTER_US     2       // hall edge timestamp resolution and ISR latency
+
+enum PolePairSource {
+    POLE_SOURCE_NONE = 0,
+    POLE_SOURCE_HALLS,
+    POLE_SOURCE_CURRENT
+};
+
+struct PoleFeature {
+    float sum;
+    uint16_t count;
+};
+
+struct PolePairResult {
+    int polePairs;              // 0 when nothing usable was measured
+    float confidence;           // 0 .. 1, POLE_MIN_CONFIDENCE and above is a measured count
+    PolePairSource source;
+    bool locked;                // hall edges kept pace with the commanded angle, and close to it
+    float amplitude;            // of the once per turn signature, rad or A
+    uint16_t sixths;            // sixths of an electrical turn with a value
+};
+
+// Commanded electrical angle (rad) and frequency (Hz) elapsedUs after the
+// ramp started, and when and at which angle the measured turns begin
+float poleSweepAngle(uint32_t elapsedUs);
+float poleSweepFrequency(uint32_t elapsedUs);
+uint32_t poleSweepMeasureStartUs();
+float poleSweepStartAngle();
+uint32_t poleSweepDurationUs();
+
+// Adds value to the measured sixth the electrical angle is in, ignored
+// outside them
+void poleFeatureAdd(PoleFeature* sixths, float angle, float value);
+
+// Pole pairs that best explain the per sixth sequence, 1 when it shows no
+// once per turn signature, 0 when too little of it has a value.
+// confidence is the weight of that answer against all the others.
+// noiseFloor is the rms a value cannot be measured better than, whatever
+// the sequence itself suggests.
+int findPolePairs(const PoleFeature* sixths, uint16_t count, float noiseFloor, float* confidence,
+                  float* amplitude, uint16_t* used);
+
+#endif
@@ -0,0 +1,76 @@
+#include "relay_tune.h"
+#include <math.h>
+
+#define RELAY_PI  3.14159265f
+
+void relayTuneBegin(RelayTune* tune, float setpoint, float amplitude, float bias) {
+    *tune = RelayTune();
+    tune->setpoint = setpoint;
+    tune->amplitude = fabsf(amplitude);
+    tune->hysteresis = fabsf(setpoint) * RELAY_TUNE_HYSTERESIS;
+    tune->bias = bias;
+    // Below the setpoint from standstill, the relay starts high and the
+    // cycles count from its first switch back up
+    tune->high = true;
+}
+
+float relayTuneUpdate(RelayTune* tune, float velocity, uint32_t tUs) {
+    // Spinning up: more torque until the setpoint is reached
+    if (tune->high && tune->switchLowUs == 0 && tune->lastUpdateUs != 0) {
+        tune->bias += RELAY_TUNE_BIAS_RAMP * tune->amplitude * (tUs - tune->lastUpdateUs) * 1e-6f;
+    }
+    tune->lastUpdateUs = tUs;
+
+    if (velocity > tune->cycleMax) tune->cycleMax = velocity;
+    if (velocity < tune->cycleMin) tune->cycleMin = velocity;
+
+    if (tune->high && velocity > tune->setpoint + tune->hysteresis) {
+        tune->high = false;
+        tune->switchLowUs = tUs;
+    } else if (!tune->high && velocity < tune->setpoint - tune->hysteresis) {
+        tune->high = true;
+        if (tune->started && !relayTuneDone(tune)) {
+            uint32_t periodUs = tUs - tune->cycleStartUs;
+            uint32_t highUs = tune->switchLowUs - tune->cycleStartUs;
+            tune->cycles++;
+            if (tune->cycles > RELAY_TUNE_SKIP_CYCLES) {
+                tune->periodSum += periodUs * 1e-6f;
+                tune->swingSum += tune->cycleMax - tune->cycleMin;
+            }
+            // More time high than low: the bias is short of the load
+            float imbalance = ((float)highUs - (float)(periodUs - highUs)) / periodUs;
+            tune->bias += RELAY_TUNE_BIAS_GAIN * imbalance * tune->amplitude;
+        }
+        tune->started = true;
+        tune->cycleStartUs = tUs;
+        tune->cycleMax = tune->cycleMin = velocity;
+    }
+
+    return tune->bias + (tune->high ? tune->amplitude : -tune->amplitude);
+}
+
+bool relayTuneDone(const RelayTune* tune) {
+    return tune->cycles >= RELAY_TUNE_MAX_CYCLES;
+}
+
+RelayTuneResult relayTuneResult(const RelayTune* tune, float speedUpdateS) {
+    RelayTuneResult result = {false, 0, 0, 0, tune->bias, 0, 0, 0, 0};
+    uint8_t measured = tune->cycles > RELAY_TUNE_SKIP_CYCLES ? tune->cycles - RELAY_TUNE_SKIP_CYCLES : 0;
+    result.cycles = measured;
+    if (measured == 0) return result;
+
+    result.ultimatePeriod = tune->periodSum / measured;
+    result.amplitude = tune->swingSum / measured / 2;
+    float h = tune->hysteresis;
+    if (result.amplitude <= h || result.ultimatePeriod <= 0) return result;
+
+    result.ultimateGain = 4 * tune->amplitude / (RELAY_PI * sqrtf(result.amplitude * result.amplitude - h * h));
+    result.kp = 0.45f * result.ultimateGain;
+    result.ki = result.kp * 1.2f / result.ultimatePeriod;
+
+    float filterTf = result.ultimatePeriod / (2 * RELAY_PI * RELAY_TUNE_FILTER_RATIO);
+    float minTf = RELAY_TUNE_FILTER_UPDATES * speedUpdateS;
+    result.filterTf = filterTf > minTf ? filterTf : minTf;
+    result.valid = true;
+    return result;
+}
@@ -0,0 +1,72 @@
+#ifndef RELAY_TUNE_H
+#define RELAY_TUNE_H
+
+#include <stdint.h>
+
+// Relay feedback autotune (Astrom-Hagglund) of the velocity loop. Instead of
+// the PI, a relay drives the torque command: bias + amplitude while the
+// speed is below the setpoint, bias - amplitude once it is above. The loop
+// settles into a limit cycle at the frequency where the plant, the
+// velocity measurement included, turns the phase by 180 degrees. Its period
+// is the ultimate period Tu, and from the speed swing a the describing
+// function of the relay gives the ultimate gain
+//   Ku = 4 d / (pi sqrt(a^2 - h^2))
+// with d the relay amplitude and h its hysteresis. The bias follows the
+// load so high and low halves last equally long, otherwise the cycle is
+// lopsided and a is misread. Until the speed first reaches the setpoint the
+// bias ramps up, so neither needs to be known in advance. Ziegler-Nichols
+// then gives the PI gains
+//   Kp = 0.45 Ku, Ki = Kp / (Tu / 1.2)
+// and the velocity filter goes well above the ultimate frequency, but not
+// below a few speed updates. Units are whatever the caller uses: torque
+// command (V or A) and rad/s give gains in V or A per rad/s.
+// Kept free of Arduino dependencies so it can be checked on the host.
+
+#define RELAY_TUNE_CYCLES         4      // limit cycles averaged
+#define RELAY_TUNE_SKIP_CYCLES    2      // while the cycle and the bias settle
+#define RELAY_TUNE_MAX_CYCLES     (RELAY_TUNE_CYCLES + RELAY_TUNE_SKIP_CYCLES)
+#define RELAY_TUNE_HYSTERESIS     0.02f  // of the setpoint, against speed quantization
+#define RELAY_TUNE_BIAS_GAIN      0.5f   // bias correction per cycle, of the duty imbalance
+#define RELAY_TUNE_BIAS_RAMP      2.0f   // amplitudes per second the bias climbs until the setpoint is reached
+#define RELAY_TUNE_FILTER_RATIO   5.0f   // filter corner over the ultimate frequency
+#define RELAY_TUNE_FILTER_UPDATES 2.0f   // filter time constant at least this many speed updates
+
+struct RelayTune {
+    float setpoint;
+    float amplitude;
+    float hysteresis;
+    float bias;
+    bool high;                  // relay output
+    bool started;               // first switch to high seen, cycles count from there
+    uint32_t cycleStartUs;      // last switch to high
+    uint32_t switchLowUs;       // last switch to low
+    uint32_t lastUpdateUs;
+    float cycleMax;
+    float cycleMin;
+    uint8_t cycles;             // complete cycles, skipped ones included
+    float periodSum;            // s, over the measured cycles
+    float swingSum;             // peak to peak
+};
+
+struct RelayTuneResult {
+    bool valid;
+    float ultimateGain;         // Ku, torque command per rad/s
+    float ultimatePeriod;       // Tu, s
+    float amplitude;            // a, rad/s, half the speed swing
+    float bias;                 // torque command that held the setpoint
+    float kp;
+    float ki;
+    float filterTf;             // s, velocity low pass
+    uint8_t cycles;             // limit cycles averaged
+};
+
+// bias is the first guess of the torque that holds setpoint, 0 will do
+void relayTuneBegin(RelayTune* tune, float setpoint, float amplitude, float bias);
+// Torque command for the speed measured at tUs
+float relayTuneUpdate(RelayTune* tune, float velocity, uint32_t tUs);
+bool relayTuneDone(const RelayTune* tune);
+// speedUpdateS is how often the speed measurement changes at the setpoint,
+// a hall sector period
+RelayTuneResult relayTuneResult(const RelayTune* tune, float speedUpdateS);
+
+#endif
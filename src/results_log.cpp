@@ -0,0 +1,438 @@
+#include "results_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define RESULTS_INDEX_MAGIC    0x31495442   // "BTI1"
+#define RESULTS_PATH_LENGTH    64
+#define RESULTS_MERGE_BLOCK    32           // index entries per read or write while merging
+#define RESULTS_CLOCK_VALID    1600000000   // anything earlier is time since boot
+
+static_assert(sizeof(ResultRecord) == 172, "ResultRecord is the file format");
+
+struct IndexHeader {
+    uint32_t magic;
+    uint32_t entries;       // records 0 .. entries - 1 are in the file
+};
+
+struct IndexEntry {
+    uint32_t hash;
+    uint32_t record;
+};
+
+static char logPath[RESULTS_PATH_LENGTH];
+static char indexPath[RESULTS_PATH_LENGTH];
+static char mergePath[RESULTS_PATH_LENGTH];
+static bool ready = false;
+static uint32_t recordCount = 0;
+static uint32_t indexedCount = 0;
+static uint32_t lastTimestamp = 0;
+// Records indexedCount .. recordCount - 1, in record order
+static IndexEntry tail[RESULTS_INDEX_TAIL];
+static uint32_t tailCount = 0;
+
+#ifdef ARDUINO
+// Appends come from the monitor task, queries from the web server task
+static SemaphoreHandle_t logLock = nullptr;
+static void lockLog() { xSemaphoreTakeRecursive(logLock, portMAX_DELAY); }
+static void unlockLog() { xSemaphoreGiveRecursive(logLock); }
+#else
+static void lockLog() {}
+static void unlockLog() {}
+#endif
+
+uint32_t resultsCrc32(const void* data, size_t length) {
+    // Reflected 0xEDB88320, a nibble at a time
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; i++) {
+        crc = (crc >> 4) ^ table[(crc ^ bytes[i]) & 0x0F];
+        crc = (crc >> 4) ^ table[(crc ^ (bytes[i] >> 4)) & 0x0F];
+    }
+    return ~crc;
+}
+
+static uint32_t serialHash(const char* serial) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < TEST_SERIAL_LENGTH && serial[i]; i++) {
+        hash = (hash ^ (uint8_t)serial[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static bool entryBefore(const IndexEntry& a, const IndexEntry& b) {
+    return a.hash < b.hash || (a.hash == b.hash && a.record < b.record);
+}
+
+static int compareEntries(const void* a, const void* b) {
+    const IndexEntry& x = *(const IndexEntry*)a;
+    const IndexEntry& y = *(const IndexEntry*)b;
+    return entryBefore(x, y) ? -1 : (entryBefore(y, x) ? 1 : 0);
+}
+
+static long recordOffset(uint32_t record) {
+    return (long)record * sizeof(ResultRecord);
+}
+
+static bool readRecord(FILE* file, uint32_t sequence, ResultRecord* record) {
+    if (fseek(file, recordOffset(sequence), SEEK_SET) != 0) return false;
+    if (fread(record, sizeof(*record), 1, file) != 1) return false;
+    return record->magic == RESULTS_RECORD_MAGIC && record->sequence == sequence &&
+           record->crc == resultsCrc32(record, offsetof(ResultRecord, crc));
+}
+
+static bool writeEntries(FILE* file, IndexEntry* block, uint32_t* count) {
+    bool ok = *count == 0 || fwrite(block, sizeof(IndexEntry), *count, file) == *count;
+    *count = 0;
+    return ok;
+}
+
+// Merge the sorted tail into a new index file, RESULTS_MERGE_BLOCK entries
+// of the old one at a time, and swap it in
+static bool mergeTail() {
+    qsort(tail, tailCount, sizeof(IndexEntry), compareEntries);
+
+    FILE* in = indexedCount ? fopen(indexPath, "rb") : nullptr;
+    if (indexedCount && (!in || fseek(in, sizeof(IndexHeader), SEEK_SET) != 0)) {
+        if (in) fclose(in);
+        return false;
+    }
+    FILE* out = fopen(mergePath, "wb");
+    if (!out) {
+        if (in) fclose(in);
+        return false;
+    }
+
+    IndexHeader header = {RESULTS_INDEX_MAGIC, indexedCount + tailCount};
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+
+    IndexEntry inBlock[RESULTS_MERGE_BLOCK];
+    IndexEntry outBlock[RESULTS_MERGE_BLOCK];
+    uint32_t inLeft = indexedCount, inCount = 0, inPos = 0, outCount = 0, tailPos = 0;
+    while (ok && (inLeft > 0 || inPos < inCount || tailPos < tailCount)) {
+        if (inPos == inCount && inLeft > 0) {
+            inCount = inLeft < RESULTS_MERGE_BLOCK ? inLeft : RESULTS_MERGE_BLOCK;
+            ok = fread(inBlock, sizeof(IndexEntry), inCount, in) == inCount;
+            inLeft -= inCount;
+            inPos = 0;
+            continue;
+        }
+        bool takeTail = inPos == inCount ||
+                        (tailPos < tailCount && entryBefore(tail[tailPos], inBlock[inPos]));
+        outBlock[outCount++] = takeTail ? tail[tailPos++] : inBlock[inPos++];
+        if (outCount == RESULTS_MERGE_BLOCK) ok = writeEntries(out, outBlock, &outCount);
+    }
+    if (ok) ok = writeEntries(out, outBlock, &outCount);
+
+    if (in) fclose(in);
+    ok = fclose(out) == 0 && ok;
+    // LittleFS renames atomically, a power loss leaves the old or the new index
+    if (!ok || rename(mergePath, indexPath) != 0) {
+        remove(mergePath);
+        return false;
+    }
+    indexedCount += tailCount;
+    tailCount = 0;
+    return true;
+}
+
+static void indexRecord(uint32_t record, const char* serial) {
+    if (tailCount == RESULTS_INDEX_TAIL && !mergeTail()) {
+        // Not indexed until the next start rebuilds the tail from the log
+        return;
+    }
+    tail[tailCount].hash = serialHash(serial);
+    tail[tailCount].record = record;
+    tailCount++;
+}
+
+bool resultsLogBegin(const char* directory) {
+#ifdef ARDUINO
+    if (!logLock) logLock = xSemaphoreCreateRecursiveMutex();
+#endif
+    lockLog();
+    snprintf(logPath, sizeof(logPath), "%s/results.bin", directory);
+    snprintf(indexPath, sizeof(indexPath), "%s/serial.idx", directory);
+    snprintf(mergePath, sizeof(mergePath), "%s/serial.tmp", directory);
+    mkdir(directory, 0755);
+    recordCount = indexedCount = tailCount = lastTimestamp = 0;
+
+    // A partly written last record is overwritten by the next append
+    FILE* log = fopen(logPath, "rb");
+    if (log) {
+        if (fseek(log, 0, SEEK_END) == 0) {
+            long size = ftell(log);
+            recordCount = size > 0 ? size / sizeof(ResultRecord) : 0;
+        }
+        ResultRecord last;
+        for (uint32_t i = recordCount; i > 0 && recordCount - i < RESULTS_INDEX_TAIL; i--) {
+            if (readRecord(log, i - 1, &last)) {
+                lastTimestamp = last.timestamp;
+                break;
+            }
+        }
+        fclose(log);
+    }
+
+    // The index is trusted if it covers no more than the log, the rest of
+    // the log goes into the tail
+    FILE* index = fopen(indexPath, "rb");
+    if (index) {
+        IndexHeader header;
+        if (fread(&header, sizeof(header), 1, index) == 1 && header.magic == RESULTS_INDEX_MAGIC &&
+            header.entries <= recordCount && fseek(index, 0, SEEK_END) == 0 &&
+            ftell(index) == (long)(sizeof(header) + header.entries * sizeof(IndexEntry))) {
+            indexedCount = header.entries;
+        }
+        fclose(index);
+    }
+    if (indexedCount == 0) remove(indexPath);
+
+    log = indexedCount < recordCount ? fopen(logPath, "rb") : nullptr;
+    if (log) {
+        ResultRecord record;
+        for (uint32_t i = indexedCount; i < recordCount; i++) {
+            // Damaged records keep their slot under whatever serial is left
+            memset(&record, 0, sizeof(record));
+            readRecord(log, i, &record);
+            record.serial[TEST_SERIAL_LENGTH - 1] = 0;
+            indexRecord(i, record.serial);
+        }
+        fclose(log);
+    }
+
+    ready = true;
+    unlockLog();
+    return true;
+}
+
+uint32_t resultsLogCount() {
+    return recordCount;
+}
+
+uint32_t resultsLogBytes() {
+    return recordCount * sizeof(ResultRecord);
+}
+
+void fillResultRecord(ResultRecord* record, const char* serial, const TestRecord* test,
+                      const MotorParameters& params, const MotorHealth& health) {
+    memset(record, 0, sizeof(*record));
+    strncpy(record->serial, serial ? serial : "", TEST_SERIAL_LENGTH - 1);
+
+    if (test) {
+        record->flags |= RESULT_FLAG_TEST;
+        if (test->passed) record->flags |= RESULT_FLAG_PASSED;
+        if (test->aborted) record->flags |= RESULT_FLAG_ABORTED;
+        record->testDurationMs = test->durationMs;
+        record->stepCount = test->stepCount;
+        for (uint8_t i = 0; i < test->stepCount; i++) {
+            record->stepTypes[i] = test->steps[i].type;
+            record->stepValues[i] = test->steps[i].value;
+            if (test->steps[i].passed) record->stepPassed |= 1 << i;
+            if (test->steps[i].skipped) record->stepSkipped |= 1 << i;
+        }
+    }
+
+    record->phaseResistance = params.phaseResistance;
+    record->phaseInductance = params.phaseInductance;
+    memcpy(record->pairInductance, params.pairInductance, sizeof(record->pairInductance));
+    record->inputVoltage = params.inputVoltage;
+    record->motorKv = params.motorKv;
+    record->polePairs = params.polePairs;
+
+    if (health.phases.phaseA_OK) record->healthFlags |= RESULT_HEALTH_PHASE_A;
+    if (health.phases.phaseB_OK) record->healthFlags |= RESULT_HEALTH_PHASE_B;
+    if (health.phases.phaseC_OK) record->healthFlags |= RESULT_HEALTH_PHASE_C;
+    if (health.halls.hallA_OK) record->healthFlags |= RESULT_HEALTH_HALL_A;
+    if (health.halls.hallB_OK) record->healthFlags |= RESULT_HEALTH_HALL_B;
+    if (health.halls.hallC_OK) record->healthFlags |= RESULT_HEALTH_HALL_C;
+    if (health.inductanceOK) record->healthFlags |= RESULT_HEALTH_INDUCTANCE;
+    if (health.motorTemperatureOK) record->healthFlags |= RESULT_HEALTH_TEMPERATURE;
+    record->healthResistance[0] = health.phases.phaseA_resistance;
+    record->healthResistance[1] = health.phases.phaseB_resistance;
+    record->healthResistance[2] = health.phases.phaseC_resistance;
+    if (health.spectrum.valid) {
+        record->healthFlags |= RESULT_HEALTH_SPECTRUM;
+        if (health.spectrum.spectrumOK) record->healthFlags |= RESULT_HEALTH_SPECTRUM_OK;
+        record->thd = health.spectrum.thd;
+        record->sidebandRatio = health.spectrum.sidebandRatio;
+        record->mechanicalRatio = health.spectrum.mechanicalRatio;
+        record->noiseRatio = health.spectrum.noiseRatio;
+    }
+}
+
+bool resultsLogAppend(ResultRecord* record) {
+    lockLog();
+    if (!ready) {
+        unlockLog();
+        return false;
+    }
+
+    // Keep the log sorted by time even when the clock is not set or goes back
+    uint32_t now = (uint32_t)time(nullptr);
+    if (now >= RESULTS_CLOCK_VALID) {
+        record->flags |= RESULT_FLAG_CLOCK_SET;
+    } else {
+        record->flags &= ~RESULT_FLAG_CLOCK_SET;
+        now = lastTimestamp;
+    }
+    record->timestamp = now > lastTimestamp ? now : lastTimestamp;
+    record->magic = RESULTS_RECORD_MAGIC;
+    record->sequence = recordCount;
+    record->serial[TEST_SERIAL_LENGTH - 1] = 0;
+    record->crc = resultsCrc32(record, offsetof(ResultRecord, crc));
+
+    FILE* log = fopen(logPath, "r+b");
+    if (!log) log = fopen(logPath, "w+b");
+    bool ok = log && fseek(log, recordOffset(recordCount), SEEK_SET) == 0 &&
+              fwrite(record, sizeof(*record), 1, log) == 1;
+    if (log) ok = fclose(log) == 0 && ok;
+
+    if (ok) {
+        recordCount++;
+        lastTimestamp = record->timestamp;
+        indexRecord(record->sequence, record->serial);
+    }
+    unlockLog();
+    return ok;
+}
+
+bool resultsLogRead(uint32_t sequence, ResultRecord* record) {
+    lockLog();
+    bool ok = false;
+    FILE* log = sequence < recordCount ? fopen(logPath, "rb") : nullptr;
+    if (log) {
+        ok = readRecord(log, sequence, record);
+        fclose(log);
+    }
+    unlockLog();
+    return ok;
+}
+
+uint32_t resultsLogFindTime(uint32_t timestamp) {
+    lockLog();
+    uint32_t low = 0, high = recordCount;
+    FILE* log = recordCount ? fopen(logPath, "rb") : nullptr;
+    if (log) {
+        // Only the timestamp of each probed record is read
+        while (low < high) {
+            uint32_t middle = low + (high - low) / 2;
+            uint32_t stamp = 0;
+            if (fseek(log, recordOffset(middle) + offsetof(ResultRecord, timestamp), SEEK_SET) != 0 ||
+                fread(&stamp, sizeof(stamp), 1, log) != 1) {
+                break;
+            }
+            if (stamp < timestamp) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        fclose(log);
+    }
+    unlockLog();
+    return low;
+}
+
+// Record of the first index file entry at or after (hash, from) if it has
+// this hash, recordCount otherwise
+static uint32_t searchIndexFile(uint32_t hash, uint32_t from) {
+    FILE* index = fopen(indexPath, "rb");
+    if (!index) return recordCount;
+
+    IndexEntry key = {hash, from};
+    IndexEntry entry;
+    uint32_t low = 0, high = indexedCount;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (fseek(index, sizeof(IndexHeader) + middle * sizeof(IndexEntry), SEEK_SET) != 0 ||
+            fread(&entry, sizeof(entry), 1, index) != 1) {
+            fclose(index);
+            return recordCount;
+        }
+        if (entryBefore(entry, key)) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    uint32_t found = recordCount;
+    if (low < indexedCount && fseek(index, sizeof(IndexHeader) + low * sizeof(IndexEntry), SEEK_SET) == 0 &&
+        fread(&entry, sizeof(entry), 1, index) == 1 && entry.hash == hash) {
+        found = entry.record;
+    }
+    fclose(index);
+    return found;
+}
+
+uint32_t resultsLogFindSerial(const char* serial, uint32_t from) {
+    lockLog();
+    uint32_t hash = serialHash(serial);
+    uint32_t found = recordCount;
+
+    while (from < recordCount) {
+        uint32_t candidate = from < indexedCount ? searchIndexFile(hash, from) : recordCount;
+        for (uint32_t i = 0; candidate == recordCount && i < tailCount; i++) {
+            if (tail[i].hash == hash && tail[i].record >= from) candidate = tail[i].record;
+        }
+        if (candidate == recordCount) break;
+
+        // Hashes collide, the record decides
+        ResultRecord record;
+        if (resultsLogRead(candidate, &record) && strncmp(record.serial, serial, TEST_SERIAL_LENGTH) == 0) {
+            found = candidate;
+            break;
+        }
+        from = candidate + 1;
+    }
+    unlockLog();
+    return found;
+}
+
+void resultsCursorBegin(ResultsCursor* cursor, const char* serial, uint32_t from, uint32_t to,
+                        uint32_t start, uint32_t limit) {
+    memset(cursor, 0, sizeof(*cursor));
+    if (serial) strncpy(cursor->serial, serial, TEST_SERIAL_LENGTH - 1);
+    cursor->to = to;
+    cursor->remaining = limit == 0 ? RESULTS_PAGE_DEFAULT : (limit > RESULTS_PAGE_MAX ? RESULTS_PAGE_MAX : limit);
+
+    if (cursor->serial[0]) {
+        cursor->next = resultsLogFindSerial(cursor->serial, start);
+    } else {
+        uint32_t first = resultsLogFindTime(from);
+        cursor->next = start > first ? start : first;
+    }
+}
+
+bool resultsCursorNext(ResultsCursor* cursor, ResultRecord* record, bool* intact) {
+    uint32_t count = resultsLogCount();
+    if (cursor->next >= count) {
+        cursor->next = count;
+        return false;
+    }
+    if (cursor->remaining == 0) return false;
+
+    uint32_t current = cursor->next;
+    *intact = resultsLogRead(current, record);
+    if (cursor->serial[0]) {
+        cursor->next = resultsLogFindSerial(cursor->serial, current + 1);
+    } else {
+        // A damaged timestamp does not end the range
+        if (*intact && record->timestamp > cursor->to) {
+            cursor->next = count;
+            return false;
+        }
+        cursor->next = current + 1;
+    }
+    if (!*intact) record->sequence = current;
+    cursor->remaining--;
+    return true;
+}
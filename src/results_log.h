@@ -0,0 +1,120 @@
+#ifndef RESULTS_LOG_H
+#define RESULTS_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "motor_analysis.h"
+#include "test_sequencer.h"
+
+// Append-only log of measurement results on the flash filesystem. Records
+// have a fixed size, so record n is at n * sizeof(ResultRecord) and every
+// lookup is a few seeks:
+//   - by time: timestamps never decrease in the log, binary search on the
+//     records themselves
+//   - by serial number: a separate index file of (serial hash, record)
+//     pairs sorted by hash, binary searched. Appends collect in a small RAM
+//     tail that is merged into the index file when full, streaming, so RAM
+//     use does not depend on the log size.
+//
+// Plain stdio on a directory: LittleFS is mounted in the VFS on the ESP32
+// and any directory works on the host. LittleFS commits a write on close,
+// so a record is either complete or missing after a power loss; the CRC
+// catches flash corruption. Safe to use from several tasks.
+
+#define RESULTS_RECORD_MAGIC   0x31525442   // "BTR1", also the format version
+#define RESULTS_INDEX_TAIL     128          // appends held in RAM before an index merge
+#define RESULTS_PAGE_DEFAULT   50           // records per query page
+#define RESULTS_PAGE_MAX       1000
+
+// Record flags
+#define RESULT_FLAG_TEST       (1 << 0)     // from the test sequencer, else a manual save
+#define RESULT_FLAG_PASSED     (1 << 1)
+#define RESULT_FLAG_ABORTED    (1 << 2)
+#define RESULT_FLAG_CLOCK_SET  (1 << 3)     // timestamp is wall time, else carried over
+
+// Health flags
+#define RESULT_HEALTH_PHASE_A      (1 << 0)
+#define RESULT_HEALTH_PHASE_B      (1 << 1)
+#define RESULT_HEALTH_PHASE_C      (1 << 2)
+#define RESULT_HEALTH_HALL_A       (1 << 3)
+#define RESULT_HEALTH_HALL_B       (1 << 4)
+#define RESULT_HEALTH_HALL_C       (1 << 5)
+#define RESULT_HEALTH_INDUCTANCE   (1 << 6)
+#define RESULT_HEALTH_TEMPERATURE  (1 << 7)
+#define RESULT_HEALTH_SPECTRUM     (1 << 8)     // a spectral run is included
+#define RESULT_HEALTH_SPECTRUM_OK  (1 << 9)
+
+// 172 bytes on flash, the layout is the file format: only append fields
+// under a new magic
+struct ResultRecord {
+    uint32_t magic;
+    uint32_t sequence;                      // record number, from 0
+    uint32_t timestamp;                     // unix seconds, never decreasing in the log
+    char serial[TEST_SERIAL_LENGTH];
+    uint8_t flags;                          // RESULT_FLAG_*
+    uint8_t stepCount;
+    uint16_t healthFlags;                   // RESULT_HEALTH_*
+    uint32_t testDurationMs;
+
+    // Test steps: type, value and outcome
+    uint8_t stepTypes[TEST_PLAN_MAX_STEPS];
+    uint16_t stepPassed;                    // bit per step
+    uint16_t stepSkipped;
+    float stepValues[TEST_PLAN_MAX_STEPS];
+
+    // MotorParameters
+    float phaseResistance;
+    float phaseInductance;
+    float pairInductance[3];
+    float inputVoltage;
+    float motorKv;
+    int32_t polePairs;
+
+    // MotorHealth
+    float healthResistance[3];
+    float thd;
+    float sidebandRatio;
+    float mechanicalRatio;
+    float noiseRatio;
+
+    uint32_t crc;                           // CRC-32 of everything above
+};
+
+// Walks the records of one query in record order
+struct ResultsCursor {
+    char serial[TEST_SERIAL_LENGTH];        // empty for a time range
+    uint32_t to;                            // last timestamp included
+    uint32_t next;                          // next record to look at
+    uint32_t remaining;                     // records left on this page
+};
+
+bool resultsLogBegin(const char* directory);
+uint32_t resultsLogCount();
+uint32_t resultsLogBytes();
+
+// Fill from a finished test (or nullptr for a manual save) and the current
+// parameters and health
+void fillResultRecord(ResultRecord* record, const char* serial, const TestRecord* test,
+                      const MotorParameters& params, const MotorHealth& health);
+// Assigns sequence, timestamp and CRC, then appends
+bool resultsLogAppend(ResultRecord* record);
+// False on a read error or a CRC mismatch
+bool resultsLogRead(uint32_t sequence, ResultRecord* record);
+
+// First record with timestamp >= t, resultsLogCount() if none
+uint32_t resultsLogFindTime(uint32_t timestamp);
+// First record >= from for this serial, resultsLogCount() if none
+uint32_t resultsLogFindSerial(const char* serial, uint32_t from);
+
+// A page of records either for one serial or in [from, to], starting at
+// record start. resultsCursorNext() returns false at the end of the page;
+// *intact is false for a record that failed its CRC (still returned so the
+// page can report it). Afterwards cursor.next is where the next page starts,
+// resultsLogCount() when there is nothing more.
+void resultsCursorBegin(ResultsCursor* cursor, const char* serial, uint32_t from, uint32_t to,
+                        uint32_t start, uint32_t limit);
+bool resultsCursorNext(ResultsCursor* cursor, ResultRecord* record, bool* intact);
+
+uint32_t resultsCrc32(const void* data, size_t length);
+
+#endif
@@ -0,0 +1,216 @@
+#include "scope_capture.h"
+#include "motor_analysis.h"
+#include "hall_capture.h"
+
+// The record is written by the sampler tap (sampler task on the ESP32) and
+// only read back once the state is SCOPE_DONE.
+static uint16_t buffer[SCOPE_BUFFER_SAMPLES];
+static volatile ScopeState state = SCOPE_IDLE;
+static ScopeConfig active;
+
+static uint8_t channelList[ADC_CH_COUNT];
+static uint8_t channelCount = 0;
+static uint16_t length = 0;          // sample sets in the record
+static uint16_t preTrigger = 0;
+static uint32_t decimation = 1;
+static uint32_t decimationCount = 0;
+static float actualRateHz = 0;
+static float voltageRateHz = 0;
+
+static volatile uint32_t written = 0;   // sample sets written since arming
+static uint32_t triggerSet = 0;         // value of written at the trigger
+static uint32_t triggerTimeUs = 0;
+static float previousValue = 0;
+static uint32_t hallEdgesAtArm = 0;
+static volatile bool forceTrigger = false;
+static bool forced = false;
+static bool samplerClaimed = false;
+static bool completionReported = false;
+static uint32_t armedAtMs = 0;
+
+ScopeConfig defaultScopeConfig() {
+    ScopeConfig config;
+    config.channelMask = (1 << ADC_CH_I_SENSE1) | (1 << ADC_CH_I_SENSE2) |
+                         (1 << ADC_CH_VA) | (1 << ADC_CH_VB) | (1 << ADC_CH_VC);
+    config.sampleRateHz = SCOPE_DEFAULT_RATE_HZ;
+    config.length = SCOPE_BUFFER_SAMPLES / 5;
+    config.preTrigger = config.length / 4;
+    config.source = SCOPE_TRIGGER_IMMEDIATE;
+    config.triggerChannel = ADC_CH_I_SENSE1;
+    config.edge = SCOPE_EDGE_RISING;
+    config.level = 0;
+    config.timeoutMs = 1000;
+    return config;
+}
+
+float scopeRawToUnits(AdcChannel channel, uint16_t raw) {
+    return adcRawToUnits(channel, raw);
+}
+
+static bool levelCrossed(float previous, float value) {
+    bool rising = previous < active.level && value >= active.level;
+    bool falling = previous > active.level && value <= active.level;
+    switch (active.edge) {
+        case SCOPE_EDGE_RISING:  return rising;
+        case SCOPE_EDGE_FALLING: return falling;
+        default:                 return rising || falling;
+    }
+}
+
+static bool triggerFired(const uint16_t* samples) {
+    if (forceTrigger) return true;
+
+    switch (active.source) {
+        case SCOPE_TRIGGER_IMMEDIATE:
+            return true;
+        case SCOPE_TRIGGER_LEVEL: {
+            float value = scopeRawToUnits(active.triggerChannel, samples[active.triggerChannel]);
+            bool crossed = levelCrossed(previousValue, value);
+            previousValue = value;
+            return crossed;
+        }
+        case SCOPE_TRIGGER_HALL:
+            return hallCaptureEdges() != hallEdgesAtArm;
+        case SCOPE_TRIGGER_FAULT:
+            return halFaultActive();
+    }
+    return false;
+}
+
+// Sampler tap, one call per converted set of all channels
+static void onSampleSet(const uint16_t* samples) {
+    ScopeState current = state;
+    if (current == SCOPE_IDLE || current == SCOPE_DONE) return;
+    if (++decimationCount < decimation) return;
+    decimationCount = 0;
+
+    uint16_t* slot = &buffer[(written % length) * channelCount];
+    for (uint8_t i = 0; i < channelCount; i++) {
+        slot[i] = samples[channelList[i]];
+    }
+    written = written + 1;
+
+    if (current == SCOPE_PRETRIGGER) {
+        if (written >= preTrigger) {
+            previousValue = scopeRawToUnits(active.triggerChannel, samples[active.triggerChannel]);
+            state = SCOPE_ARMED;
+        }
+        return;
+    }
+
+    if (current == SCOPE_ARMED) {
+        if (!triggerFired(samples)) return;
+        triggerSet = written - 1;
+        triggerTimeUs = halMicros();
+        current = SCOPE_POSTTRIGGER;
+    }
+
+    // The trigger sample counts as the first sample after the trigger
+    state = (written - triggerSet >= (uint32_t)(length - preTrigger)) ? SCOPE_DONE : current;
+}
+
+static void releaseSampler() {
+    if (!samplerClaimed) return;
+    adcSamplerSetTap(nullptr);
+    adcSamplerSetRate(ADC_SAMPLER_SAMPLE_RATE, ADC_SAMPLER_OVERSAMPLE);
+    samplerClaimed = false;
+}
+
+bool scopeArm(const ScopeConfig& config) {
+    scopeStop();
+
+    uint8_t count = 0;
+    for (int ch = 0; ch < ADC_CH_COUNT; ch++) {
+        if (config.channelMask & (1 << ch)) channelList[count++] = ch;
+    }
+    if (count == 0 || config.sampleRateHz == 0) return false;
+    if (config.source == SCOPE_TRIGGER_LEVEL && config.triggerChannel >= ADC_CH_COUNT) return false;
+
+    // Convert every channel at the lowest ADC rate that covers the request,
+    // then keep every n-th set
+    uint32_t adcRate = config.sampleRateHz * ADC_CH_COUNT;
+    adcRate = constrain(adcRate, (uint32_t)ADC_SAMPLER_MIN_RATE, (uint32_t)ADC_SAMPLER_MAX_RATE);
+    if (!adcSamplerSetRate(adcRate, 1)) return false;
+    samplerClaimed = true;
+
+    uint32_t channelRate = adcSamplerChannelRate();
+    decimation = (channelRate + config.sampleRateHz / 2) / config.sampleRateHz;
+    if (decimation == 0) decimation = 1;
+    actualRateHz = (float)channelRate / decimation;
+    float voltageRate = adcSamplerConversionRate(ADC_CH_VIN);
+    voltageRateHz = voltageRate < actualRateHz ? voltageRate : actualRateHz;
+
+    active = config;
+    channelCount = count;
+    length = config.length;
+    if (length > SCOPE_BUFFER_SAMPLES / count) length = SCOPE_BUFFER_SAMPLES / count;
+    if (length < 2) length = 2;
+    preTrigger = config.preTrigger < length ? config.preTrigger : length - 1;
+
+    written = 0;
+    decimationCount = 0;
+    forceTrigger = false;
+    forced = false;
+    completionReported = false;
+    hallEdgesAtArm = hallCaptureEdges();
+    armedAtMs = halMillis();
+
+    state = preTrigger > 0 ? SCOPE_PRETRIGGER : SCOPE_ARMED;
+    adcSamplerSetTap(onSampleSet);
+    return true;
+}
+
+void scopeStop() {
+    state = SCOPE_IDLE;
+    releaseSampler();
+}
+
+ScopeState scopeState() {
+    return state;
+}
+
+bool scopeTick() {
+    ScopeState current = state;
+
+    if (current == SCOPE_ARMED && active.timeoutMs > 0 && !forceTrigger &&
+        halMillis() - armedAtMs >= active.timeoutMs) {
+        // Like a scope in auto mode: show something rather than nothing
+        forced = true;
+        forceTrigger = true;
+    }
+
+    if (current != SCOPE_DONE) return false;
+    releaseSampler();
+    if (completionReported) return false;
+    completionReported = true;
+    return true;
+}
+
+bool scopeCaptureInfo(ScopeCaptureInfo* info) {
+    if (state != SCOPE_DONE) return false;
+
+    info->channelMask = active.channelMask;
+    info->channels = channelCount;
+    info->sampleRateHz = actualRateHz;
+    info->voltageRateHz = voltageRateHz;
+    info->length = length;
+    info->triggerIndex = (uint16_t)(triggerSet - (written - length));
+    info->triggerTimeUs = triggerTimeUs;
+    info->source = active.source;
+    info->forced = forced;
+    return true;
+}
+
+uint16_t scopeReadValues(uint32_t offset, float* out, uint16_t max) {
+    if (state != SCOPE_DONE) return 0;
+
+    uint32_t total = (uint32_t)length * channelCount;
+    uint32_t first = written - length;   // oldest sample set of the record
+    uint16_t count = 0;
+    for (uint32_t i = offset; i < total && count < max; i++, count++) {
+        uint32_t set = (first + i / channelCount) % length;
+        uint8_t index = i % channelCount;
+        out[count] = scopeRawToUnits((AdcChannel)channelList[index], buffer[set * channelCount + index]);
+    }
+    return count;
+}
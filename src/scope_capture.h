@@ -0,0 +1,87 @@
+#ifndef SCOPE_CAPTURE_H
+#define SCOPE_CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "adc_sampler.h"
+
+// Triggered capture of the phase currents and voltages, like a storage
+// oscilloscope. Arming raises the sampler's conversion rate and taps every
+// sample set; the selected channels go into a circular RAM buffer until the
+// trigger fires and the post trigger part is full. The finished record is
+// read back in physical units (A, V) in chunks for streaming.
+//
+// While the FOC loop owns the ADC (adcSamplerSyncedToPwm()) the rate
+// request cannot take effect: sample sets come at the control loop rate and
+// the voltages take turns, each repeating until its next conversion. The
+// record then reports the lower voltageRateHz next to sampleRateHz.
+
+#define SCOPE_BUFFER_SAMPLES  8192   // raw samples over all selected channels
+#define SCOPE_DEFAULT_RATE_HZ 10000  // per channel
+
+enum ScopeTriggerSource {
+    SCOPE_TRIGGER_IMMEDIATE = 0,  // as soon as the pre trigger part is full
+    SCOPE_TRIGGER_LEVEL,          // triggerChannel crosses level
+    SCOPE_TRIGGER_HALL,           // any hall transition
+    SCOPE_TRIGGER_FAULT           // driver fault pin asserted
+};
+
+enum ScopeEdge {
+    SCOPE_EDGE_RISING = 0,
+    SCOPE_EDGE_FALLING,
+    SCOPE_EDGE_EITHER
+};
+
+enum ScopeState {
+    SCOPE_IDLE = 0,
+    SCOPE_PRETRIGGER,     // filling the part before the trigger
+    SCOPE_ARMED,          // waiting for the trigger
+    SCOPE_POSTTRIGGER,    // triggered, filling the rest
+    SCOPE_DONE
+};
+
+struct ScopeConfig {
+    uint8_t channelMask;          // bit per AdcChannel
+    uint32_t sampleRateHz;        // per channel, rounded to what the ADC can do
+    uint16_t length;              // samples per channel, clamped to the buffer
+    uint16_t preTrigger;          // samples per channel before the trigger
+    ScopeTriggerSource source;
+    AdcChannel triggerChannel;    // SCOPE_TRIGGER_LEVEL only
+    ScopeEdge edge;
+    float level;                  // A for current channels, V for voltages
+    uint32_t timeoutMs;           // force a trigger after this long, 0 waits forever
+};
+
+struct ScopeCaptureInfo {
+    uint8_t channelMask;
+    uint8_t channels;             // number of channels in the record
+    float sampleRateHz;           // actual per channel rate
+    float voltageRateHz;          // new voltage values per second, below sampleRateHz
+                                  // while the sampler is synced to the PWM
+    uint16_t length;              // sample sets in the record
+    uint16_t triggerIndex;        // sample set at which the trigger fired
+    uint32_t triggerTimeUs;
+    ScopeTriggerSource source;
+    bool forced;                  // timed out and triggered anyway
+};
+
+ScopeConfig defaultScopeConfig();
+
+// Start a capture, replacing any capture in progress
+bool scopeArm(const ScopeConfig& config);
+void scopeStop();
+ScopeState scopeState();
+
+// Monitor task: handles the trigger timeout and gives the ADC back once the
+// capture is done. Returns true once per finished capture.
+bool scopeTick();
+
+bool scopeCaptureInfo(ScopeCaptureInfo* info);
+// Interleaved values of the finished record in A / V, starting at sample
+// offset (counted over all channels). Returns the number of values copied.
+uint16_t scopeReadValues(uint32_t offset, float* out, uint16_t max);
+
+// Raw ADC value of a channel in A or V
+float scopeRawToUnits(AdcChannel channel, uint16_t raw);
+
+#endif
@@ -0,0 +1,112 @@
+#if defined(SIM_SWEEP_MODE) && !defined(ARDUINO)
+
+#include "sim_sweep.h"
+#include "motor_analysis.h"
+#include "pole_pairs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+static uint32_t sweepState;
+
+static float uniform() {
+    sweepState ^= sweepState << 13;
+    sweepState ^= sweepState >> 17;
+    sweepState ^= sweepState << 5;
+    return (sweepState >> 8) / 16777216.0f;
+}
+
+static float logUniform(float low, float high) {
+    return low * powf(high / low, uniform());
+}
+
+// The error that the given share of the errors is at or below
+static float quantile(std::vector<float>& errors, float share) {
+    if (errors.empty()) return 0;
+    size_t k = (size_t)(share * (errors.size() - 1));
+    std::nth_element(errors.begin(), errors.begin() + k, errors.end());
+    return errors[k];
+}
+
+static BldcSimParams randomMotor(uint32_t seed) {
+    BldcSimParams p = defaultSimParams();
+    p.phaseResistance = logUniform(SIM_SWEEP_R_MIN, SIM_SWEEP_R_MAX);
+    p.phaseInductance = logUniform(SIM_SWEEP_L_MIN, SIM_SWEEP_L_MAX);
+    p.backEmfConstant = logUniform(SIM_SWEEP_KE_MIN, SIM_SWEEP_KE_MAX);
+    p.inertia = logUniform(SIM_SWEEP_INERTIA_MIN, SIM_SWEEP_INERTIA_MAX);
+    p.polePairs = 1 + (int)(uniform() * SIM_SWEEP_MAX_POLE_PAIRS);
+    p.hallOffset = (uniform() - 0.5f) * 0.2f;
+    p.rotorEccentricity = uniform() * SIM_SWEEP_ECCENTRICITY_MAX;
+    p.seed = seed;
+    return p;
+}
+
+int main(int argc, char** argv) {
+    uint32_t motors = argc > 1 ? (uint32_t)strtoul(argv[1], nullptr, 10) : SIM_SWEEP_MOTORS;
+    uint32_t firstSeed = argc > 2 ? (uint32_t)strtoul(argv[2], nullptr, 10) : 1;
+    sweepState = firstSeed * 2654435761u + 1;
+
+    uint32_t failed = 0, lUnmeasured = 0, ppUnknown = 0, ppCorrect = 0, ppWrong = 0;
+    std::vector<float> errorsR, errorsL;
+    double virtualMsSum = 0, wallMsSum = 0;
+
+    for (uint32_t motor = 0; motor < motors; motor++) {
+        BldcSimParams p = randomMotor(firstSeed + motor);
+        auto start = std::chrono::steady_clock::now();
+
+        halSimConfigure(p);
+        hallCaptureBegin();
+        adcSamplerBegin();
+        halDelayMs(50);
+        motorParams = MotorParameters();
+        uint64_t virtualStartUs = halSimState().timeUs;
+        bool ok = measureMotorParameters();
+        double virtualMs = (halSimState().timeUs - virtualStartUs) / 1000.0;
+
+        std::chrono::duration<double, std::milli> wall = std::chrono::steady_clock::now() - start;
+        float errR = motorParams.phaseResistance / p.phaseResistance - 1;
+        float errL = motorParams.phaseInductance / p.phaseInductance - 1;
+
+        printf("{\"motor\":%u,\"R\":%.4g,\"estR\":%.4g,\"errR\":%.4f,\"L\":%.4g,\"estL\":%.4g,\"errL\":%.4f,"
+               "\"pp\":%d,\"estPp\":%u,\"ppConfidence\":%.2f,\"hallValid\":%s,\"ok\":%s,"
+               "\"virtualMs\":%.0f,\"wallMs\":%.1f}\n",
+               (unsigned)motor, p.phaseResistance, motorParams.phaseResistance, errR, p.phaseInductance,
+               motorParams.phaseInductance, errL, p.polePairs, (unsigned)motorParams.polePairs,
+               motorParams.polePairConfidence, motorParams.hallValid ? "true" : "false", ok ? "true" : "false",
+               virtualMs, wall.count());
+
+        if (!ok) failed++;
+        uint8_t measured = motorParams.measured;
+        if (measured & MEASURED_RESISTANCE) errorsR.push_back(fabsf(errR));
+        if (measured & MEASURED_INDUCTANCE) {
+            errorsL.push_back(fabsf(errL));
+        } else {
+            lUnmeasured++;
+        }
+        if (!(measured & MEASURED_POLE_PAIRS)) {
+            ppUnknown++;
+        } else if (motorParams.polePairs == p.polePairs) {
+            ppCorrect++;
+        } else {
+            ppWrong++;
+        }
+        virtualMsSum += virtualMs;
+        wallMsSum += wall.count();
+    }
+
+    printf("{\"summary\":\"sweep\",\"motors\":%u,\"failed\":%u,"
+           "\"errRMedian\":%.4f,\"errRP90\":%.4f,\"errRMax\":%.4f,"
+           "\"errLMedian\":%.4f,\"errLP90\":%.4f,\"errLMax\":%.4f,\"lUnmeasured\":%u,"
+           "\"ppCorrect\":%.3f,\"ppUnknown\":%u,\"ppWrong\":%u,\"virtualMsMean\":%.0f,\"wallMsMean\":%.1f}\n",
+           (unsigned)motors, (unsigned)failed,
+           quantile(errorsR, 0.5f), quantile(errorsR, 0.9f), quantile(errorsR, 1),
+           quantile(errorsL, 0.5f), quantile(errorsL, 0.9f), quantile(errorsL, 1), (unsigned)lUnmeasured,
+           motors ? (double)ppCorrect / motors : 0.0, (unsigned)ppUnknown, (unsigned)ppWrong,
+           motors ? virtualMsSum / motors : 0.0, motors ? wallMsSum / motors : 0.0);
+    return 0;
+}
+
+#endif
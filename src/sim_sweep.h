@@ -0,0 +1,37 @@
+#ifndef SIM_SWEEP_H
+#define SIM_SWEEP_H
+
+// Accuracy against test time of measureMotorParameters() over many virtual
+// motors. Only built natively with -DSIM_SWEEP_MODE (env:native_sweep):
+//   pio run -e native_sweep && .pio/build/native_sweep/program [motors] [seed]
+//
+// Every motor is drawn from the ranges below, log uniform where the range
+// spans decades, and gets its own noise seed. One JSON object per motor:
+//   {"motor":0,"R":0.512,"estR":0.514,"errR":0.0039,"L":0.00041,"estL":0.000405,"errL":-0.0122,
+//    "pp":7,"estPp":7,"ppConfidence":0.97,"hallValid":true,"ok":true,"virtualMs":2412,"wallMs":31.2}
+// errors are relative, errL is -1 when the inductance went unmeasured, ok
+// is what measureMotorParameters() returned. A summary line closes the run,
+// with quantiles of the absolute errors over the motors that measured the
+// value, motorParams.measured:
+//   {"summary":"sweep","motors":200,"failed":92,"errRMedian":0.0040,"errRP90":0.0060,"errRMax":0.0349,
+//    "errLMedian":0.0136,"errLP90":0.0323,"errLMax":0.0542,"lUnmeasured":0,"ppCorrect":0.540,
+//    "ppUnknown":92,"ppWrong":0,"virtualMsMean":5154,"wallMsMean":225.0}
+// failed counts the motors that missed any MEASURED_ALL field, here all of
+// them for pole pairs below POLE_MIN_CONFIDENCE (ppUnknown). ppWrong counts
+// the ones that claimed it and were wrong, ppCorrect is of all motors. The
+// pole pair sweep takes about 4 s, the slowest L/R of the ranges (100 ms)
+// the inductance capture a few seconds of its own.
+
+#define SIM_SWEEP_MOTORS          1000
+#define SIM_SWEEP_R_MIN           0.05f   // ohm
+#define SIM_SWEEP_R_MAX           5.0f
+#define SIM_SWEEP_L_MIN           50e-6f  // H
+#define SIM_SWEEP_L_MAX           5e-3f
+#define SIM_SWEEP_KE_MIN          0.005f  // V per mechanical rad/s
+#define SIM_SWEEP_KE_MAX          0.1f
+#define SIM_SWEEP_INERTIA_MIN     5e-6f   // kg m^2
+#define SIM_SWEEP_INERTIA_MAX     2e-4f
+#define SIM_SWEEP_MAX_POLE_PAIRS  14
+#define SIM_SWEEP_ECCENTRICITY_MAX 0.01f  // uniform from a rotor without any signature up to this
+
+#endif
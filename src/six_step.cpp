@@ -0,0 +1,169 @@
+#include "six_step.h"
+#include "hal.h"
+#include "hall_capture.h"
+#include "adc_sampler.h"
+#include "adc_calibration.h"
+#include <math.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#define SIX_STEP_TASK_CORE     1
+#define SIX_STEP_TASK_PRIORITY (configMAX_PRIORITIES - 1)   // as the FOC task, which is held meanwhile
+#endif
+
+#define SIX_STEP_PI_3 1.0471976f
+#define SIX_STEP_PI_2 1.5707963f
+
+static float commutation[8][3];
+static volatile bool driving = false;
+static volatile bool tripped = false;
+static volatile float tripCurrent = 0;
+static float limit = 0;
+static int8_t driveDirection = 1;
+
+// Written by the sampler tap, read by the owner
+static volatile float currentSum = 0;
+static volatile float currentSquares = 0;
+static volatile float currentPeak = 0;
+static volatile uint32_t currentSamples = 0;
+
+void sixStepBuildTable(float voltage, int8_t direction, float table[8][3]) {
+    for (uint8_t state = 0; state < 8; state++) {
+        int sector = hallSector(state);
+        if (sector < 0) {
+            table[state][0] = table[state][1] = table[state][2] = 0;
+            continue;
+        }
+        // Middle of the sector, then a quarter turn ahead in the direction
+        float middle = sector * SIX_STEP_PI_3 - SIX_STEP_PI_3 / 2 + SIX_STEP_HALL_OFFSET;
+        float vector = middle + (direction < 0 ? -SIX_STEP_PI_2 : SIX_STEP_PI_2);
+        for (int phase = 0; phase < 3; phase++) {
+            float c = cosf(vector - phase * 2 * SIX_STEP_PI_3);
+            table[state][phase] = c > SIX_STEP_LEVEL_EDGE ? voltage : (c < -SIX_STEP_LEVEL_EDGE ? 0 : voltage / 2);
+        }
+    }
+}
+
+static void applyState(uint8_t state) {
+    if (!driving || tripped) return;
+    const float* u = commutation[state & 7];
+    halSetPwm(u[0], u[1], u[2]);
+    // A trip or a stop in between has zeroed the bridge before this write
+    if (!driving || tripped) halSetPwm(0, 0, 0);
+}
+
+#ifdef ARDUINO
+
+static TaskHandle_t commutationTask = nullptr;
+static volatile uint8_t edgeState = 0;
+
+// Hall edge tap, in the hall GPIO ISR. halSetPwm() runs SimpleFOC's float
+// duty math, and the FPU is off limits in interrupt context on the ESP32,
+// so the ISR only hands the state to the commutation task.
+static void ARDUINO_ISR_ATTR onHallEdge(uint8_t state, uint32_t) {
+    edgeState = state;
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(commutationTask, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+static void commutationTaskLoop(void* arg) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        applyState(edgeState);
+    }
+}
+
+static void startCommutation() {
+    if (!commutationTask) {
+        xTaskCreatePinnedToCore(commutationTaskLoop, "six_step", 2048, nullptr, SIX_STEP_TASK_PRIORITY,
+                                &commutationTask, SIX_STEP_TASK_CORE);
+    }
+}
+
+#else
+
+// The simulator calls the tap from its clock, not from an interrupt
+static void onHallEdge(uint8_t state, uint32_t) {
+    applyState(state);
+}
+
+static void startCommutation() {}
+
+#endif
+
+// Sampler tap, one call per converted set of all channels
+static void onSampleSet(const uint16_t* samples) {
+    float i1 = adcRawToUnits(ADC_CH_I_SENSE1, samples[ADC_CH_I_SENSE1]);
+    float i2 = adcRawToUnits(ADC_CH_I_SENSE2, samples[ADC_CH_I_SENSE2]);
+    float i3 = -i1 - i2;
+    float largest = fmaxf(fabsf(i1), fmaxf(fabsf(i2), fabsf(i3)));
+
+    if (largest > limit && !tripped) {
+        // The hall tap sees the flag before it would switch again
+        tripped = true;
+        tripCurrent = largest;
+        halSetPwm(0, 0, 0);
+    }
+
+    currentSum = currentSum + largest;
+    currentSquares = currentSquares + largest * largest;
+    if (largest > currentPeak) currentPeak = largest;
+    currentSamples = currentSamples + 1;
+}
+
+void sixStepBegin(float voltage, int8_t direction, float currentLimit) {
+    driveDirection = direction;
+    sixStepBuildTable(voltage, direction, commutation);
+    limit = currentLimit;
+    tripped = false;
+    tripCurrent = 0;
+    sixStepResetCurrent();
+
+    startCommutation();
+    driving = true;
+    adcSamplerSetTap(onSampleSet);
+    hallCaptureSetTap(onHallEdge);
+    // At standstill there is no edge to start from
+    applyState(hallCaptureState());
+}
+
+void sixStepSetVoltage(float voltage) {
+    // An edge in between applies a half written entry at worst, the next
+    // edge or this call puts it right
+    sixStepBuildTable(voltage, driveDirection, commutation);
+    applyState(hallCaptureState());
+}
+
+void sixStepStop() {
+    driving = false;
+    hallCaptureSetTap(nullptr);
+    adcSamplerSetTap(nullptr);
+    halSetPwm(0, 0, 0);
+}
+
+bool sixStepTripped() {
+    return tripped;
+}
+
+SixStepCurrent sixStepCurrent() {
+    SixStepCurrent current = {};
+    uint32_t samples = currentSamples;
+    current.samples = samples;
+    current.peak = currentPeak;
+    current.tripped = tripped;
+    current.tripCurrent = tripCurrent;
+    if (samples > 0) {
+        current.mean = currentSum / samples;
+        float variance = currentSquares / samples - current.mean * current.mean;
+        current.ripple = variance > 0 ? sqrtf(variance) : 0;
+    }
+    return current;
+}
+
+void sixStepResetCurrent() {
+    currentSamples = 0;
+    currentSum = 0;
+    currentSquares = 0;
+    currentPeak = 0;
+}
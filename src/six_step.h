@@ -0,0 +1,48 @@
+#ifndef SIX_STEP_H
+#define SIX_STEP_H
+
+#include <stdint.h>
+
+// Hall commutated six-step drive. The phase voltages for every hall state
+// are worked out once when the drive starts; from then on every hall edge
+// wakes a commutation task at the top priority that applies the entry of
+// the new state, so commutation keeps up at any speed the halls can report
+// while no float math runs in the ISR. Current is watched by the
+// sampler tap on every converted set: the largest phase current is checked
+// against the limit and accumulated for the mean and the ripple. A trip
+// drops the table to zero before the bridge is disabled by the owner.
+//
+// The 3PWM bridge cannot float a phase, so the vector of a sector is made
+// from the three half bridges at supply or ground (a half level where the
+// vector falls between two). Each vector leads the middle of its hall sector
+// by 90 electrical degrees, 60 to 120 across the sector.
+
+#define SIX_STEP_HALL_OFFSET   0.0f      // electrical rad, hall placement against the windings
+#define SIX_STEP_LEVEL_EDGE    0.25f     // cos of the vector angle to a phase below which it sits at half
+
+struct SixStepCurrent {
+    float mean;         // A, largest phase current per sample set
+    float ripple;       // A rms around the mean
+    float peak;         // A
+    uint32_t samples;
+    bool tripped;       // limit exceeded, the drive stopped itself
+    float tripCurrent;  // A, the sample that tripped it
+};
+
+// Phase voltages for every hall state, invalid states stay at zero
+void sixStepBuildTable(float voltage, int8_t direction, float table[8][3]);
+
+// Start driving at voltage (V), direction +1 follows increasing hall
+// sectors. Installs the hall and sampler taps and applies the sector the
+// rotor is in now, the edges take over from there.
+void sixStepBegin(float voltage, int8_t direction, float currentLimit);
+// New voltage for every entry while running, e.g. for a soft start
+void sixStepSetVoltage(float voltage);
+// Remove the taps and switch the phases to zero
+void sixStepStop();
+bool sixStepTripped();
+// Current since the start or the last reset
+SixStepCurrent sixStepCurrent();
+void sixStepResetCurrent();
+
+#endif
@@ -0,0 +1,206 @@
+#include "spectral_analysis.h"
+#include <math.h>
+#include <stdlib.h>
+
+#ifdef ARDUINO
+#include "esp_dsp.h"
+#endif
+
+#define SPECTRAL_TWO_PI       6.28318531f
+#define SPECTRAL_MAX_LINES    (SPECTRAL_RATE_PER_FE / 2 + 4)
+#define SPECTRAL_SEARCH_SPAN  0.1f   // fe search window around the hall estimate
+
+#ifdef ARDUINO
+
+static uint32_t initializedPoints = 0;
+
+bool spectralFftInit(uint32_t points) {
+    if (initializedPoints >= points) return true;
+    // Twiddle table sized for the largest transform, kept for the uptime
+    if (initializedPoints) dsps_fft2r_deinit_fc32();
+    if (dsps_fft2r_init_fc32(NULL, points) != ESP_OK) return false;
+    initializedPoints = points;
+    return true;
+}
+
+void spectralFft(float* data, uint32_t points) {
+    dsps_fft2r_fc32(data, points);
+    dsps_bit_rev_fc32(data, points);
+}
+
+#else
+
+// Twiddles for every stage stored back to back, so the butterfly loop of a
+// stage walks them contiguously and the compiler can vectorize it
+static float* twiddles = nullptr;
+static uint32_t twiddlePoints = 0;
+
+bool spectralFftInit(uint32_t points) {
+    if (points < 2 || (points & (points - 1))) return false;
+    if (twiddlePoints == points) return true;
+
+    free(twiddles);
+    twiddles = (float*)malloc(sizeof(float) * 2 * points);
+    if (!twiddles) {
+        twiddlePoints = 0;
+        return false;
+    }
+    // Stage with half size h uses entries h - 1 .. 2h - 2
+    for (uint32_t half = 1; half < points; half <<= 1) {
+        for (uint32_t k = 0; k < half; k++) {
+            double angle = -M_PI * k / half;
+            twiddles[2 * (half - 1 + k)] = (float)cos(angle);
+            twiddles[2 * (half - 1 + k) + 1] = (float)sin(angle);
+        }
+    }
+    twiddlePoints = points;
+    return true;
+}
+
+void spectralFft(float* data, uint32_t points) {
+    // Bit reversal permutation
+    for (uint32_t i = 1, j = 0; i < points; i++) {
+        uint32_t bit = points >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) {
+            float re = data[2 * i], im = data[2 * i + 1];
+            data[2 * i] = data[2 * j];
+            data[2 * i + 1] = data[2 * j + 1];
+            data[2 * j] = re;
+            data[2 * j + 1] = im;
+        }
+    }
+
+    // Radix-2 decimation in time butterflies
+    for (uint32_t half = 1; half < points; half <<= 1) {
+        const float* w = &twiddles[2 * (half - 1)];
+        for (uint32_t start = 0; start < points; start += 2 * half) {
+            float* __restrict a = &data[2 * start];
+            float* __restrict b = &data[2 * (start + half)];
+            for (uint32_t k = 0; k < half; k++) {
+                float tr = w[2 * k] * b[2 * k] - w[2 * k + 1] * b[2 * k + 1];
+                float ti = w[2 * k] * b[2 * k + 1] + w[2 * k + 1] * b[2 * k];
+                b[2 * k] = a[2 * k] - tr;
+                b[2 * k + 1] = a[2 * k + 1] - ti;
+                a[2 * k] += tr;
+                a[2 * k + 1] += ti;
+            }
+        }
+    }
+}
+
+#endif
+
+// Amplitude of a sine whose energy lies in power[center +- SPECTRAL_BAND_BINS].
+// For a periodic Hann window sum(w^2) = 3N/8 and the positive half of the
+// spectrum holds N * sum(w^2) * A^2 / 4.
+static float bandAmplitude(const float* power, uint32_t points, float centerBin) {
+    int32_t center = (int32_t)lroundf(centerBin);
+    int32_t first = center - SPECTRAL_BAND_BINS;
+    int32_t last = center + SPECTRAL_BAND_BINS;
+    if (first < 1) first = 1;
+    if (last > (int32_t)points / 2 - 1) last = points / 2 - 1;
+    if (first > last) return 0;
+
+    float sum = 0;
+    for (int32_t k = first; k <= last; k++) sum += power[k];
+    return 2.0f * sqrtf(sum * 8.0f / 3.0f) / points;
+}
+
+bool analyzeCurrentSpectrum(float* data, uint32_t points, float sampleRateHz,
+                            float electricalHz, int polePairs, SpectralHealth* health) {
+    *health = SpectralHealth();
+    if (sampleRateHz <= 0 || electricalHz <= 0 || electricalHz >= sampleRateHz / 2) return false;
+    if (!spectralFftInit(points)) return false;
+
+    // Remove DC, window and spread into complex pairs from the back so the
+    // real samples are not overwritten before they are read
+    float mean = 0;
+    for (uint32_t i = 0; i < points; i++) mean += data[i];
+    mean /= points;
+    for (int32_t i = points - 1; i >= 0; i--) {
+        float window = 0.5f - 0.5f * cosf(SPECTRAL_TWO_PI * i / points);
+        data[2 * i] = (data[i] - mean) * window;
+        data[2 * i + 1] = 0;
+    }
+
+    spectralFft(data, points);
+
+    // Power of the positive frequencies, compacted to the front
+    uint32_t bins = points / 2;
+    float* power = data;
+    for (uint32_t k = 0; k < bins; k++) {
+        power[k] = data[2 * k] * data[2 * k] + data[2 * k + 1] * data[2 * k + 1];
+    }
+    float binHz = sampleRateHz / points;
+
+    // Refine the hall estimate of fe on the strongest bin nearby
+    float hallBin = electricalHz / binHz;
+    float span = hallBin * SPECTRAL_SEARCH_SPAN;
+    if (span < SPECTRAL_BAND_BINS) span = SPECTRAL_BAND_BINS;
+    uint32_t first = hallBin - span > 1 ? (uint32_t)(hallBin - span) : 1;
+    uint32_t last = (uint32_t)(hallBin + span);
+    if (last > bins - 2) last = bins - 2;
+    uint32_t peak = first;
+    for (uint32_t k = first; k <= last; k++) {
+        if (power[k] > power[peak]) peak = k;
+    }
+    float feBin = peak;
+    float left = sqrtf(power[peak - 1]), middle = sqrtf(power[peak]), right = sqrtf(power[peak + 1]);
+    float curvature = left - 2 * middle + right;
+    if (curvature < 0) feBin += 0.5f * (left - right) / curvature;
+
+    health->sampleRateHz = sampleRateHz;
+    health->electricalHz = feBin * binHz;
+    health->fundamental = bandAmplitude(power, points, feBin);
+    if (health->fundamental <= 0) return false;
+
+    // Every line that is not noise: all harmonics up to Nyquist, fm, 2 fm
+    // and the sidebands of the fundamental
+    float lines[SPECTRAL_MAX_LINES];
+    int lineCount = 0;
+    float sumSquares = 0;
+    for (int h = 1; h * feBin < bins && lineCount < SPECTRAL_MAX_LINES - 4; h++) {
+        lines[lineCount++] = h * feBin;
+        float ratio = bandAmplitude(power, points, h * feBin) / health->fundamental;
+        if (h <= SPECTRAL_HARMONICS) health->harmonics[h - 1] = ratio;
+        if (h >= 2) sumSquares += ratio * ratio;
+    }
+    health->thd = sqrtf(sumSquares);
+
+    float fmBin = polePairs > 0 ? feBin / polePairs : 0;
+    if (fmBin > 2 * SPECTRAL_BAND_BINS) {
+        // Resolvable: the bands of fm, 2 fm and the sidebands do not overlap
+        lines[lineCount++] = fmBin;
+        lines[lineCount++] = 2 * fmBin;
+        lines[lineCount++] = feBin - fmBin;
+        lines[lineCount++] = feBin + fmBin;
+        float lower = bandAmplitude(power, points, feBin - fmBin);
+        float upper = bandAmplitude(power, points, feBin + fmBin);
+        float once = bandAmplitude(power, points, fmBin);
+        float twice = bandAmplitude(power, points, 2 * fmBin);
+        health->sidebandRatio = (lower > upper ? lower : upper) / health->fundamental;
+        health->mechanicalRatio = (once > twice ? once : twice) / health->fundamental;
+    }
+
+    // Broadband rest in the low band, rms against the rms of the fundamental
+    float noise = 0;
+    uint32_t noiseEnd = (uint32_t)(SPECTRAL_NOISE_BAND_FE * feBin);
+    if (noiseEnd > bins) noiseEnd = bins;
+    for (uint32_t k = SPECTRAL_BAND_BINS + 1; k < noiseEnd; k++) {
+        bool line = false;
+        for (int i = 0; i < lineCount && !line; i++) {
+            line = fabsf(k - lines[i]) <= SPECTRAL_BAND_BINS + 0.5f;
+        }
+        if (!line) noise += power[k];
+    }
+    float noiseAmplitude = 2.0f * sqrtf(noise * 8.0f / 3.0f) / points;
+    health->noiseRatio = noiseAmplitude / health->fundamental;
+
+    health->valid = true;
+    health->spectrumOK = health->sidebandRatio <= SPECTRAL_SIDEBAND_LIMIT &&
+                         health->mechanicalRatio <= SPECTRAL_MECHANICAL_LIMIT &&
+                         health->noiseRatio <= SPECTRAL_NOISE_LIMIT;
+    return true;
+}
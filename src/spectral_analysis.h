@@ -0,0 +1,51 @@
+#ifndef SPECTRAL_ANALYSIS_H
+#define SPECTRAL_ANALYSIS_H
+
+#include <stdint.h>
+
+// Spectrum of a phase current window taken at constant speed. A healthy
+// motor only draws lines at the electrical frequency fe and its harmonics.
+// Rotor eccentricity and bearing damage modulate the load once per
+// revolution, which adds lines at the mechanical frequency fm = fe / pole
+// pairs and sidebands at fe +- fm; worn bearings also raise the broadband
+// floor between the lines.
+//
+// The FFT runs on ESP-DSP on the ESP32 and on a portable radix-2 kernel on
+// the host. Both use interleaved complex data (re, im).
+
+#define SPECTRAL_POINTS            4096   // FFT size, power of two
+#define SPECTRAL_HARMONICS         8      // harmonics of fe reported
+#define SPECTRAL_BAND_BINS         3      // bins either side of a line, covers the Hann main lobe
+#define SPECTRAL_RATE_PER_FE       32     // sample rate as a multiple of fe
+#define SPECTRAL_NOISE_BAND_FE     3      // floor measured up to 3 fe, where bearing defect lines lie
+#define SPECTRAL_TEST_VOLTAGE      2.0f   // V, constant speed run
+#define SPECTRAL_SETTLE_MS         1000   // spin up before the capture
+#define SPECTRAL_SIDEBAND_LIMIT    0.10f  // fe +- fm relative to the fundamental
+#define SPECTRAL_MECHANICAL_LIMIT  0.10f  // fm, 2 fm relative to the fundamental
+#define SPECTRAL_NOISE_LIMIT       0.20f  // rms between the lines relative to the fundamental
+
+struct SpectralHealth {
+    bool valid;                             // a spectral run completed
+    bool spectrumOK;
+    float electricalHz;                     // fe, from hall timing refined on the spectrum
+    float sampleRateHz;
+    float fundamental;                      // A, amplitude at fe
+    float harmonics[SPECTRAL_HARMONICS];    // n * fe relative to the fundamental, [0] = 1
+    float thd;                              // harmonics 2 and up relative to the fundamental
+    float sidebandRatio;                    // larger of fe - fm and fe + fm
+    float mechanicalRatio;                  // larger of fm and 2 fm
+    float noiseRatio;                       // rms outside all lines, up to SPECTRAL_NOISE_BAND_FE
+};
+
+// Kernels
+bool spectralFftInit(uint32_t points);
+// In place forward FFT of points complex values, output in natural order
+void spectralFft(float* data, uint32_t points);
+
+// Analyze points real current samples (A) in data[0 .. points - 1]. data
+// must hold 2 * points floats and is used as the work buffer. polePairs <= 0
+// skips the mechanical lines.
+bool analyzeCurrentSpectrum(float* data, uint32_t points, float sampleRateHz,
+                            float electricalHz, int polePairs, SpectralHealth* health);
+
+#endif
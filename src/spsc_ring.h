@@ -0,0 +1,118 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// Wait-free single-producer/single-consumer ring for trivially copyable
+// items. The producer (control side) never blocks and never allocates; the
+// consumer (network side) drains in batches at its own pace.
+//
+// SPSC_DROP_NEWEST:      push() fails when full, the item is counted as dropped
+// SPSC_OVERWRITE_OLDEST: push() always succeeds; the consumer skips whatever
+//                        was overwritten and counts it as an overrun
+//
+// The producer only writes head, the consumer only writes tail, and each
+// lives on its own cache line so the two cores do not contend.
+
+#ifndef SPSC_CACHE_LINE
+#define SPSC_CACHE_LINE 64
+#endif
+
+enum SpscPolicy {
+    SPSC_DROP_NEWEST,
+    SPSC_OVERWRITE_OLDEST
+};
+
+template <typename T, size_t N, SpscPolicy Policy = SPSC_DROP_NEWEST>
+class SpscRing {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscRing capacity must be a power of two");
+
+  public:
+    SpscRing() : head(0), dropCount(0), tail(0), overrunCount(0) {}
+
+    // Producer side
+    bool push(const T& item) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (Policy == SPSC_DROP_NEWEST &&
+            h - tail.load(std::memory_order_acquire) >= N) {
+            dropCount.store(dropCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+        if (Policy == SPSC_OVERWRITE_OLDEST) {
+            // The slot may still hold item h - N. Keep this write behind the
+            // previous head store, so a consumer that sees any of it also
+            // sees head reach h and discards its copy. Free on x86, a real
+            // barrier on weaker memory models.
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+        slots[h & (N - 1)] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side
+    bool pop(T& item) {
+        return popBatch(&item, 1) == 1;
+    }
+
+    size_t popBatch(T* out, size_t max) {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        size_t count = 0;
+
+        while (count < max) {
+            uint32_t h = head.load(std::memory_order_acquire);
+            if (h == t) break;
+
+            if (Policy == SPSC_OVERWRITE_OLDEST && h - t >= N) {
+                // Producer lapped us, resume at the oldest slot that is not
+                // about to be rewritten by the next push
+                uint32_t oldest = h - N + 1;
+                overrunCount.store(overrunCount.load(std::memory_order_relaxed) + (oldest - t),
+                                   std::memory_order_relaxed);
+                t = oldest;
+            }
+
+            out[count] = slots[t & (N - 1)];
+
+            if (Policy == SPSC_OVERWRITE_OLDEST) {
+                // Slot t is rewritten once head reaches t + N, discard the copy
+                // if that may have happened while we were reading it
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (head.load(std::memory_order_relaxed) - t >= N) {
+                    continue;
+                }
+            }
+
+            t++;
+            count++;
+        }
+
+        tail.store(t, std::memory_order_release);
+        return count;
+    }
+
+    // Approximate when called from the producer side
+    size_t size() const {
+        uint32_t h = head.load(std::memory_order_acquire);
+        uint32_t t = tail.load(std::memory_order_acquire);
+        return h - t > N ? N : h - t;
+    }
+
+    bool empty() const { return size() == 0; }
+    static constexpr size_t capacity() { return N; }
+
+    uint32_t pushed() const { return head.load(std::memory_order_relaxed); }
+    uint32_t dropped() const { return dropCount.load(std::memory_order_relaxed); }
+    uint32_t overruns() const { return overrunCount.load(std::memory_order_relaxed); }
+
+  private:
+    alignas(SPSC_CACHE_LINE) std::atomic<uint32_t> head;
+    std::atomic<uint32_t> dropCount;
+    alignas(SPSC_CACHE_LINE) std::atomic<uint32_t> tail;
+    std::atomic<uint32_t> overrunCount;
+    alignas(SPSC_CACHE_LINE) T slots[N];
+};
+
+#endif
@@ -0,0 +1,142 @@
+#include "step_response.h"
+#include <math.h>
+
+// Samples with a normalized response outside this band are too close to the
+// start (PWM delay) or to the end (noise dominates the log) to be fitted
+#define RL_FIT_BAND_LOW   0.10f
+#define RL_FIT_BAND_HIGH  0.85f
+#define RL_FIT_MIN_POINTS 5
+#define RL_FIT_MAX_RMS    0.05f   // residual relative to final value, above it the rise is not first order
+#define RL_FIT_MIN_SPACINGS 3.0f  // shortest tau resolved, in sample spacings
+#define RL_SETTLED_LIMIT  0.02f   // tail drift allowed relative to final value
+#define RL_MIN_FINAL      8.0f    // smallest usable response in raw counts
+#define STEP_SETTLE_BAND  0.05f   // settled within 5 % of the final value
+#define STEP_MIN_FINAL    0.2f    // of the commanded step, less is no response
+
+static float meanAboveBaseline(const uint16_t* raw, uint16_t from, uint16_t to, float baseline) {
+    float sum = 0;
+    for (uint16_t i = from; i < to; i++) {
+        sum += raw[i] - baseline;
+    }
+    return to > from ? sum / (to - from) : 0;
+}
+
+RLFitResult fitRLStep(const uint32_t* tUs, const uint16_t* raw, uint16_t count, float baseline) {
+    RLFitResult result = {false, 0, 0, baseline, 0, 0, false, false};
+    if (count < 32) return result;
+
+    // Settled value from the last eighth, drift against the eighth before it
+    uint16_t tail = count / 8;
+    float finalValue = meanAboveBaseline(raw, count - tail, count, baseline);
+    float previous = meanAboveBaseline(raw, count - 2 * tail, count - tail, baseline);
+    result.finalValue = finalValue;
+    if (finalValue < RL_MIN_FINAL) return result;
+    result.settled = fabsf(finalValue - previous) < RL_SETTLED_LIMIT * finalValue;
+
+    // Least squares line through ln(1 - i/I) = a - t/tau
+    double sumT = 0, sumZ = 0, sumTT = 0, sumTZ = 0;
+    uint16_t n = 0;
+    for (uint16_t i = 0; i < count - tail; i++) {
+        float ratio = (raw[i] - baseline) / finalValue;
+        if (ratio < RL_FIT_BAND_LOW || ratio > RL_FIT_BAND_HIGH) continue;
+        double t = tUs[i] * 1e-6;
+        double z = log(1.0 - ratio);
+        sumT += t;
+        sumZ += z;
+        sumTT += t * t;
+        sumTZ += t * z;
+        n++;
+    }
+    result.pointsUsed = n;
+    float spacingUs = (float)(tUs[count - 1] - tUs[0]) / (count - 1);
+    if (n < RL_FIT_MIN_POINTS) {
+        // A settled capture that jumps over the band rose within a few samples
+        result.tooFast = result.settled;
+        return result;
+    }
+
+    double denom = n * sumTT - sumT * sumT;
+    if (denom <= 0) return result;
+    double slope = (n * sumTZ - sumT * sumZ) / denom;
+    double intercept = (sumZ - slope * sumT) / n;
+    if (slope >= 0) return result;
+    float tau = (float)(-1.0 / slope);
+
+    // Residual of the fitted curve over the whole rise
+    double errorSum = 0;
+    for (uint16_t i = 0; i < count; i++) {
+        double t = tUs[i] * 1e-6;
+        double model = finalValue * (1.0 - exp(intercept + slope * t));
+        if (model < 0) model = 0;
+        double e = (raw[i] - baseline) - model;
+        errorSum += e * e;
+    }
+    result.rmsError = (float)(sqrt(errorSum / count) / finalValue);
+
+    // Noise on a flat or unresolved capture still gives a slope. A tau
+    // beyond the capture or within a few samples is not a measurement.
+    if (tau * 1e6f < RL_FIT_MIN_SPACINGS * spacingUs) {
+        result.tooFast = result.settled;
+        return result;
+    }
+    if (tau * 1e6f > tUs[count - 1] - tUs[0] || result.rmsError > RL_FIT_MAX_RMS) return result;
+    result.valid = result.settled;
+    if (result.valid) result.tau = tau;
+    return result;
+}
+
+// Time from sample from on at which the response, normalized as
+// (value - baseline) * scale, first reaches level. Interpolated between
+// samples, -1 if it never does.
+static float crossingUs(const float* values, uint16_t from, uint16_t count, float baseline, float scale,
+                        float level, float periodUs) {
+    float previous = 0;
+    for (uint16_t i = from; i < count; i++) {
+        float value = (values[i] - baseline) * scale;
+        if (value >= level) {
+            if (i == from) return 0;
+            return (i - 1 - from + (level - previous) / (value - previous)) * periodUs;
+        }
+        previous = value;
+    }
+    return -1;
+}
+
+StepMetrics analyzeStepResponse(const float* values, uint16_t count, uint16_t stepIndex,
+                                float periodUs, float step) {
+    StepMetrics metrics = {false, 0, 0, 0, 0, 0, 0};
+    if (stepIndex == 0 || count < stepIndex + 16 || step == 0) return metrics;
+
+    float baseline = 0;
+    for (uint16_t i = 0; i < stepIndex; i++) baseline += values[i];
+    baseline /= stepIndex;
+    metrics.baseline = baseline;
+
+    uint16_t tail = (count - stepIndex) / 8;
+    float finalValue = 0;
+    for (uint16_t i = count - tail; i < count; i++) finalValue += values[i] - baseline;
+    finalValue /= tail;
+    metrics.finalValue = finalValue;
+    metrics.trackingError = (finalValue - step) / step;
+    if (finalValue / step < STEP_MIN_FINAL) return metrics;
+
+    // Normalized to the settled value, which also turns a negative step
+    // into a rise
+    float scale = 1 / finalValue;
+    float low = crossingUs(values, stepIndex, count, baseline, scale, 0.1f, periodUs);
+    float high = crossingUs(values, stepIndex, count, baseline, scale, 0.9f, periodUs);
+    if (low < 0 || high < 0) return metrics;
+    metrics.riseTimeUs = high - low;
+
+    float peak = 0;
+    uint16_t settled = stepIndex;
+    for (uint16_t i = stepIndex; i < count; i++) {
+        float value = (values[i] - baseline) * scale;
+        if (value > peak) peak = value;
+        if (fabsf(value - 1) > STEP_SETTLE_BAND) settled = i + 1;
+    }
+    metrics.overshoot = peak > 1 ? peak - 1 : 0;
+    metrics.settlingUs = (settled - stepIndex) * periodUs;
+    metrics.valid = settled < count - tail;
+    return metrics;
+}
@@ -0,0 +1,44 @@
+#ifndef STEP_RESPONSE_H
+#define STEP_RESPONSE_H
+
+#include <stdint.h>
+
+// Analysis of captured step responses. Kept free of Arduino dependencies so
+// the fits can be built and checked on the host.
+
+struct RLFitResult {
+    bool valid;
+    float tau;           // time constant in seconds
+    float finalValue;    // settled response above baseline (raw units)
+    float baseline;      // value before the step (raw units)
+    float rmsError;      // fit residual relative to finalValue
+    uint16_t pointsUsed; // samples inside the fitted band
+    bool settled;        // response reached steady state within the capture
+    bool tooFast;        // settled, but the rise spans too few samples to fit
+};
+
+// Fit i(t) = I * (1 - exp(-(t - t0) / tau)) to a captured first order rise.
+// baseline is the mean value before the step was applied, tUs are sample
+// timestamps in microseconds relative to the step. Only the ratio to the
+// settled value is used, so raw ADC counts work without calibration.
+// A fit is only valid on a settled capture, with a residual that fits a
+// first order rise and a tau between a few sample spacings and the length
+// of the capture. Otherwise tau is left at 0.
+RLFitResult fitRLStep(const uint32_t* tUs, const uint16_t* raw, uint16_t count, float baseline);
+
+struct StepMetrics {
+    bool valid;
+    float baseline;      // mean before the step
+    float finalValue;    // settled response above baseline
+    float riseTimeUs;    // 10 to 90 % of finalValue
+    float overshoot;     // peak beyond finalValue, relative to it
+    float settlingUs;    // from the step until the response stays within the band
+    float trackingError; // finalValue against the commanded step, relative to it
+};
+
+// Rise time, overshoot and settling of a closed-loop step response sampled
+// every periodUs, the step of size step was commanded at sample stepIndex
+StepMetrics analyzeStepResponse(const float* values, uint16_t count, uint16_t stepIndex,
+                                float periodUs, float step);
+
+#endif
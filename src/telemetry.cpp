@@ -0,0 +1,177 @@
+#include "telemetry.h"
+#include <string.h>
+
+static uint16_t sequences[TELEMETRY_CH_COUNT];
+
+size_t encodeTelemetryFrame(uint8_t* out, size_t capacity, TelemetryChannel channel,
+                            uint16_t status, uint32_t timestampUs,
+                            const float* values, uint8_t count) {
+    size_t size = TELEMETRY_HEADER_SIZE + (size_t)count * sizeof(float);
+    if (count > TELEMETRY_MAX_VALUES || size > capacity) {
+        return 0;
+    }
+
+    uint16_t sequence = sequences[channel]++;
+
+    out[0] = TELEMETRY_MAGIC;
+    out[1] = TELEMETRY_VERSION;
+    out[2] = (uint8_t)channel;
+    out[3] = count;
+    // Both the ESP32 and the browser side DataView use little endian
+    memcpy(out + 4, &status, sizeof(status));
+    memcpy(out + 6, &sequence, sizeof(sequence));
+    memcpy(out + 8, &timestampUs, sizeof(timestampUs));
+    memcpy(out + TELEMETRY_HEADER_SIZE, values, (size_t)count * sizeof(float));
+
+    return size;
+}
+
+bool buildTelemetryJson(JsonDocument& doc, TelemetryChannel channel, uint16_t status,
+                        const float* values, uint8_t count) {
+    switch (channel) {
+        case TELEMETRY_CH_ANALOG:
+            doc["voltage"] = values[0];
+            doc["current"] = values[1];
+            break;
+        case TELEMETRY_CH_HEALTH: {
+            JsonObject health = doc.createNestedObject("health");
+            JsonObject phases = health.createNestedObject("phases");
+            phases["phaseA_OK"] = (status & HEALTH_FLAG_PHASE_A) != 0;
+            phases["phaseB_OK"] = (status & HEALTH_FLAG_PHASE_B) != 0;
+            phases["phaseC_OK"] = (status & HEALTH_FLAG_PHASE_C) != 0;
+            phases["phaseA_resistance"] = values[0];
+            phases["phaseB_resistance"] = values[1];
+            phases["phaseC_resistance"] = values[2];
+            JsonObject halls = health.createNestedObject("halls");
+            halls["hallA_OK"] = (status & HEALTH_FLAG_HALL_A) != 0;
+            halls["hallB_OK"] = (status & HEALTH_FLAG_HALL_B) != 0;
+            halls["hallC_OK"] = (status & HEALTH_FLAG_HALL_C) != 0;
+            break;
+        }
+        case TELEMETRY_CH_CONTROL_LOOP: {
+            JsonObject loopStats = doc.createNestedObject("controlLoop");
+            loopStats["rate"] = values[0];
+            loopStats["measuredRate"] = values[1];
+            loopStats["maxJitterUs"] = values[2];
+            loopStats["maxExecUs"] = values[3];
+            loopStats["overruns"] = values[4];
+            loopStats["sampleOverruns"] = values[5];
+            break;
+        }
+        case TELEMETRY_CH_PARAMETERS: {
+            JsonObject params = doc.createNestedObject("parameters");
+            params["phaseResistance"] = values[0];
+            params["phaseInductance"] = values[1];
+            params["polePairs"] = values[2];
+            params["inputVoltage"] = values[3];
+            params["motorKv"] = values[4];
+            params["hallValid"] = status != 0;
+            break;
+        }
+        case TELEMETRY_CH_MOTOR_STATE: {
+            // Only the newest sample of the batch is worth reading as JSON
+            if (count < 4) return false;
+            JsonObject state = doc.createNestedObject("motorState");
+            state["velocity"] = values[count - 4];
+            state["electricalAngle"] = values[count - 3];
+            state["voltageQ"] = values[count - 2];
+            state["voltageD"] = values[count - 1];
+            state["samples"] = count / 4;
+            state["periodUs"] = status;
+            break;
+        }
+        case TELEMETRY_CH_CURRENT_LOOP: {
+            if (count < 4) return false;
+            JsonObject loop = doc.createNestedObject("currentLoop");
+            loop["currentQ"] = values[count - 4];
+            loop["currentD"] = values[count - 3];
+            loop["voltageQ"] = values[count - 2];
+            loop["voltageD"] = values[count - 1];
+            loop["samples"] = count / 4;
+            loop["periodUs"] = status;
+            break;
+        }
+        case TELEMETRY_CH_SYSTEM: {
+            JsonObject system = doc.createNestedObject("system");
+            system["freeHeap"] = values[0];
+            system["minFreeHeap"] = values[1];
+            system["largestFreeBlock"] = values[2];
+            system["broadcasts"] = values[3];
+            system["bufferAllocations"] = values[4];
+            system["bufferReuses"] = values[5];
+            system["poolExhausted"] = values[6];
+            break;
+        }
+        case TELEMETRY_CH_CLIENTS: {
+            JsonArray clients = doc.createNestedArray("clients");
+            for (uint8_t i = 0; i + 5 <= count; i += 5) {
+                JsonObject client = clients.createNestedObject();
+                client["id"] = values[i];
+                client["queued"] = values[i + 1];
+                client["sent"] = values[i + 2];
+                client["coalesced"] = values[i + 3];
+                client["dropped"] = values[i + 4];
+            }
+            break;
+        }
+        case TELEMETRY_CH_SPECTRUM: {
+            if (count < 7) return false;
+            JsonObject spectrum = doc.createNestedObject("spectrum");
+            spectrum["valid"] = (status & SPECTRUM_FLAG_VALID) != 0;
+            spectrum["spectrumOK"] = (status & SPECTRUM_FLAG_OK) != 0;
+            spectrum["electricalHz"] = values[0];
+            spectrum["sampleRate"] = values[1];
+            spectrum["fundamental"] = values[2];
+            spectrum["thd"] = values[3];
+            spectrum["sidebandRatio"] = values[4];
+            spectrum["mechanicalRatio"] = values[5];
+            spectrum["noiseRatio"] = values[6];
+            JsonArray harmonics = spectrum.createNestedArray("harmonics");
+            for (uint8_t i = 7; i < count; i++) harmonics.add(values[i]);
+            break;
+        }
+        case TELEMETRY_CH_SCOPE: {
+            // Only the record header, waveforms need the binary frames
+            if (status != 0 || count < 7) return false;
+            JsonObject scope = doc.createNestedObject("scope");
+            scope["channelMask"] = values[0];
+            scope["sampleRate"] = values[1];
+            scope["length"] = values[2];
+            scope["triggerIndex"] = values[3];
+            scope["chunks"] = values[4];
+            scope["source"] = values[5];
+            scope["forced"] = values[6] != 0;
+            if (count > 7) scope["voltageRate"] = values[7];
+            break;
+        }
+        case TELEMETRY_CH_EFFICIENCY_MAP: {
+            if (count < 16) return false;
+            JsonObject point = doc.createNestedObject("mapPoint");
+            point["index"] = status & MAP_POINT_INDEX_MASK;
+            point["converged"] = (status & MAP_FLAG_CONVERGED) != 0;
+            point["limited"] = (status & MAP_FLAG_LIMITED) != 0;
+            point["last"] = (status & MAP_FLAG_LAST) != 0;
+            point["speedSteps"] = values[0];
+            point["currentSteps"] = values[1];
+            point["speedSetpoint"] = values[2];
+            point["currentLimit"] = values[3];
+            point["velocity"] = values[4];
+            point["currentQ"] = values[5];
+            point["currentD"] = values[6];
+            point["voltageQ"] = values[7];
+            point["voltageD"] = values[8];
+            point["supply"] = values[9];
+            point["inputCurrent"] = values[10];
+            point["inputPower"] = values[11];
+            point["torque"] = values[12];
+            point["mechanicalPower"] = values[13];
+            point["efficiency"] = values[14];
+            point["dwellMs"] = values[15];
+            break;
+        }
+        default:
+            return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,84 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <ArduinoJson.h>
+
+// Binary telemetry frames sent as WebSocket binary messages.
+// All fields are little endian (native on the ESP32):
+//
+//   offset 0   uint8   magic      TELEMETRY_MAGIC
+//   offset 1   uint8   version    TELEMETRY_VERSION
+//   offset 2   uint8   channel    TelemetryChannel
+//   offset 3   uint8   count      number of float32 values
+//   offset 4   uint16  status     channel specific bit flags
+//   offset 6   uint16  sequence   per channel frame counter
+//   offset 8   uint32  timestamp  microseconds since boot (wraps)
+//   offset 12  float32 values[count]
+
+#define TELEMETRY_MAGIC        0xB7
+#define TELEMETRY_VERSION      1
+#define TELEMETRY_HEADER_SIZE  12
+#define TELEMETRY_MAX_VALUES   64
+#define TELEMETRY_MAX_FRAME    (TELEMETRY_HEADER_SIZE + TELEMETRY_MAX_VALUES * 4)
+
+enum TelemetryChannel {
+    TELEMETRY_CH_ANALOG = 1,        // input voltage, current
+    TELEMETRY_CH_HEALTH = 2,        // phase resistances A, B, C; status = health flags
+    TELEMETRY_CH_CONTROL_LOOP = 3,  // rate, measured rate, max jitter, max exec, overruns
+    TELEMETRY_CH_PARAMETERS = 4,    // R, L, pole pairs, input voltage, Kv; status = hall valid
+    TELEMETRY_CH_MOTOR_STATE = 5,   // batch of (velocity, angle, Uq, Ud); status = sample period us
+    TELEMETRY_CH_SYSTEM = 6,        // free heap, min free heap, largest block, broadcasts,
+                                    // buffer allocations, buffer reuses, pool exhausted
+    TELEMETRY_CH_CLIENTS = 7,       // per client (id, queued, sent, coalesced, dropped)
+    TELEMETRY_CH_SCOPE = 8,         // scope record; status = chunk index, timestamp = trigger time
+                                    // chunk 0: channel mask, rate, length, trigger index,
+                                    // chunk count, trigger source, forced
+                                    // chunk n: interleaved A / V values from (n - 1) * 64 on
+    TELEMETRY_CH_SPECTRUM = 9,      // fe, sample rate, fundamental, THD, sideband, mechanical, noise,
+                                    // harmonics 1..8; status = spectrum flags
+    TELEMETRY_CH_CURRENT_LOOP = 10, // batch of (Iq, Id, Uq, Ud) while closed-loop FOC runs;
+                                    // status = sample period us
+    TELEMETRY_CH_EFFICIENCY_MAP = 11, // one map point: speed steps, current steps, speed setpoint,
+                                    // current limit, speed, Iq, Id, Uq, Ud, Vin, Iin, Pin, torque,
+                                    // mechanical power, efficiency, dwell ms;
+                                    // status = point index | map flags
+    TELEMETRY_CH_COUNT
+};
+
+// Scope chunks are pieces of one record and map points rows of one table,
+// every one of them has to arrive instead of being replaced by the newest
+inline bool telemetryChannelCoalesced(TelemetryChannel channel) {
+    return channel != TELEMETRY_CH_SCOPE && channel != TELEMETRY_CH_EFFICIENCY_MAP;
+}
+
+// Status bits of TELEMETRY_CH_HEALTH
+#define HEALTH_FLAG_PHASE_A  (1 << 0)
+#define HEALTH_FLAG_PHASE_B  (1 << 1)
+#define HEALTH_FLAG_PHASE_C  (1 << 2)
+#define HEALTH_FLAG_HALL_A   (1 << 3)
+#define HEALTH_FLAG_HALL_B   (1 << 4)
+#define HEALTH_FLAG_HALL_C   (1 << 5)
+
+// Status bits of TELEMETRY_CH_SPECTRUM
+#define SPECTRUM_FLAG_VALID  (1 << 0)
+#define SPECTRUM_FLAG_OK     (1 << 1)
+
+// Status bits of TELEMETRY_CH_EFFICIENCY_MAP, above the point index
+#define MAP_POINT_INDEX_MASK   0xFF
+#define MAP_FLAG_CONVERGED     (1 << 8)
+#define MAP_FLAG_LIMITED       (1 << 9)
+#define MAP_FLAG_LAST          (1 << 10)
+
+// Encode one frame into out. Returns the frame size, or 0 if it does not fit.
+size_t encodeTelemetryFrame(uint8_t* out, size_t capacity, TelemetryChannel channel,
+                            uint16_t status, uint32_t timestampUs,
+                            const float* values, uint8_t count);
+
+// Fill doc with the JSON debug form of a frame, using the same keys the web UI
+// reads from the binary frames. Returns false for channels without one.
+bool buildTelemetryJson(JsonDocument& doc, TelemetryChannel channel, uint16_t status,
+                        const float* values, uint8_t count);
+
+#endif
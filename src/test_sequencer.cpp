@@ -0,0 +1,264 @@
+#include "test_sequencer.h"
+#include <string.h>
+
+#ifdef ARDUINO
+#include <Preferences.h>
+#include "health_monitor.h"
+#include "foc_control.h"
+#endif
+
+static const char* const stepNames[TEST_STEP_COUNT] = {
+    "resistance", "inductance", "polePairs", "halls", "openLoop", "kv"
+};
+
+static volatile bool abortRequested = false;
+static TestSequencerStats stats;
+static uint32_t recentStarts[TEST_THROUGHPUT_UNITS];
+
+TestPlan defaultTestPlan() {
+    // Direct drive steps first, then the rotation steps: one hand over
+    static const TestStep steps[] = {
+        {TEST_STEP_RESISTANCE, 0, 0, 0.05f, 5.0f},
+        {TEST_STEP_INDUCTANCE, 0, 0, 20e-6f, 10e-3f},
+        {TEST_STEP_OPEN_LOOP, 0.3f, 2000, 0.0f, 5.0f},
+        {TEST_STEP_POLE_PAIRS, 0, 0, 1, 30},
+        {TEST_STEP_HALLS, 0, 0, 1, 1},
+        {TEST_STEP_KV, 2.0f, 1000, 10, 5000}
+    };
+
+    TestPlan plan = {};
+    plan.stopOnFail = true;
+    plan.stepCount = sizeof(steps) / sizeof(steps[0]);
+    memcpy(plan.steps, steps, sizeof(steps));
+    return plan;
+}
+
+bool testPlanValid(const TestPlan& plan) {
+    if (plan.stepCount == 0 || plan.stepCount > TEST_PLAN_MAX_STEPS) return false;
+
+    bool haveResistance = false;
+    bool havePolePairs = false;
+    for (uint8_t i = 0; i < plan.stepCount; i++) {
+        const TestStep& step = plan.steps[i];
+        if (step.type >= TEST_STEP_COUNT || step.min > step.max) return false;
+
+        switch (step.type) {
+            case TEST_STEP_RESISTANCE:
+                haveResistance = true;
+                break;
+            case TEST_STEP_INDUCTANCE:
+                if (!haveResistance) return false;
+                break;
+            case TEST_STEP_POLE_PAIRS:
+                havePolePairs = true;
+                break;
+            case TEST_STEP_OPEN_LOOP:
+                if (step.parameter <= 0 || step.durationMs == 0) return false;
+                break;
+            case TEST_STEP_KV:
+                if (!havePolePairs || step.parameter <= 0) return false;
+                break;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+const char* testStepName(TestStepType type) {
+    return type < TEST_STEP_COUNT ? stepNames[type] : "unknown";
+}
+
+bool testStepFromName(const char* name, TestStepType* type) {
+    if (!name) return false;
+    for (int i = 0; i < TEST_STEP_COUNT; i++) {
+        if (strcmp(name, stepNames[i]) == 0) {
+            *type = (TestStepType)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static float runStep(const TestStep& step, bool* completed) {
+    *completed = true;
+
+    switch (step.type) {
+        case TEST_STEP_RESISTANCE:
+            motorParams.phaseResistance = measurePhaseResistance();
+            return motorParams.phaseResistance;
+        case TEST_STEP_INDUCTANCE:
+            motorParams.phaseInductance = measurePhaseInductance();
+            return motorParams.phaseInductance;
+        case TEST_STEP_POLE_PAIRS:
+            motorParams.polePairs = detectPolePairs();
+            return motorParams.polePairs;
+        case TEST_STEP_HALLS:
+            motorParams.hallValid = verifyHallSensors() && hallSector(hallCaptureState()) >= 0;
+            return motorParams.hallValid ? 1 : 0;
+        case TEST_STEP_OPEN_LOOP: {
+            // Rotation is judged by the hall step, this one by its current
+            OpenLoopTestResult result = runOpenLoopTest(step.parameter, step.durationMs);
+            *completed = result.success && !result.currentLimitExceeded;
+            return result.avgCurrent;
+        }
+        case TEST_STEP_KV:
+            return measureMotorKv(step.parameter, step.durationMs);
+        default:
+            *completed = false;
+            return 0;
+    }
+}
+
+static void updateStats(const TestRecord& record) {
+    recentStarts[stats.units % TEST_THROUGHPUT_UNITS] = record.startMs;
+    stats.units++;
+    if (record.passed) {
+        stats.passed++;
+    } else {
+        stats.failed++;
+    }
+    stats.lastDurationS = record.durationMs / 1000.0f;
+
+    // Start to start, so operator handling between units counts too
+    uint32_t window = stats.units < TEST_THROUGHPUT_UNITS ? stats.units : TEST_THROUGHPUT_UNITS;
+    uint32_t oldest = recentStarts[(stats.units - window) % TEST_THROUGHPUT_UNITS];
+    uint32_t spanMs = record.startMs - oldest;
+    if (window >= 2 && spanMs > 0) {
+        stats.unitsPerHour = (window - 1) * 3600000.0f / spanMs;
+    } else if (record.durationMs > 0) {
+        stats.unitsPerHour = 3600000.0f / record.durationMs;
+    }
+}
+
+bool runTestPlan(const TestPlan& plan, const char* serial, TestRecord* record,
+                 TestProgressCallback progress) {
+    memset(record, 0, sizeof(*record));
+    strncpy(record->serial, serial ? serial : "", TEST_SERIAL_LENGTH - 1);
+    record->startMs = millis();
+    record->stepCount = plan.stepCount;
+    abortRequested = false;
+
+    // Nothing carries over from the previous unit
+    motorParams.phaseResistance = 0;
+    motorParams.phaseInductance = 0;
+    motorParams.polePairs = 0;
+    motorParams.hallValid = false;
+    motorParams.motorKv = 0;
+    motorParams.motorKe = 0;
+    motorParams.polePairConfidence = 0;
+    motorParams.measured = 0;
+    memset(motorParams.pairInductance, 0, sizeof(motorParams.pairInductance));
+    motorParams.inputVoltage = measureInputVoltage();
+
+    bool failed = false;
+    for (uint8_t i = 0; i < plan.stepCount; i++) {
+        const TestStep& step = plan.steps[i];
+        TestStepResult& result = record->steps[i];
+        result.type = step.type;
+
+        if (abortRequested) record->aborted = true;
+        if (record->aborted || (failed && plan.stopOnFail)) {
+            result.skipped = true;
+        } else {
+            uint32_t stepStart = millis();
+            bool completed;
+            result.value = runStep(step, &completed);
+            result.durationMs = millis() - stepStart;
+            result.passed = completed && result.value >= step.min && result.value <= step.max;
+            failed |= !result.passed;
+        }
+
+        if (progress) progress(*record, i);
+    }
+
+    // Leave the motor to the FOC task, stopped
+    releaseBridge();
+
+    record->passed = !failed && !record->aborted;
+    record->durationMs = millis() - record->startMs;
+    updateStats(*record);
+    if (progress) progress(*record, record->stepCount);
+    return record->passed;
+}
+
+void testSequencerAbort() {
+    abortRequested = true;
+}
+
+TestSequencerStats getTestSequencerStats() {
+    return stats;
+}
+
+#ifdef ARDUINO
+
+static TestPlan storedPlan;
+static TaskHandle_t sequencerTask = nullptr;
+static char pendingSerial[TEST_SERIAL_LENGTH];
+static TestProgressCallback pendingProgress = nullptr;
+static TestRecord taskRecord;
+static volatile bool recordPending = false;
+
+void testSequencerBegin() {
+    storedPlan = defaultTestPlan();
+
+    Preferences prefs;
+    if (!prefs.begin("sequencer", true)) return;
+    TestPlan plan;
+    if (prefs.getBytesLength("plan") == sizeof(plan) &&
+        prefs.getBytes("plan", &plan, sizeof(plan)) == sizeof(plan) && testPlanValid(plan)) {
+        storedPlan = plan;
+    }
+    prefs.end();
+}
+
+TestPlan getTestPlan() {
+    return storedPlan;
+}
+
+bool setTestPlan(const TestPlan& plan) {
+    if (!testPlanValid(plan) || testSequencerRunning()) return false;
+
+    Preferences prefs;
+    if (!prefs.begin("sequencer", false)) return false;
+    bool stored = prefs.putBytes("plan", &plan, sizeof(plan)) == sizeof(plan);
+    prefs.end();
+    if (stored) storedPlan = plan;
+    return stored;
+}
+
+static void sequencerTaskLoop(void* arg) {
+    // The health monitor and closed-loop control step aside at their next tick
+    isTestRunning = true;
+    while (healthMonitorBusy() || focControlActive()) delay(1);
+
+    runTestPlan(storedPlan, pendingSerial, &taskRecord, pendingProgress);
+    recordPending = true;
+
+    isTestRunning = false;
+    sequencerTask = nullptr;
+    vTaskDelete(NULL);
+}
+
+bool testSequencerStart(const char* serial, TestProgressCallback progress) {
+    // The next unit waits until the last record has been taken
+    if (sequencerTask || recordPending || !serial || !serial[0]) return false;
+
+    strncpy(pendingSerial, serial, TEST_SERIAL_LENGTH - 1);
+    pendingSerial[TEST_SERIAL_LENGTH - 1] = 0;
+    pendingProgress = progress;
+    return xTaskCreatePinnedToCore(sequencerTaskLoop, "sequencer", 8192, nullptr, 1, &sequencerTask, 0) == pdPASS;
+}
+
+bool testSequencerRunning() {
+    return sequencerTask != nullptr;
+}
+
+bool testSequencerTakeRecord(TestRecord* record) {
+    if (!recordPending) return false;
+    *record = taskRecord;
+    recordPending = false;
+    return true;
+}
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef TEST_SEQUENCER_H
+#define TEST_SEQUENCER_H
+
+#include <stdint.h>
+#include "motor_analysis.h"
+
+// Production test sequencer. A test plan is a list of measurement steps,
+// each with pass limits on its value; running it on one motor produces one
+// result record under the motor's serial number. The steps run back to back,
+// the bridge is only handed over when a step needs a different mode than the
+// one before (see BridgeMode), so keep direct drive and rotation steps
+// grouped in the plan.
+//
+// On the ESP32 the plan is stored in NVS and runs in its own task on core 0;
+// runTestPlan() itself is portable and runs on the host simulator.
+
+#define TEST_PLAN_MAX_STEPS   12
+#define TEST_SERIAL_LENGTH    24    // including the terminator
+#define TEST_THROUGHPUT_UNITS 10    // units per hour over the last starts
+
+enum TestStepType {
+    TEST_STEP_RESISTANCE = 0,   // value: phase resistance (ohm)
+    TEST_STEP_INDUCTANCE,       // value: phase inductance (H), needs a resistance step first
+    TEST_STEP_POLE_PAIRS,       // value: pole pairs
+    TEST_STEP_HALLS,            // value: 1 when all three sensors toggle with valid patterns
+    TEST_STEP_OPEN_LOOP,        // value: average current (A); parameter: duty of the supply, durationMs: run time
+    TEST_STEP_KV,               // value: Kv (RPM/V); parameter: voltage, durationMs: spin up,
+                                // needs a pole pair step first
+    TEST_STEP_COUNT
+};
+
+struct TestStep {
+    TestStepType type;
+    float parameter;
+    uint32_t durationMs;
+    float min;                  // pass limits on the value, inclusive
+    float max;
+};
+
+struct TestPlan {
+    uint8_t stepCount;
+    bool stopOnFail;            // skip the remaining steps after a failure
+    TestStep steps[TEST_PLAN_MAX_STEPS];
+};
+
+struct TestStepResult {
+    TestStepType type;
+    bool passed;
+    bool skipped;
+    float value;
+    uint32_t durationMs;
+};
+
+struct TestRecord {
+    char serial[TEST_SERIAL_LENGTH];
+    uint32_t startMs;
+    uint32_t durationMs;
+    bool passed;
+    bool aborted;
+    uint8_t stepCount;
+    TestStepResult steps[TEST_PLAN_MAX_STEPS];
+};
+
+struct TestSequencerStats {
+    uint32_t units;
+    uint32_t passed;
+    uint32_t failed;
+    float unitsPerHour;         // from the start times of the last units, handling included
+    float lastDurationS;        // test time of the last unit
+};
+
+// Called after every step and once more with stepIndex == record.stepCount
+// when the unit is finished
+typedef void (*TestProgressCallback)(const TestRecord& record, uint8_t stepIndex);
+
+TestPlan defaultTestPlan();
+// Limits in order and every step's prerequisites earlier in the plan
+bool testPlanValid(const TestPlan& plan);
+const char* testStepName(TestStepType type);
+bool testStepFromName(const char* name, TestStepType* type);
+
+// Run plan on one motor, blocking. Returns record->passed.
+bool runTestPlan(const TestPlan& plan, const char* serial, TestRecord* record,
+                 TestProgressCallback progress = nullptr);
+// Stop after the current step, safe from any task
+void testSequencerAbort();
+
+TestSequencerStats getTestSequencerStats();
+
+#ifdef ARDUINO
+// Stored plan and the background run
+void testSequencerBegin();
+TestPlan getTestPlan();
+bool setTestPlan(const TestPlan& plan);     // validates and stores in NVS
+bool testSequencerStart(const char* serial, TestProgressCallback progress);
+bool testSequencerRunning();
+// Hands over the record of the last finished unit once, for the results log
+bool testSequencerTakeRecord(TestRecord* record);
+#endif
+
+#endif
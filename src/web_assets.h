@@ -0,0 +1,19 @@
+#ifndef WEB_ASSETS_H
+#define WEB_ASSETS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#ifdef ARDUINO
+#include <pgmspace.h>
+#endif
+
+// One gzip compressed UI file in flash, see tools/embed_web_ui.py
+struct WebAsset {
+    const char* path;
+    const char* contentType;
+    const uint8_t* data;      // gzip stream, PROGMEM
+    size_t length;
+    const char* etag;         // strong, quoted, changes with the content
+};
+
+#endif
@@ -1,12 +1,300 @@
 #include "webserver.h"
+#include "control_loop.h"
+#include "health_monitor.h"
+#include "web_ui.h"
+#include "ws_publisher.h"
+#include "scope_capture.h"
+#include "test_sequencer.h"
+#include "results_log.h"
+#include "foc_control.h"
+#include <memory>
+#include <new>
+#include <sys/time.h>
 
 AsyncWebServer server(80);
 AsyncWebSocket ws("/ws");
 
+// JSON telemetry is kept for debugging, binary frames are the default
+static bool jsonTelemetry = false;
+
+// Broadcast buffers are allocated once and then reused. The publisher counts
+// a reference per client until the frame is sent and one for the newest
+// value of each channel, and a buffer is only refilled once it is idle
+// again. JSON is padded with spaces to whole granules so its varying length
+// still maps onto a few buffers.
+#define BROADCAST_POOL_SIZE     24
+#define BROADCAST_JSON_GRANULE  32
+
+struct BroadcastSlot {
+    PublisherBuffer buffer;  // no data until first used
+    bool claimed;            // being filled or sent by a broadcaster
+};
+
+static BroadcastSlot broadcastPool[BROADCAST_POOL_SIZE];
+static BroadcastStats broadcastStats;
+// Broadcasts come from the monitor task and from WebSocket command handlers
+static SemaphoreHandle_t broadcastLock = nullptr;
+
+static void sendWebAsset(AsyncWebServerRequest *request, const WebAsset& asset) {
+    // Browsers revalidate on every load and get an empty 304 while the
+    // firmware, and with it the ETag, is unchanged
+    AsyncWebHeader* match = request->getHeader("If-None-Match");
+    if (match && match->value().indexOf(asset.etag) >= 0) {
+        AsyncWebServerResponse *response = request->beginResponse(304);
+        response->addHeader("ETag", asset.etag);
+        response->addHeader("Cache-Control", "no-cache");
+        request->send(response);
+        return;
+    }
+
+    // Sent straight from flash, every browser we target accepts gzip
+    AsyncWebServerResponse *response =
+        request->beginResponse_P(200, asset.contentType, asset.data, asset.length);
+    response->addHeader("Content-Encoding", "gzip");
+    response->addHeader("ETag", asset.etag);
+    response->addHeader("Cache-Control", "no-cache");
+    request->send(response);
+}
+
+// One results query in flight: a record at a time is formatted into line
+// and copied out as the response asks for data
+#define RESULTS_JSON_LINE 1536
+
+struct ResultsStream {
+    ResultsCursor cursor;
+    bool binary;
+    uint8_t stage;          // 0 opening, 1 records, 2 closing, 3 done
+    bool first;
+    char line[RESULTS_JSON_LINE];
+    size_t length;
+    size_t sent;
+};
+
+static uint32_t queryNumber(AsyncWebServerRequest *request, const char* name, uint32_t fallback) {
+    if (!request->hasParam(name)) return fallback;
+    return strtoul(request->getParam(name)->value().c_str(), nullptr, 10);
+}
+
+static size_t formatResultJson(const ResultRecord& record, bool intact, char* line, size_t size) {
+    DynamicJsonDocument doc(RESULTS_JSON_LINE);
+    doc["sequence"] = record.sequence;
+    if (!intact) {
+        doc["corrupt"] = true;
+        return serializeJson(doc, line, size);
+    }
+    doc["timestamp"] = record.timestamp;
+    doc["clockSet"] = (record.flags & RESULT_FLAG_CLOCK_SET) != 0;
+    doc["serial"] = record.serial;
+    if (record.flags & RESULT_FLAG_TEST) {
+        JsonObject test = doc.createNestedObject("test");
+        test["passed"] = (record.flags & RESULT_FLAG_PASSED) != 0;
+        test["aborted"] = (record.flags & RESULT_FLAG_ABORTED) != 0;
+        test["durationMs"] = record.testDurationMs;
+        JsonArray steps = test.createNestedArray("steps");
+        for (uint8_t i = 0; i < record.stepCount && i < TEST_PLAN_MAX_STEPS; i++) {
+            JsonObject step = steps.createNestedObject();
+            step["name"] = testStepName((TestStepType)record.stepTypes[i]);
+            step["value"] = record.stepValues[i];
+            step["passed"] = ((record.stepPassed >> i) & 1) != 0;
+            step["skipped"] = ((record.stepSkipped >> i) & 1) != 0;
+        }
+    }
+    JsonObject params = doc.createNestedObject("parameters");
+    params["phaseResistance"] = record.phaseResistance;
+    params["phaseInductance"] = record.phaseInductance;
+    JsonArray pairs = params.createNestedArray("pairInductance");
+    for (int i = 0; i < 3; i++) pairs.add(record.pairInductance[i]);
+    params["inputVoltage"] = record.inputVoltage;
+    params["motorKv"] = record.motorKv;
+    params["polePairs"] = record.polePairs;
+    JsonObject health = doc.createNestedObject("health");
+    health["flags"] = record.healthFlags;
+    JsonArray resistances = health.createNestedArray("phaseResistance");
+    for (int i = 0; i < 3; i++) resistances.add(record.healthResistance[i]);
+    if (record.healthFlags & RESULT_HEALTH_SPECTRUM) {
+        health["thd"] = record.thd;
+        health["sidebandRatio"] = record.sidebandRatio;
+        health["mechanicalRatio"] = record.mechanicalRatio;
+        health["noiseRatio"] = record.noiseRatio;
+    }
+    return serializeJson(doc, line, size);
+}
+
+// Next piece of the response into stream->line, false when done
+static bool refillResultsStream(ResultsStream* stream) {
+    stream->length = stream->sent = 0;
+    while (stream->length == 0) {
+        if (stream->stage == 0) {
+            if (!stream->binary) stream->length = snprintf(stream->line, RESULTS_JSON_LINE, "{\"records\":[");
+            stream->stage = 1;
+        } else if (stream->stage == 1) {
+            ResultRecord record;
+            bool intact;
+            if (!resultsCursorNext(&stream->cursor, &record, &intact)) {
+                stream->stage = 2;
+            } else if (stream->binary) {
+                memcpy(stream->line, &record, sizeof(record));
+                stream->length = sizeof(record);
+            } else {
+                size_t offset = 0;
+                if (!stream->first) stream->line[offset++] = ',';
+                stream->first = false;
+                stream->length = offset + formatResultJson(record, intact, stream->line + offset,
+                                                           RESULTS_JSON_LINE - offset);
+            }
+        } else if (stream->stage == 2) {
+            // next is where the following page starts, -1 at the end of the log
+            if (!stream->binary) {
+                long next = stream->cursor.next < resultsLogCount() ? (long)stream->cursor.next : -1;
+                stream->length = snprintf(stream->line, RESULTS_JSON_LINE, "],\"next\":%ld,\"total\":%u}",
+                                          next, (unsigned)resultsLogCount());
+            }
+            stream->stage = 3;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// GET /results?serial=&from=&to=&start=&limit=&format=bin
+// One page of records for a serial number, or in a unix time range, from
+// record start on. JSON by default, raw records with format=bin.
+static void handleResultsQuery(AsyncWebServerRequest *request) {
+    std::shared_ptr<ResultsStream> stream = std::make_shared<ResultsStream>();
+    String serial = request->hasParam("serial") ? request->getParam("serial")->value() : String();
+    resultsCursorBegin(&stream->cursor, serial.c_str(), queryNumber(request, "from", 0),
+                       queryNumber(request, "to", UINT32_MAX), queryNumber(request, "start", 0),
+                       queryNumber(request, "limit", RESULTS_PAGE_DEFAULT));
+    stream->binary = request->hasParam("format") && request->getParam("format")->value() == "bin";
+    stream->stage = 0;
+    stream->first = true;
+    stream->length = stream->sent = 0;
+
+    AsyncWebServerResponse *response = request->beginChunkedResponse(
+        stream->binary ? "application/octet-stream" : "application/json",
+        [stream](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+            size_t filled = 0;
+            while (filled < maxLen) {
+                if (stream->sent == stream->length && !refillResultsStream(stream.get())) break;
+                size_t count = stream->length - stream->sent;
+                if (count > maxLen - filled) count = maxLen - filled;
+                memcpy(buffer + filled, stream->line + stream->sent, count);
+                stream->sent += count;
+                filled += count;
+            }
+            return filled;
+        });
+    if (stream->binary) {
+        response->addHeader("Content-Disposition", "attachment; filename=results.bin");
+        response->addHeader("X-Record-Size", String(sizeof(ResultRecord)));
+    }
+    request->send(response);
+}
+
+static void releaseBroadcastSlot(BroadcastSlot* slot) {
+    xSemaphoreTake(broadcastLock, portMAX_DELAY);
+    slot->claimed = false;
+    xSemaphoreGive(broadcastLock);
+}
+
+// Find an idle buffer of exactly this length, or recycle an idle one
+static BroadcastSlot* claimBroadcastSlot(size_t length) {
+    BroadcastSlot* match = nullptr;
+    BroadcastSlot* empty = nullptr;
+    BroadcastSlot* spare = nullptr;
+
+    xSemaphoreTake(broadcastLock, portMAX_DELAY);
+    for (BroadcastSlot& slot : broadcastPool) {
+        if (slot.claimed) continue;
+        if (!slot.buffer.data) {
+            if (!empty) empty = &slot;
+        } else if (publisherBufferIdle(&slot.buffer)) {
+            if (slot.buffer.length == length) {
+                match = &slot;
+                break;
+            }
+            if (!spare) spare = &slot;
+        }
+    }
+    BroadcastSlot* slot = match ? match : (empty ? empty : spare);
+    if (slot) {
+        slot->claimed = true;
+        if (match) broadcastStats.bufferReuses++;
+    } else {
+        broadcastStats.poolExhausted++;
+    }
+    xSemaphoreGive(broadcastLock);
+
+    if (slot && !match) {
+        // Only while warming up or when a new message size shows up
+        // One spare byte for the terminator serializeJson() writes
+        delete[] slot->buffer.data;
+        slot->buffer.data = new (std::nothrow) uint8_t[length + 1];
+        slot->buffer.length = length;
+        if (!slot->buffer.data) {
+            releaseBroadcastSlot(slot);
+            return nullptr;
+        }
+        xSemaphoreTake(broadcastLock, portMAX_DELAY);
+        broadcastStats.bufferAllocations++;
+        xSemaphoreGive(broadcastLock);
+    }
+    return slot;
+}
+
+// Telemetry channels are coalesced per client, channel 0 is a one-off event
+static void sendBroadcastSlot(BroadcastSlot* slot, bool binary, int channel) {
+    if (channel > 0) {
+        publishLatest(ws, (TelemetryChannel)channel, &slot->buffer, binary);
+    } else {
+        publishEvent(ws, &slot->buffer, binary);
+    }
+
+    xSemaphoreTake(broadcastLock, portMAX_DELAY);
+    broadcastStats.messages++;
+    slot->claimed = false;
+    xSemaphoreGive(broadcastLock);
+}
+
+static void broadcastText(const char* text, size_t length) {
+    size_t padded = (length + BROADCAST_JSON_GRANULE - 1) / BROADCAST_JSON_GRANULE * BROADCAST_JSON_GRANULE;
+    BroadcastSlot* slot = claimBroadcastSlot(padded);
+    if (!slot) return;
+
+    uint8_t* data = slot->buffer.data;
+    memcpy(data, text, length);
+    memset(data + length, ' ', padded - length);
+    sendBroadcastSlot(slot, false, 0);
+}
+
+static bool broadcastJsonChannel(const JsonDocument& doc, int channel) {
+    if (ws.count() == 0) return false;
+
+    // Serialized straight into the shared buffer, no intermediate String
+    size_t length = measureJson(doc);
+    size_t padded = (length + BROADCAST_JSON_GRANULE - 1) / BROADCAST_JSON_GRANULE * BROADCAST_JSON_GRANULE;
+    BroadcastSlot* slot = claimBroadcastSlot(padded);
+    if (!slot) return false;
+
+    char* data = (char*)slot->buffer.data;
+    serializeJson(doc, data, padded + 1);
+    memset(data + length, ' ', padded - length);
+    sendBroadcastSlot(slot, false, channel);
+    return true;
+}
+
 void setupWebServer() {
+    broadcastLock = xSemaphoreCreateMutex();
+    publisherBegin();
+
     ws.onEvent([](AsyncWebSocket * server, AsyncWebSocketClient * client, AwsEventType type,
                  void * arg, uint8_t *data, size_t len) {
-        if(type == WS_EVT_DATA) {
+        if(type == WS_EVT_CONNECT) {
+            publisherClientConnected(client);
+        } else if(type == WS_EVT_DISCONNECT) {
+            publisherClientDisconnected(client);
+        } else if(type == WS_EVT_DATA) {
             AwsFrameInfo * info = (AwsFrameInfo*)arg;
             if(info->final && info->index == 0 && info->len == len && info->opcode == WS_TEXT) {
                 data[len] = 0;
@@ -17,163 +305,90 @@ void setupWebServer() {
     
     server.addHandler(&ws);
 
-    server.on("/", HTTP_GET, [](AsyncWebServerRequest *request){
-        const char* html = R"html(
-<!DOCTYPE html>
-<html>
-<head>
-    <title>BLDC Motor Tester</title>
-    <style>
-        body { font-family: Arial; margin: 20px; background-color: #f5f5f5; }
-        .card { background: white; padding: 20px; margin: 10px; border-radius: 8px; 
-                box-shadow: 0 2px 4px rgba(0,0,0,0.1); }
-        .status-ok { color: green; font-weight: bold; }
-        .status-error { color: red; font-weight: bold; }
-        .parameter-label { display: inline-block; width: 200px; font-weight: bold; }
-        button { padding: 10px 20px; margin: 5px; border-radius: 4px; 
-                 background-color: #007bff; color: white; border: none; cursor: pointer; }
-        button:hover { background-color: #0056b3; }
-        input[type="range"] { width: 200px; }
-    </style>
-</head>
-<body>
-    <h1>BLDC Motor Tester</h1>
-
-    <div class="card">
-        <h2>Motor Status</h2>
-        <p><span class="parameter-label">Supply Voltage:</span> 
-           <span id="supply-voltage">--</span> V</p>
-        <p>
-            <span class="parameter-label">Voltage Limit:</span>
-            <input type="number" id="voltage-limit" min="0" max="24" step="0.1" value="12">
-            <button onclick="updateVoltageLimit()">Set</button>
-        </p>
-        <p>
-            <span class="parameter-label">Direction:</span>
-            <select id="motor-direction">
-                <option value="CW">Clockwise</option>
-                <option value="CCW">Counter-Clockwise</option>
-            </select>
-            <button onclick="updateDirection()">Set</button>
-        </p>
-        <p><span class="parameter-label">Motor Pole Pairs:</span> 
-           <span id="pole-pairs">--</span></p>
-        <p><span class="parameter-label">Motor KV:</span> 
-           <span id="motor-kv">--</span> RPM/V</p>
-    </div>
-
-    <div class="card">
-        <h2>Phase Parameters</h2>
-        <h3>Phase A</h3>
-        <p><span class="parameter-label">Status:</span> 
-           <span class="status-ok" id="phaseA-status">--</span></p>
-        <p><span class="parameter-label">Resistance:</span> 
-           <span id="phaseA-resistance">--</span> Ω</p>
-        <p><span class="parameter-label">Inductance:</span> 
-           <span id="phaseA-inductance">--</span> mH</p>
-
-        <h3>Phase B</h3>
-        <p><span class="parameter-label">Status:</span> 
-           <span class="status-ok" id="phaseB-status">--</span></p>
-        <p><span class="parameter-label">Resistance:</span> 
-           <span id="phaseB-resistance">--</span> Ω</p>
-        <p><span class="parameter-label">Inductance:</span> 
-           <span id="phaseB-inductance">--</span> mH</p>
-
-        <h3>Phase C</h3>
-        <p><span class="parameter-label">Status:</span> 
-           <span class="status-ok" id="phaseC-status">--</span></p>
-        <p><span class="parameter-label">Resistance:</span> 
-           <span id="phaseC-resistance">--</span> Ω</p>
-        <p><span class="parameter-label">Inductance:</span> 
-           <span id="phaseC-inductance">--</span> mH</p>
-    </div>
-
-    <div class="card">
-        <h2>Hall Sensor Status</h2>
-        <p><span class="parameter-label">Hall A:</span> 
-           <span class="status-ok" id="hallA-status">--</span></p>
-        <p><span class="parameter-label">Hall B:</span> 
-           <span class="status-ok" id="hallB-status">--</span></p>
-        <p><span class="parameter-label">Hall C:</span> 
-           <span class="status-ok" id="hallC-status">--</span></p>
-    </div>
-
-    <div class="card">
-        <h2>Test Section</h2>
-        <button onclick="startTest()">Run Test</button>
-        <button onclick="stopTest()">Stop Test</button>
-        <p>
-            <span class="parameter-label">Duty Cycle:</span>
-            <input type="range" id="duty-cycle" min="0" max="100" value="50">
-            <span id="duty-cycle-value">50</span>%
-        </p>
-    </div>
-
-    <script>
-        var ws = new WebSocket('ws://' + window.location.hostname + '/ws');
-        
-        ws.onmessage = function(event) {
-            var data = JSON.parse(event.data);
-            updateUI(data);
-        };
-
-        function updateUI(data) {
-            // Update all UI elements with received data
-            if(data.voltage) document.getElementById('supply-voltage').textContent = data.voltage;
-            if(data.polePairs) document.getElementById('pole-pairs').textContent = data.polePairs;
-            if(data.motorKv) document.getElementById('motor-kv').textContent = data.motorKv;
-            if(data.voltageLimit) {
-                document.getElementById('voltage-limit').value = data.voltageLimit;
-            }
-            if(data.direction) {
-                document.getElementById('motor-direction').value = data.direction;
-            }
-            // ... update other elements
-        }
+    server.on("/results", HTTP_GET, handleResultsQuery);
 
-        function startTest() {
-            ws.send(JSON.stringify({command: 'start'}));
-        }
+    // The UI is compiled from preview.html into gzipped flash blobs
+    for (const WebAsset& asset : WEB_UI_ASSETS) {
+        server.on(asset.path, HTTP_GET, [&asset](AsyncWebServerRequest *request){
+            sendWebAsset(request, asset);
+        });
+    }
 
-        function stopTest() {
-            ws.send(JSON.stringify({command: 'stop'}));
-        }
+    server.begin();
+}
 
-        // Update duty cycle value display and send to server
-        document.getElementById('duty-cycle').oninput = function() {
-            var value = this.value;
-            document.getElementById('duty-cycle-value').textContent = value;
-            ws.send(JSON.stringify({command: 'duty', value: value}));
-        };
-
-        function updateVoltageLimit() {
-            const limit = document.getElementById('voltage-limit').value;
-            ws.send(JSON.stringify({
-                command: 'setVoltageLimit',
-                value: parseFloat(limit)
-            }));
+// Runs on the sequencer task after every step and at the end of the unit
+static void broadcastTestProgress(const TestRecord& record, uint8_t stepIndex) {
+    DynamicJsonDocument doc(1536);
+    if (stepIndex < record.stepCount) {
+        const TestStepResult& step = record.steps[stepIndex];
+        JsonObject progress = doc.createNestedObject("testStep");
+        progress["serial"] = record.serial;
+        progress["index"] = stepIndex;
+        progress["name"] = testStepName(step.type);
+        progress["value"] = step.value;
+        progress["passed"] = step.passed;
+        progress["skipped"] = step.skipped;
+        progress["durationMs"] = step.durationMs;
+    } else {
+        TestSequencerStats stats = getTestSequencerStats();
+        JsonObject result = doc.createNestedObject("testRecord");
+        result["serial"] = record.serial;
+        result["passed"] = record.passed;
+        result["aborted"] = record.aborted;
+        result["durationMs"] = record.durationMs;
+        JsonArray steps = result.createNestedArray("steps");
+        for (uint8_t i = 0; i < record.stepCount; i++) {
+            JsonObject step = steps.createNestedObject();
+            step["name"] = testStepName(record.steps[i].type);
+            step["value"] = record.steps[i].value;
+            step["passed"] = record.steps[i].passed;
+            step["skipped"] = record.steps[i].skipped;
         }
+        result["units"] = stats.units;
+        result["passedUnits"] = stats.passed;
+        result["unitsPerHour"] = stats.unitsPerHour;
+    }
+    broadcastJson(doc);
+}
 
-        function updateDirection() {
-            const direction = document.getElementById('motor-direction').value;
-            ws.send(JSON.stringify({
-                command: 'setDirection',
-                value: direction
-            }));
-        }
-    </script>
-</body>
-</html>
-        )html";
-        request->send(200, "text/html", html);
-    });
+static void broadcastTestPlan() {
+    TestPlan plan = getTestPlan();
+    DynamicJsonDocument doc(1536);
+    JsonObject result = doc.createNestedObject("testPlan");
+    result["stopOnFail"] = plan.stopOnFail;
+    JsonArray steps = result.createNestedArray("steps");
+    for (uint8_t i = 0; i < plan.stepCount; i++) {
+        JsonObject step = steps.createNestedObject();
+        step["type"] = testStepName(plan.steps[i].type);
+        step["parameter"] = plan.steps[i].parameter;
+        step["duration"] = plan.steps[i].durationMs;
+        step["min"] = plan.steps[i].min;
+        step["max"] = plan.steps[i].max;
+    }
+    broadcastJson(doc);
+}
 
-    server.begin();
+static bool parseTestPlan(const JsonDocument& doc, TestPlan* plan) {
+    JsonArrayConst steps = doc["steps"];
+    if (steps.isNull() || steps.size() > TEST_PLAN_MAX_STEPS) return false;
+
+    *plan = TestPlan();
+    plan->stopOnFail = doc["stopOnFail"] | true;
+    for (JsonObjectConst step : steps) {
+        TestStep& parsed = plan->steps[plan->stepCount++];
+        if (!testStepFromName(step["type"], &parsed.type)) return false;
+        parsed.parameter = step["parameter"] | 0.0f;
+        parsed.durationMs = step["duration"] | 0;
+        parsed.min = step["min"] | 0.0f;
+        parsed.max = step["max"] | 0.0f;
+    }
+    return testPlanValid(*plan);
 }
 
 void handleWebSocketMessage(AsyncWebSocketClient *client, const char *message) {
-    StaticJsonDocument<200> doc;
+    // Sized for a full test plan, the only large command
+    DynamicJsonDocument doc(1536);
     DeserializationError error = deserializeJson(doc, message);
     
     if (error) {
@@ -189,9 +404,7 @@ void handleWebSocketMessage(AsyncWebSocketClient *client, const char *message) {
         // Broadcast back the new setting
         StaticJsonDocument<200> response;
         response["voltageLimit"] = motor.voltage_limit;
-        String jsonString;
-        serializeJson(response, jsonString);
-        broadcastJson(jsonString);
+        broadcastJson(response);
     } 
     else if (strcmp(command, "setDirection") == 0) {
         const char* dir = doc["value"];
@@ -199,14 +412,100 @@ void handleWebSocketMessage(AsyncWebSocketClient *client, const char *message) {
         // Broadcast back the new setting
         StaticJsonDocument<200> response;
         response["direction"] = (motor.sensor_direction == Direction::CW) ? "CW" : "CCW";
-        String jsonString;
-        serializeJson(response, jsonString);
-        broadcastJson(jsonString);
+        broadcastJson(response);
+    }
+    else if (strcmp(command, "setLoopRate") == 0) {
+        uint32_t rate = doc["value"];
+        controlLoopSetRate(rate);
+    }
+    else if (strcmp(command, "setHealthInterval") == 0) {
+        uint32_t interval = doc["value"];
+        healthMonitorSetInterval(interval);
+    }
+    else if (strcmp(command, "setTelemetryFormat") == 0) {
+        const char* format = doc["value"];
+        setTelemetryJsonMode(format && strcmp(format, "json") == 0);
+    }
+    else if (strcmp(command, "spectrumCheck") == 0) {
+        healthMonitorRequestSpectrum();
+    }
+    else if (strcmp(command, "scopeArm") == 0) {
+        // Fields left out keep their defaults
+        ScopeConfig config = defaultScopeConfig();
+        config.channelMask = doc["channels"] | config.channelMask;
+        config.sampleRateHz = doc["rate"] | config.sampleRateHz;
+        config.length = doc["length"] | config.length;
+        config.preTrigger = doc["preTrigger"] | config.preTrigger;
+        config.source = (ScopeTriggerSource)(doc["trigger"] | (int)config.source);
+        config.triggerChannel = (AdcChannel)(doc["triggerChannel"] | (int)config.triggerChannel);
+        config.edge = (ScopeEdge)(doc["edge"] | (int)config.edge);
+        config.level = doc["level"] | config.level;
+        config.timeoutMs = doc["timeout"] | config.timeoutMs;
+        StaticJsonDocument<64> response;
+        response["scopeArmed"] = scopeArm(config);
+        broadcastJson(response);
+    }
+    else if (strcmp(command, "scopeStop") == 0) {
+        scopeStop();
+        StaticJsonDocument<64> response;
+        response["scopeArmed"] = false;
+        broadcastJson(response);
+    }
+    else if (strcmp(command, "scopeResend") == 0) {
+        restartScopeStream();
     }
     else if (strcmp(command, "start") == 0) {
-        // Handle start test command
+        StaticJsonDocument<64> response;
+        response["testStarted"] = testSequencerStart(doc["serial"] | "", broadcastTestProgress);
+        broadcastJson(response);
     } else if (strcmp(command, "stop") == 0) {
-        // Handle stop test command
+        testSequencerAbort();
+    } else if (strcmp(command, "getTestPlan") == 0) {
+        broadcastTestPlan();
+    } else if (strcmp(command, "setTestPlan") == 0) {
+        TestPlan plan;
+        bool stored = parseTestPlan(doc, &plan) && setTestPlan(plan);
+        StaticJsonDocument<64> response;
+        response["testPlanStored"] = stored;
+        broadcastJson(response);
+        if (stored) broadcastTestPlan();
+    } else if (strcmp(command, "saveResults") == 0) {
+        requestResultsSave(doc["serial"] | "");
+    } else if (strcmp(command, "setTime") == 0) {
+        // The tester has no RTC, the browser sets the clock for the results log
+        struct timeval now = {(time_t)(doc["value"] | 0UL), 0};
+        if (now.tv_sec > 0) settimeofday(&now, nullptr);
+    } else if (strcmp(command, "focStart") == 0) {
+        // Torque current control unless the command says otherwise
+        FocTorqueMode torque;
+        FocMotion motion;
+        bool started = focTorqueModeFromName(doc["torque"] | "foc_current", &torque) &&
+                       focMotionFromName(doc["motion"] | "torque", &motion) &&
+                       focControlRequest(torque, motion, doc["currentLimit"] | FOC_CURRENT_LIMIT);
+        if (started && doc.containsKey("target")) focControlSetTarget(doc["target"]);
+        StaticJsonDocument<64> response;
+        response["focStarted"] = started;
+        broadcastJson(response);
+    } else if (strcmp(command, "focTarget") == 0) {
+        focControlSetTarget(doc["value"] | 0.0f);
+    } else if (strcmp(command, "tuneCurrentLoop") == 0) {
+        StaticJsonDocument<64> response;
+        response["focStarted"] = focControlTuneCurrent(doc["bandwidth"] | 0.0f);
+        broadcastJson(response);
+    } else if (strcmp(command, "tuneVelocityLoop") == 0) {
+        StaticJsonDocument<64> response;
+        response["focStarted"] = focControlTuneVelocity(doc["setpoint"] | FOC_RELAY_SETPOINT,
+                                                        doc["amplitude"] | FOC_RELAY_AMPLITUDE);
+        broadcastJson(response);
+    } else if (strcmp(command, "mapEfficiency") == 0) {
+        StaticJsonDocument<64> response;
+        response["focStarted"] = focControlMapEfficiency(doc["maxSpeed"] | FOC_MAP_SPEED,
+                                                         doc["speedSteps"] | FOC_MAP_SPEED_STEPS,
+                                                         doc["maxCurrent"] | FOC_MAP_CURRENT,
+                                                         doc["currentSteps"] | FOC_MAP_CURRENT_STEPS);
+        broadcastJson(response);
+    } else if (strcmp(command, "focStop") == 0) {
+        focControlStop();
     } else if (strcmp(command, "duty") == 0) {
         float duty = doc["value"];
         // Handle duty cycle change
@@ -214,5 +513,118 @@ void handleWebSocketMessage(AsyncWebSocketClient *client, const char *message) {
 }
 
 void broadcastJson(const String& json) {
-    ws.textAll(json);
-}
\ No newline at end of file
+    if (ws.count() == 0) return;
+    broadcastText(json.c_str(), json.length());
+}
+
+void broadcastJson(const JsonDocument& doc) {
+    broadcastJsonChannel(doc, 0);
+}
+
+void broadcastFocControl() {
+    FocControlState state = focControlState();
+    StaticJsonDocument<960> doc;
+    JsonObject foc = doc.createNestedObject("focControl");
+    foc["active"] = state.active;
+    foc["aligned"] = state.aligned;
+    foc["torque"] = focTorqueModeName(state.torque);
+    foc["motion"] = focMotionName(state.motion);
+    foc["target"] = state.target;
+    foc["currentLimit"] = state.currentLimit;
+    foc["tuningVelocity"] = state.tuningVelocity;
+    foc["mapping"] = state.mapping;
+    foc["mapPoints"] = state.mapPoints;
+    foc["mapTotal"] = state.mapSpeedSteps * state.mapCurrentSteps;
+    foc["error"] = state.error;
+    if (state.gains.valid) {
+        JsonObject gains = foc.createNestedObject("gains");
+        gains["kp"] = state.gains.kp;
+        gains["ki"] = state.gains.ki;
+        gains["bandwidthHz"] = state.gains.bandwidthHz;
+        gains["filterTf"] = state.gains.filterTf;
+        gains["riseTimeUs"] = state.gains.riseTimeUs;
+    }
+    if (state.step.finalValue != 0) {
+        JsonObject step = foc.createNestedObject("step");
+        step["valid"] = state.step.valid;
+        step["riseTimeUs"] = state.step.riseTimeUs;
+        step["overshoot"] = state.step.overshoot;
+        step["settlingUs"] = state.step.settlingUs;
+        step["finalValue"] = state.step.finalValue;
+        step["trackingError"] = state.step.trackingError;
+    }
+    if (state.velocity.cycles > 0) {
+        JsonObject velocity = foc.createNestedObject("velocityTune");
+        velocity["valid"] = state.velocity.valid;
+        velocity["torque"] = focTorqueModeName(state.velocityTorque);
+        velocity["ultimateGain"] = state.velocity.ultimateGain;
+        velocity["ultimatePeriod"] = state.velocity.ultimatePeriod;
+        velocity["amplitude"] = state.velocity.amplitude;
+        velocity["bias"] = state.velocity.bias;
+        velocity["kp"] = state.velocity.kp;
+        velocity["ki"] = state.velocity.ki;
+        velocity["filterTf"] = state.velocity.filterTf;
+        velocity["cycles"] = state.velocity.cycles;
+    }
+    broadcastJson(doc);
+}
+
+BroadcastStats getBroadcastStats() {
+    xSemaphoreTake(broadcastLock, portMAX_DELAY);
+    BroadcastStats stats = broadcastStats;
+    xSemaphoreGive(broadcastLock);
+    return stats;
+}
+
+void setTelemetryJsonMode(bool enabled) {
+    jsonTelemetry = enabled;
+}
+
+bool telemetryJsonMode() {
+    return jsonTelemetry;
+}
+
+// Largest JSON forms of a telemetry frame: the client list with every
+// publisher record in use, and an efficiency map point
+#define TELEMETRY_JSON_CLIENTS_SIZE \
+    (JSON_OBJECT_SIZE(1) + JSON_ARRAY_SIZE(PUBLISHER_MAX_CLIENTS) + PUBLISHER_MAX_CLIENTS * JSON_OBJECT_SIZE(5))
+#define TELEMETRY_JSON_MAP_SIZE     (JSON_OBJECT_SIZE(1) + JSON_OBJECT_SIZE(20))
+#define TELEMETRY_JSON_CAPACITY \
+    (TELEMETRY_JSON_CLIENTS_SIZE > TELEMETRY_JSON_MAP_SIZE ? TELEMETRY_JSON_CLIENTS_SIZE : TELEMETRY_JSON_MAP_SIZE)
+
+static bool broadcastTelemetryJson(TelemetryChannel channel, uint16_t status, const float* values, uint8_t count) {
+    StaticJsonDocument<TELEMETRY_JSON_CAPACITY> doc;
+    // Channels without a JSON form count as delivered
+    if (!buildTelemetryJson(doc, channel, status, values, count)) return true;
+    return broadcastJsonChannel(doc, telemetryChannelCoalesced(channel) ? channel : 0);
+}
+
+bool broadcastTelemetry(TelemetryChannel channel, uint16_t status, const float* values, uint8_t count,
+                        uint32_t timestampUs) {
+    if (ws.count() == 0) return false;
+
+    if (jsonTelemetry) {
+        return broadcastTelemetryJson(channel, status, values, count);
+    }
+
+    // Encoded in place, frames of one channel always have the same size
+    size_t len = TELEMETRY_HEADER_SIZE + (size_t)count * sizeof(float);
+    BroadcastSlot* slot = claimBroadcastSlot(len);
+    if (!slot) return false;
+
+    if (timestampUs == 0) timestampUs = micros();
+    if (encodeTelemetryFrame(slot->buffer.data, len, channel, status, timestampUs, values, count) == 0) {
+        releaseBroadcastSlot(slot);
+        return false;
+    }
+    sendBroadcastSlot(slot, true, telemetryChannelCoalesced(channel) ? channel : 0);
+    return true;
+}
+
+void flushTelemetry() {
+    publisherFlush(ws);
+}
+
+bool telemetryEventRoom() {
+    return publisherEventRoom(ws);
+}
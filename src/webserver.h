@@ -10,6 +10,8 @@
 #include <ESPAsyncWebServer.h>
 #include <ArduinoJson.h>
 #include "motor_analysis.h"
+#include "telemetry.h"
+#include "ws_publisher.h"
 
 // External declarations
 extern AsyncWebServer server;
@@ -19,5 +21,31 @@ extern AsyncWebSocket ws;
 void setupWebServer();
 void handleWebSocketMessage(AsyncWebSocketClient *client, const char *message);
 void broadcastJson(const String& json);
+void broadcastJson(const JsonDocument& doc);
+// Mode, target and last error of the closed-loop control (foc_control.h)
+void broadcastFocControl();
+
+// Telemetry goes out as binary frames, or as JSON when debug mode is enabled.
+// A zero timestamp stamps the frame with the current time. Returns false when
+// the frame could not be handed to the WebSocket.
+bool broadcastTelemetry(TelemetryChannel channel, uint16_t status, const float* values, uint8_t count,
+                        uint32_t timestampUs = 0);
+// Deliver coalesced telemetry to clients whose queue has drained
+void flushTelemetry();
+// Every client can take another uncoalesced frame (scope chunks)
+bool telemetryEventRoom();
+void setTelemetryJsonMode(bool enabled);
+bool telemetryJsonMode();
+
+// Broadcasts reuse a fixed pool of WebSocket message buffers. Once every
+// message size has been seen, bufferAllocations stops growing.
+struct BroadcastStats {
+    uint32_t messages;            // broadcasts handed to the WebSocket
+    uint32_t bufferAllocations;   // pool buffers (re)allocated
+    uint32_t bufferReuses;        // broadcasts served from an idle pool buffer
+    uint32_t poolExhausted;       // broadcasts skipped, every buffer still queued
+};
+
+BroadcastStats getBroadcastStats();
 
 #endif 
\ No newline at end of file
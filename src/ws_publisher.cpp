@@ -0,0 +1,218 @@
+#include "ws_publisher.h"
+
+struct PublisherClient {
+    volatile uint32_t id;           // 0 marks a free record
+    std::atomic<uint32_t> queued;
+    uint32_t pending;               // bit per telemetry channel
+    uint32_t sent;
+    uint32_t coalesced;
+    uint32_t dropped;
+};
+
+struct LatestValue {
+    PublisherBuffer* buffer;
+    bool binary;
+};
+
+static PublisherClient clients[PUBLISHER_MAX_CLIENTS];
+static LatestValue latest[TELEMETRY_CH_COUNT];
+// Telemetry comes from the monitor task, events and client changes from the
+// AsyncTCP task. Recursive because a send can report a disconnect inline.
+static SemaphoreHandle_t publisherLock = nullptr;
+
+// Defined in the library's AsyncWebSocket.cpp (3.3.0), its header leaves them out
+size_t webSocketSendFrameWindow(AsyncClient* client);
+size_t webSocketSendFrame(AsyncClient* client, bool final, uint8_t opcode, bool mask, uint8_t* data, size_t len);
+
+// The library's multi message, sent from a PublisherBuffer. It holds a
+// reference on the buffer and a place in the client's queue and gives both
+// back when it is destroyed: once sent, or with the client's queue when the
+// client goes away.
+class TrackedMessage : public AsyncWebSocketMessage {
+  public:
+    TrackedMessage(PublisherBuffer* buffer, bool binary, PublisherClient* record)
+        : buffer(buffer), record(record), clientId(record->id) {
+        _opcode = binary ? WS_BINARY : WS_TEXT;
+        _mask = false;
+        _status = WS_MSG_SENDING;
+        buffer->references++;
+        record->queued++;
+    }
+
+    ~TrackedMessage() override {
+        // The record may have been handed to a new client in the meantime
+        if (record->id == clientId && record->queued > 0) record->queued--;
+        buffer->references--;
+    }
+
+    bool betweenFrames() const override { return acked == ackExpected; }
+
+    void ack(size_t len, uint32_t time) override {
+        (void)time;
+        acked += len;
+        if (sent >= buffer->length && acked >= ackExpected) _status = WS_MSG_SENT;
+    }
+
+    // Same framing as AsyncWebSocketMultiMessage::send()
+    size_t send(AsyncClient* client) override {
+        if (_status != WS_MSG_SENDING || acked < ackExpected) return 0;
+        if (sent == buffer->length) {
+            _status = WS_MSG_SENT;
+            return 0;
+        }
+
+        size_t toSend = buffer->length - sent;
+        size_t window = webSocketSendFrameWindow(client);
+        if (window < toSend) toSend = window;
+
+        sent += toSend;
+        ackExpected += toSend + (toSend < 126 ? 2 : 4);
+        bool final = sent == buffer->length;
+        uint8_t opcode = (toSend && sent == toSend) ? _opcode : (uint8_t)WS_CONTINUATION;
+
+        size_t written = webSocketSendFrame(client, final, opcode, false, buffer->data + sent - toSend, toSend);
+        if (toSend && written != toSend) {
+            sent -= toSend - written;
+            ackExpected -= toSend - written;
+        }
+        return written;
+    }
+
+  private:
+    PublisherBuffer* buffer;
+    PublisherClient* record;
+    uint32_t clientId;
+    size_t sent = 0;
+    size_t ackExpected = 0;  // bytes the socket has to confirm, frame headers included
+    size_t acked = 0;
+};
+
+static PublisherClient* findRecord(uint32_t id) {
+    for (PublisherClient& record : clients) {
+        if (record.id == id) return &record;
+    }
+    return nullptr;
+}
+
+static bool hasRoom(PublisherClient& record, AsyncWebSocketClient* client) {
+    return client->status() == WS_CONNECTED && record.queued < PUBLISHER_CLIENT_QUEUE && client->canSend();
+}
+
+static void sendTo(PublisherClient& record, AsyncWebSocketClient* client,
+                   PublisherBuffer* buffer, bool binary) {
+    client->message(new TrackedMessage(buffer, binary, &record));
+    record.sent++;
+}
+
+static void flushClient(AsyncWebSocket& ws, PublisherClient& record) {
+    if (!record.pending) return;
+    AsyncWebSocketClient* client = ws.client(record.id);
+    if (!client) return;
+
+    for (int ch = 0; ch < TELEMETRY_CH_COUNT && record.pending; ch++) {
+        if (!(record.pending & (1u << ch))) continue;
+        if (!hasRoom(record, client)) return;
+        record.pending &= ~(1u << ch);
+        sendTo(record, client, latest[ch].buffer, latest[ch].binary);
+    }
+}
+
+void publisherBegin() {
+    publisherLock = xSemaphoreCreateRecursiveMutex();
+}
+
+void publisherClientConnected(AsyncWebSocketClient* client) {
+    xSemaphoreTakeRecursive(publisherLock, portMAX_DELAY);
+    PublisherClient* record = findRecord(0);
+    if (record) {
+        record->queued = 0;
+        record->pending = 0;
+        record->sent = 0;
+        record->coalesced = 0;
+        record->dropped = 0;
+        record->id = client->id();
+        // A new client starts with the newest value of every channel
+        for (int ch = 0; ch < TELEMETRY_CH_COUNT; ch++) {
+            if (latest[ch].buffer) record->pending |= 1u << ch;
+        }
+    }
+    xSemaphoreGiveRecursive(publisherLock);
+}
+
+void publisherClientDisconnected(AsyncWebSocketClient* client) {
+    xSemaphoreTakeRecursive(publisherLock, portMAX_DELAY);
+    PublisherClient* record = findRecord(client->id());
+    if (record) record->id = 0;
+    xSemaphoreGiveRecursive(publisherLock);
+}
+
+void publishLatest(AsyncWebSocket& ws, TelemetryChannel channel, PublisherBuffer* buffer, bool binary) {
+    xSemaphoreTakeRecursive(publisherLock, portMAX_DELAY);
+
+    // Hold the newest value so the buffer pool cannot recycle it while a
+    // slow client still has it pending
+    buffer->references++;
+    if (latest[channel].buffer) latest[channel].buffer->references--;
+    latest[channel].buffer = buffer;
+    latest[channel].binary = binary;
+
+    for (PublisherClient& record : clients) {
+        if (!record.id) continue;
+        if (record.pending & (1u << channel)) {
+            record.coalesced++;
+        }
+        record.pending |= 1u << channel;
+        flushClient(ws, record);
+    }
+
+    xSemaphoreGiveRecursive(publisherLock);
+}
+
+void publishEvent(AsyncWebSocket& ws, PublisherBuffer* buffer, bool binary) {
+    xSemaphoreTakeRecursive(publisherLock, portMAX_DELAY);
+    for (PublisherClient& record : clients) {
+        if (!record.id) continue;
+        AsyncWebSocketClient* client = ws.client(record.id);
+        if (client && hasRoom(record, client)) {
+            sendTo(record, client, buffer, binary);
+        } else {
+            record.dropped++;
+        }
+    }
+    xSemaphoreGiveRecursive(publisherLock);
+}
+
+void publisherFlush(AsyncWebSocket& ws) {
+    xSemaphoreTakeRecursive(publisherLock, portMAX_DELAY);
+    for (PublisherClient& record : clients) {
+        if (record.id) flushClient(ws, record);
+    }
+    xSemaphoreGiveRecursive(publisherLock);
+}
+
+bool publisherBufferIdle(const PublisherBuffer* buffer) {
+    return buffer->references.load() == 0;
+}
+
+bool publisherEventRoom(AsyncWebSocket& ws) {
+    bool room = true;
+    xSemaphoreTakeRecursive(publisherLock, portMAX_DELAY);
+    for (PublisherClient& record : clients) {
+        if (!record.id) continue;
+        AsyncWebSocketClient* client = ws.client(record.id);
+        if (client && !hasRoom(record, client)) room = false;
+    }
+    xSemaphoreGiveRecursive(publisherLock);
+    return room;
+}
+
+size_t getPublisherClientStats(PublisherClientStats* out, size_t max) {
+    size_t count = 0;
+    xSemaphoreTakeRecursive(publisherLock, portMAX_DELAY);
+    for (PublisherClient& record : clients) {
+        if (!record.id || count >= max) continue;
+        out[count++] = {record.id, record.queued, record.sent, record.coalesced, record.dropped};
+    }
+    xSemaphoreGiveRecursive(publisherLock);
+    return count;
+}
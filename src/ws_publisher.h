@@ -0,0 +1,63 @@
+#ifndef WS_PUBLISHER_H
+#define WS_PUBLISHER_H
+
+#include <ESPAsyncWebServer.h>
+#include <atomic>
+#include "telemetry.h"
+
+// Per client WebSocket publisher with backpressure. Every client gets
+// frames only while it has fewer than PUBLISHER_CLIENT_QUEUE of ours in
+// flight. A telemetry channel that cannot be delivered right away is
+// coalesced: the client keeps a pending mark and receives the newest value
+// of that channel once its queue drains, so a slow phone sees fewer updates
+// instead of old ones, and never holds back the other clients.
+//
+// Written against ESPAsyncWebServer-esphome 3.3.0 and pinned to exactly that
+// version in platformio.ini: the publisher calls webSocketSendFrame() and
+// webSocketSendFrameWindow(), which the library does not declare in its
+// header, and sets the protected _opcode, _mask and _status of
+// AsyncWebSocketMessage. Check those against the library's AsyncWebSocket
+// sources before moving the pin.
+
+#define PUBLISHER_MAX_CLIENTS   8
+#define PUBLISHER_CLIENT_QUEUE  8    // frames in flight per client
+
+// A frame shared by every client it goes to. The publisher counts who still
+// uses it: each message in flight and the newest value of a channel hold a
+// reference. Messages are destroyed on the AsyncTCP task while frames are
+// published from others, so the count is an atomic of ours and not the
+// library's AsyncWebSocketMessageBuffer count. The owner of the memory may
+// only refill it once publisherBufferIdle() says so.
+struct PublisherBuffer {
+    uint8_t* data;
+    size_t length;
+    std::atomic<uint32_t> references;
+};
+
+struct PublisherClientStats {
+    uint32_t id;
+    uint32_t queued;      // frames handed to the socket, not yet sent
+    uint32_t sent;        // frames queued to this client
+    uint32_t coalesced;   // telemetry values replaced by a newer one before sending
+    uint32_t dropped;     // one-off messages the client had no room for
+};
+
+void publisherBegin();
+void publisherClientConnected(AsyncWebSocketClient* client);
+void publisherClientDisconnected(AsyncWebSocketClient* client);
+
+// Keep buffer as the newest value of channel and deliver it where possible.
+// The publisher holds a reference until a newer value replaces it.
+void publishLatest(AsyncWebSocket& ws, TelemetryChannel channel, PublisherBuffer* buffer, bool binary);
+// One-off message, sent to every client with room and dropped for the rest
+void publishEvent(AsyncWebSocket& ws, PublisherBuffer* buffer, bool binary);
+// No message and no channel refers to buffer any more
+bool publisherBufferIdle(const PublisherBuffer* buffer);
+// Send pending telemetry to clients whose queue has drained
+void publisherFlush(AsyncWebSocket& ws);
+// True when publishEvent() would reach every client right now
+bool publisherEventRoom(AsyncWebSocket& ws);
+
+size_t getPublisherClientStats(PublisherClientStats* out, size_t max);
+
+#endif
@@ -0,0 +1,154 @@
+// Ring buffer, window readers and bursts of the ADC sampler against the host
+// synthetic source. Every sample encodes its channel and index, so a reader
+// that picked the wrong slot, channel or wrap offset shows a wrong value.
+#include <unity.h>
+#include "adc_sampler.h"
+#include "hal.h"
+
+#define SAMPLE_MASK 0x0FFF   // 12 bit ADC
+
+static uint16_t sampleValue(AdcChannel channel, uint32_t index) {
+    return (uint16_t)((channel * 1000u + index) & SAMPLE_MASK);
+}
+
+static uint32_t tapCalls;
+static uint16_t tapLast[ADC_CH_COUNT];
+
+static void countingTap(const uint16_t* samples) {
+    tapCalls++;
+    for (int ch = 0; ch < ADC_CH_COUNT; ch++) tapLast[ch] = samples[ch];
+}
+
+void setUp() {
+    adcSamplerSetTap(nullptr);
+    adcSamplerSetSyntheticSource(sampleValue);
+    adcSamplerBegin();
+}
+
+void tearDown() {
+    adcSamplerStop();
+}
+
+static void test_empty_ring() {
+    AdcWindowStats stats;
+    uint16_t out[4];
+    TEST_ASSERT_FALSE(adcSamplerStats(ADC_CH_VIN, 16, &stats));
+    TEST_ASSERT_EQUAL_UINT16(0, stats.count);
+    TEST_ASSERT_EQUAL_FLOAT(0, stats.average);
+    TEST_ASSERT_EQUAL_FLOAT(0, adcSamplerAverage(ADC_CH_VIN, 16));
+    TEST_ASSERT_EQUAL_UINT16(0, adcSamplerLatest(ADC_CH_VIN));
+    TEST_ASSERT_EQUAL_UINT16(0, adcSamplerRawWindow(ADC_CH_VIN, out, 4));
+    TEST_ASSERT_EQUAL_UINT32(0, adcSamplerSequence(ADC_CH_VIN));
+}
+
+static void test_average_min_max() {
+    adcSamplerPump(10);
+    for (int ch = 0; ch < ADC_CH_COUNT; ch++) {
+        AdcChannel channel = (AdcChannel)ch;
+        TEST_ASSERT_EQUAL_UINT32(10, adcSamplerSequence(channel));
+        TEST_ASSERT_EQUAL_UINT16(sampleValue(channel, 9), adcSamplerLatest(channel));
+
+        // The last four samples are indices 6 .. 9
+        AdcWindowStats stats;
+        TEST_ASSERT_TRUE(adcSamplerStats(channel, 4, &stats));
+        TEST_ASSERT_EQUAL_UINT16(4, stats.count);
+        TEST_ASSERT_EQUAL_UINT16(sampleValue(channel, 6), stats.min);
+        TEST_ASSERT_EQUAL_UINT16(sampleValue(channel, 9), stats.max);
+        TEST_ASSERT_EQUAL_FLOAT(sampleValue(channel, 6) + 1.5f, stats.average);
+        TEST_ASSERT_EQUAL_FLOAT(stats.average, adcSamplerAverage(channel, 4));
+    }
+
+    // A window longer than the samples written is clamped to them
+    AdcWindowStats stats;
+    TEST_ASSERT_TRUE(adcSamplerStats(ADC_CH_I_SENSE1, 100, &stats));
+    TEST_ASSERT_EQUAL_UINT16(10, stats.count);
+    TEST_ASSERT_EQUAL_FLOAT(4.5f, stats.average);
+}
+
+static void test_raw_window_across_the_wrap() {
+    // Three laps and a bit, so the window straddles the end of the ring
+    uint32_t total = 3 * ADC_SAMPLER_RING_SIZE + ADC_SAMPLER_RING_SIZE / 4;
+    adcSamplerPump(total);
+    TEST_ASSERT_EQUAL_UINT32(total, adcSamplerSequence(ADC_CH_VB));
+
+    uint16_t out[ADC_SAMPLER_RING_SIZE];
+    uint16_t window = ADC_SAMPLER_RING_SIZE / 2;
+    TEST_ASSERT_EQUAL_UINT16(window, adcSamplerRawWindow(ADC_CH_VB, out, window));
+    for (uint16_t i = 0; i < window; i++) {
+        TEST_ASSERT_EQUAL_UINT16(sampleValue(ADC_CH_VB, total - window + i), out[i]);
+    }
+
+    // At most half the ring is handed out, the rest is margin for the producer
+    TEST_ASSERT_EQUAL_UINT16(window, adcSamplerRawWindow(ADC_CH_VB, out, ADC_SAMPLER_RING_SIZE));
+    AdcWindowStats stats;
+    TEST_ASSERT_TRUE(adcSamplerStats(ADC_CH_VB, ADC_SAMPLER_RING_SIZE, &stats));
+    TEST_ASSERT_EQUAL_UINT16(window, stats.count);
+    float expected = 0;
+    for (uint16_t i = 0; i < window; i++) expected += sampleValue(ADC_CH_VB, total - window + i);
+    TEST_ASSERT_EQUAL_FLOAT(expected / window, stats.average);
+}
+
+static void test_sample_value_wrap() {
+    // The synthetic values wrap at 12 bits within the window: min and max
+    // have to come from the samples, not from the ends of the window. The
+    // last sample of VC is 5000 + 3199 = 2 * 4096 + 7.
+    uint32_t total = 2 * (SAMPLE_MASK + 1) + 8 - ADC_CH_VC * 1000;
+    adcSamplerPump(total);
+    AdcWindowStats stats;
+    TEST_ASSERT_TRUE(adcSamplerStats(ADC_CH_VC, 16, &stats));
+    TEST_ASSERT_EQUAL_UINT16(0, stats.min);
+    TEST_ASSERT_EQUAL_UINT16(SAMPLE_MASK, stats.max);
+    TEST_ASSERT_EQUAL_UINT16(7, adcSamplerLatest(ADC_CH_VC));
+}
+
+static void test_tap_stop_and_restart() {
+    tapCalls = 0;
+    adcSamplerSetTap(countingTap);
+    adcSamplerPump(5);
+    TEST_ASSERT_EQUAL_UINT32(5, tapCalls);
+    for (int ch = 0; ch < ADC_CH_COUNT; ch++) {
+        TEST_ASSERT_EQUAL_UINT16(sampleValue((AdcChannel)ch, 4), tapLast[ch]);
+    }
+
+    // Stopped, the pump produces nothing
+    adcSamplerStop();
+    TEST_ASSERT_FALSE(adcSamplerRunning());
+    adcSamplerPump(5);
+    TEST_ASSERT_EQUAL_UINT32(5, tapCalls);
+    TEST_ASSERT_EQUAL_UINT32(5, adcSamplerSequence(ADC_CH_I_SENSE2));
+
+    // A restart empties the rings and starts the source over
+    TEST_ASSERT_TRUE(adcSamplerBegin());
+    TEST_ASSERT_EQUAL_UINT32(0, adcSamplerSequence(ADC_CH_I_SENSE2));
+    adcSamplerPump(1);
+    TEST_ASSERT_EQUAL_UINT16(sampleValue(ADC_CH_I_SENSE2, 0), adcSamplerLatest(ADC_CH_I_SENSE2));
+}
+
+static void test_burst_timestamps() {
+    // The burst runs on the HAL clock, which belongs to the simulator
+    halSimConfigure(defaultSimParams());
+    adcSamplerSetSyntheticSource(sampleValue);
+
+    uint16_t raw[32];
+    uint32_t tUs[32];
+    TEST_ASSERT_EQUAL_UINT16(32, adcSamplerBurst(ADC_CH_I_SENSE1, raw, tUs, 32, 25));
+    for (uint16_t i = 0; i < 32; i++) {
+        TEST_ASSERT_EQUAL_UINT32(i * 25u, tUs[i]);
+        TEST_ASSERT_EQUAL_UINT16(sampleValue(ADC_CH_I_SENSE1, i), raw[i]);
+    }
+
+    // Without a spacing the host burst uses its default
+    TEST_ASSERT_EQUAL_UINT16(2, adcSamplerBurst(ADC_CH_I_SENSE1, raw, tUs, 2));
+    TEST_ASSERT_EQUAL_UINT32(ADC_SAMPLER_HOST_BURST_US, tUs[1] - tUs[0]);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_empty_ring);
+    RUN_TEST(test_average_min_max);
+    RUN_TEST(test_raw_window_across_the_wrap);
+    RUN_TEST(test_sample_value_wrap);
+    RUN_TEST(test_tap_stop_and_restart);
+    RUN_TEST(test_burst_timestamps);
+    return UNITY_END();
+}
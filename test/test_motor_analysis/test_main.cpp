@@ -0,0 +1,250 @@
+// measureMotorParameters(), detectPolePairs() and runOpenLoopTest() against
+// the simulated motor, for a few plants of known parameters and a handful
+// of noise seeds each, and motors drawn across the native_sweep ranges.
+// The tolerances hold the estimates to what the measurements reach on these
+// plants today, so a regression shows up as a failure rather than as a
+// drift.
+#include <unity.h>
+#include <math.h>
+#include <stdio.h>
+#include "motor_analysis.h"
+#include "sim_sweep.h"
+
+#define PLANT_SEEDS              5
+#define RESISTANCE_TOLERANCE     0.05f  // relative
+#define INDUCTANCE_TOLERANCE     0.10f  // relative, bridge and sampling delays included
+#define CONNECTION_TOLERANCE     0.15f  // relative, per phase from three pair readings
+#define POLE_PAIR_MOTORS         3      // per pole pair count
+#define POLE_PAIR_MIN_FOUND      0.4f   // share of the motors, the native_sweep measures about half
+#define OPEN_LOOP_DUTY           0.3f
+#define OPEN_LOOP_DURATION_MS    2000
+#define OPEN_LOOP_SPEED_TOLERANCE 0.15f // relative to the ideal no-load speed
+
+struct Plant {
+    float resistance;       // ohms
+    float inductance;       // H
+    uint8_t polePairs;
+    float backEmfConstant;  // V per mechanical rad/s, phase peak
+};
+
+static const Plant plants[] = {
+    {0.5f, 0.5e-3f, 7, 0.02f},   // defaultSimParams()
+    {0.2f, 0.2e-3f, 4, 0.03f},
+    {0.3f, 0.1e-3f, 2, 0.015f},
+    {1.5f, 2e-3f, 14, 0.04f},
+};
+
+// Corners of the native_sweep ranges: the slowest and the fastest L/R, and
+// both ends of R at the same L/R, with the back-EMF at either end
+static const Plant rangeEnds[] = {
+    {0.05f, 5e-3f, 7, 0.1f},     // 100 ms
+    {5.0f, 50e-6f, 7, 0.005f},   // 10 us
+    {0.05f, 50e-6f, 1, 0.1f},    // 1 ms, low R against a strong back-EMF
+    {5.0f, 5e-3f, 14, 0.005f},   // 1 ms
+};
+
+static void startMotor(const BldcSimParams& p) {
+    halSimConfigure(p);
+    hallCaptureBegin();
+    adcSamplerBegin();
+    halDelayMs(50);
+    motorParams = MotorParameters();
+}
+
+static void startPlant(const Plant& plant, uint32_t seed) {
+    BldcSimParams p = defaultSimParams();
+    p.phaseResistance = plant.resistance;
+    p.phaseInductance = plant.inductance;
+    p.polePairs = plant.polePairs;
+    p.backEmfConstant = plant.backEmfConstant;
+    p.seed = seed;
+    startMotor(p);
+}
+
+// Motors drawn from the native_sweep ranges, eccentricity included, so the
+// rotor ranges from a clear once per turn signature to none at all
+static BldcSimParams sweepMotor(uint32_t* state, int polePairs) {
+    auto uniform = [state]() {
+        *state = *state * 1664525u + 1013904223u;
+        return (*state >> 8) / 16777216.0f;
+    };
+    auto logUniform = [&uniform](float low, float high) { return low * powf(high / low, uniform()); };
+    BldcSimParams p = defaultSimParams();
+    p.phaseResistance = logUniform(SIM_SWEEP_R_MIN, SIM_SWEEP_R_MAX);
+    p.phaseInductance = logUniform(SIM_SWEEP_L_MIN, SIM_SWEEP_L_MAX);
+    p.backEmfConstant = logUniform(SIM_SWEEP_KE_MIN, SIM_SWEEP_KE_MAX);
+    p.inertia = logUniform(SIM_SWEEP_INERTIA_MIN, SIM_SWEEP_INERTIA_MAX);
+    p.hallOffset = (uniform() - 0.5f) * 0.2f;
+    p.rotorEccentricity = uniform() * SIM_SWEEP_ECCENTRICITY_MAX;
+    p.polePairs = polePairs;
+    p.seed = *state;
+    return p;
+}
+
+static void assertWithin(float expected, float actual, float tolerance, const char* what) {
+    char message[96];
+    snprintf(message, sizeof(message), "%s %.4g, expected %.4g", what, actual, expected);
+    TEST_ASSERT_TRUE_MESSAGE(fabsf(actual / expected - 1) <= tolerance, message);
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_measure_motor_parameters() {
+    for (const Plant& plant : plants) {
+        for (uint32_t seed = 1; seed <= PLANT_SEEDS; seed++) {
+            startPlant(plant, seed);
+            TEST_ASSERT_TRUE(measureMotorParameters());
+            TEST_ASSERT_EQUAL_UINT8(MEASURED_ALL, motorParams.measured);
+            assertWithin(plant.resistance, motorParams.phaseResistance, RESISTANCE_TOLERANCE, "resistance");
+            assertWithin(plant.inductance, motorParams.phaseInductance, INDUCTANCE_TOLERANCE, "inductance");
+            TEST_ASSERT_EQUAL_UINT8(plant.polePairs, motorParams.polePairs);
+            TEST_ASSERT_TRUE(motorParams.hallValid);
+            assertWithin(defaultSimParams().supplyVoltage, motorParams.inputVoltage, 0.02f, "input voltage");
+        }
+    }
+}
+
+static void test_measure_across_the_sweep_ranges() {
+    // Resistance and inductance always, the pole pairs only when they are
+    // known, and the result owns up to whatever is missing
+    uint32_t state = 2;
+    for (int pp = 1; pp <= SIM_SWEEP_MAX_POLE_PAIRS; pp++) {
+        BldcSimParams p = sweepMotor(&state, pp);
+        startMotor(p);
+        bool ok = measureMotorParameters();
+        uint8_t measured = motorParams.measured;
+        TEST_ASSERT_TRUE(measured & MEASURED_RESISTANCE);
+        TEST_ASSERT_TRUE(measured & MEASURED_INDUCTANCE);
+        assertWithin(p.phaseResistance, motorParams.phaseResistance, RESISTANCE_TOLERANCE, "resistance");
+        assertWithin(p.phaseInductance, motorParams.phaseInductance, INDUCTANCE_TOLERANCE, "inductance");
+        if (measured & MEASURED_POLE_PAIRS) TEST_ASSERT_EQUAL_INT(pp, motorParams.polePairs);
+        TEST_ASSERT_EQUAL(measured == MEASURED_ALL, ok);
+        if (pp == 1) TEST_ASSERT_FALSE(ok);
+    }
+}
+
+static void test_inductance_at_the_range_ends() {
+    for (const Plant& plant : rangeEnds) {
+        for (uint32_t seed = 1; seed <= 2; seed++) {
+            startPlant(plant, seed);
+            float resistance = measurePhaseResistance();
+            assertWithin(plant.resistance, resistance, RESISTANCE_TOLERANCE, "resistance");
+            motorParams.phaseResistance = resistance;
+            assertWithin(plant.inductance, measurePhaseInductance(), INDUCTANCE_TOLERANCE, "inductance");
+            releaseBridge();
+        }
+    }
+}
+
+static void test_detect_pole_pairs() {
+    // Not every rotor shows a signature, or follows the sweep, but no count
+    // that claims POLE_MIN_CONFIDENCE may be wrong
+    uint32_t state = 1;
+    int runs = 0, found = 0;
+    for (int pp = 1; pp <= SIM_SWEEP_MAX_POLE_PAIRS; pp++) {
+        for (int k = 0; k < POLE_PAIR_MOTORS; k++) {
+            BldcSimParams p = sweepMotor(&state, pp);
+            startMotor(p);
+            motorParams.phaseResistance = p.phaseResistance;
+            int detected = detectPolePairs();
+            char message[96];
+            snprintf(message, sizeof(message), "%d pole pairs read as %d, confidence %.2f, eccentricity %.4f",
+                     pp, detected, motorParams.polePairConfidence, p.rotorEccentricity);
+            if (motorParams.polePairConfidence >= POLE_MIN_CONFIDENCE) {
+                TEST_ASSERT_EQUAL_INT_MESSAGE(pp, detected, message);
+                found++;
+            }
+            // One pole pair looks like a rotor without a signature
+            if (pp == 1) TEST_ASSERT_TRUE_MESSAGE(motorParams.polePairConfidence < POLE_MIN_CONFIDENCE, message);
+            runs++;
+        }
+    }
+    char message[48];
+    snprintf(message, sizeof(message), "%d of %d counts measured", found, runs);
+    TEST_ASSERT_TRUE_MESSAGE(found >= POLE_PAIR_MIN_FOUND * runs, message);
+}
+
+static void test_phase_connections() {
+    for (const Plant& plant : plants) {
+        startPlant(plant, 1);
+        PhaseStatus phases;
+        checkPhaseConnections(&phases);
+        releaseBridge();
+        TEST_ASSERT_TRUE(phases.phaseA_OK && phases.phaseB_OK && phases.phaseC_OK);
+        assertWithin(plant.resistance, phases.phaseA_resistance, CONNECTION_TOLERANCE, "phase A");
+        assertWithin(plant.resistance, phases.phaseB_resistance, CONNECTION_TOLERANCE, "phase B");
+        assertWithin(plant.resistance, phases.phaseC_resistance, CONNECTION_TOLERANCE, "phase C");
+    }
+
+    // Phase A open: both pairs through it carry no current
+    const float openA[3] = {INFINITY, 1.0f, INFINITY};
+    PhaseStatus phases;
+    storePairResistances(&phases, openA);
+    TEST_ASSERT_FALSE(phases.phaseA_OK);
+    TEST_ASSERT_TRUE(isinf(phases.phaseA_resistance));
+    TEST_ASSERT_TRUE(phases.phaseB_OK && phases.phaseC_OK);
+    TEST_ASSERT_FLOAT_WITHIN(1e-6f, 0.5f, phases.phaseB_resistance);
+    TEST_ASSERT_FLOAT_WITHIN(1e-6f, 0.5f, phases.phaseC_resistance);
+
+    // Phase C shorted to the neutral point
+    const float shortC[3] = {1.0f, 0.5f, 0.5f};
+    storePairResistances(&phases, shortC);
+    TEST_ASSERT_TRUE(phases.phaseA_OK && phases.phaseB_OK);
+    TEST_ASSERT_FALSE(phases.phaseC_OK);
+}
+
+static void test_open_loop() {
+    for (const Plant& plant : plants) {
+        startPlant(plant, 1);
+        motorParams.phaseResistance = plant.resistance;
+        motorParams.polePairs = plant.polePairs;
+        OpenLoopTestResult result = runOpenLoopTest(OPEN_LOOP_DUTY, OPEN_LOOP_DURATION_MS);
+        TEST_ASSERT_TRUE_MESSAGE(result.success, result.errorMessage.c_str());
+        TEST_ASSERT_FALSE(result.currentLimitExceeded);
+        TEST_ASSERT_TRUE(result.hallsWorking);
+        TEST_ASSERT_EQUAL_UINT32(0, result.hallGlitches);
+
+        // Ideal six-step no-load speed, where the line to line back-EMF
+        // peak meets the duty's share of the supply
+        float idealRpm = OPEN_LOOP_DUTY * defaultSimParams().supplyVoltage /
+                         (sqrtf(3.0f) * plant.backEmfConstant) * 60 / (2 * (float)M_PI);
+        assertWithin(idealRpm, result.speedRpm, OPEN_LOOP_SPEED_TOLERANCE, "open-loop speed");
+        assertWithin(result.electricalHz * 60 / plant.polePairs, result.speedRpm, 0.001f, "rpm from electrical Hz");
+    }
+}
+
+static void test_open_loop_trip_hands_the_bridge_back() {
+    // Low resistance and a heavy rotor: the ramp outruns the back-EMF
+    BldcSimParams p = defaultSimParams();
+    p.phaseResistance = 0.1f;
+    p.inertia = 1e-3f;
+    halSimConfigure(p);
+    hallCaptureBegin();
+    adcSamplerBegin();
+    halDelayMs(50);
+    motorParams = MotorParameters();
+    motorParams.phaseResistance = p.phaseResistance;
+    motorParams.polePairs = p.polePairs;
+
+    OpenLoopTestResult result = runOpenLoopTest(0.9f, 1000);
+    TEST_ASSERT_TRUE(result.currentLimitExceeded);
+    TEST_ASSERT_FALSE(result.success);
+    TEST_ASSERT_FALSE(halSimState().bridgeEnabled);
+
+    // Handing the bridge back has to clear the FOC hold and the trip
+    useBridge(BRIDGE_RELEASED);
+    TEST_ASSERT_TRUE(halSimState().bridgeEnabled);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_measure_motor_parameters);
+    RUN_TEST(test_measure_across_the_sweep_ranges);
+    RUN_TEST(test_inductance_at_the_range_ends);
+    RUN_TEST(test_detect_pole_pairs);
+    RUN_TEST(test_phase_connections);
+    RUN_TEST(test_open_loop);
+    RUN_TEST(test_open_loop_trip_hands_the_bridge_back);
+    return UNITY_END();
+}
@@ -0,0 +1,171 @@
+// fitRLStep() against simulated RL current rises: tau from 0.1 to 3 ms,
+// captured the way measurePairTimeConstant() does (256 samples, the sample
+// spacing widened until the rise settles), with Gaussian noise and the ADC's
+// 12 bit quantization on top.
+#include <unity.h>
+#include <math.h>
+#include <stdio.h>
+#include "step_response.h"
+
+#define FIT_SAMPLES         256
+#define FIT_BASELINE        310.0f   // counts, amplifier offset
+#define FIT_FINAL           1500.0f  // counts above the baseline once settled
+#define FIT_NOISE           4.0f     // counts rms
+#define FIT_STEP_DELAY_US   3.0f     // step applied this long before the first sample
+#define FIT_SEEDS           50
+#define FIT_RMS_TOLERANCE   0.006f   // relative tau error, rms over the seeds at every tau
+#define FIT_WORST_TOLERANCE 0.015f   // relative tau error of any single fit
+
+static uint32_t noiseState;
+
+static float gaussian() {
+    // xorshift32 into Box-Muller, deterministic per seed
+    float u[2];
+    for (int k = 0; k < 2; k++) {
+        noiseState ^= noiseState << 13;
+        noiseState ^= noiseState >> 17;
+        noiseState ^= noiseState << 5;
+        u[k] = (noiseState + 1.0f) / 4294967297.0f;
+    }
+    return sqrtf(-2 * logf(u[0])) * cosf(6.2831853f * u[1]);
+}
+
+// Spacing of the capture that settles, doubled from 10 us like the retries
+static uint32_t spacingFor(float tau) {
+    uint32_t spacingUs = 10;
+    while (FIT_SAMPLES * spacingUs * 1e-6f < 8 * tau) spacingUs *= 2;
+    return spacingUs;
+}
+
+static RLFitResult fitSimulated(float tau, uint32_t seed, float noise) {
+    static uint32_t tUs[FIT_SAMPLES];
+    static uint16_t raw[FIT_SAMPLES];
+    noiseState = seed * 2654435761u + 1;
+    uint32_t spacingUs = spacingFor(tau);
+    for (uint16_t i = 0; i < FIT_SAMPLES; i++) {
+        tUs[i] = i * spacingUs;
+        float t = (tUs[i] + FIT_STEP_DELAY_US) * 1e-6f;
+        float value = FIT_BASELINE + FIT_FINAL * (1 - expf(-t / tau)) + noise * gaussian();
+        raw[i] = (uint16_t)lroundf(fminf(fmaxf(value, 0), 4095));
+    }
+    return fitRLStep(tUs, raw, FIT_SAMPLES, FIT_BASELINE);
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_tau_sweep_with_noise() {
+    static const float taus[] = {0.1e-3f, 0.2e-3f, 0.35e-3f, 0.5e-3f, 0.75e-3f, 1e-3f, 1.5e-3f, 2e-3f, 3e-3f};
+    float worstRms = 0, worst = 0;
+    for (float tau : taus) {
+        float squares = 0;
+        for (uint32_t seed = 0; seed < FIT_SEEDS; seed++) {
+            RLFitResult fit = fitSimulated(tau, seed, FIT_NOISE);
+            TEST_ASSERT_TRUE(fit.valid);
+            TEST_ASSERT_TRUE(fit.settled);
+            TEST_ASSERT_FLOAT_WITHIN(FIT_WORST_TOLERANCE * tau, tau, fit.tau);
+            float error = (fit.tau - tau) / tau;
+            squares += error * error;
+            if (fabsf(error) > worst) worst = fabsf(error);
+        }
+        float rms = sqrtf(squares / FIT_SEEDS);
+        if (rms > worstRms) worstRms = rms;
+        TEST_ASSERT_TRUE_MESSAGE(rms <= FIT_RMS_TOLERANCE, "rms tau error above the bound");
+    }
+    char message[64];
+    snprintf(message, sizeof(message), "tau error %.2f %% rms, %.2f %% worst", worstRms * 100, worst * 100);
+    TEST_MESSAGE(message);
+}
+
+static void test_noise_free_fit_is_exact() {
+    RLFitResult fit = fitSimulated(1e-3f, 0, 0);
+    TEST_ASSERT_TRUE(fit.valid);
+    TEST_ASSERT_FLOAT_WITHIN(0.002f * 1e-3f, 1e-3f, fit.tau);
+    TEST_ASSERT_FLOAT_WITHIN(2, FIT_FINAL, fit.finalValue);
+}
+
+// A window far shorter than the rise is not settled and must not pass
+static void test_unsettled_capture_is_rejected() {
+    static uint32_t tUs[FIT_SAMPLES];
+    static uint16_t raw[FIT_SAMPLES];
+    const float tau = 3e-3f;
+    for (uint16_t i = 0; i < FIT_SAMPLES; i++) {
+        tUs[i] = i * 10;
+        raw[i] = (uint16_t)lroundf(FIT_BASELINE + FIT_FINAL * (1 - expf(-tUs[i] * 1e-6f / tau)));
+    }
+    RLFitResult fit = fitRLStep(tUs, raw, FIT_SAMPLES, FIT_BASELINE);
+    TEST_ASSERT_FALSE(fit.settled);
+    TEST_ASSERT_FALSE(fit.valid);
+}
+
+static void test_short_or_flat_capture_is_rejected() {
+    uint32_t tUs[FIT_SAMPLES];
+    uint16_t raw[FIT_SAMPLES];
+    for (uint16_t i = 0; i < FIT_SAMPLES; i++) {
+        tUs[i] = i * 10;
+        raw[i] = (uint16_t)FIT_BASELINE;
+    }
+    TEST_ASSERT_FALSE(fitRLStep(tUs, raw, 0, FIT_BASELINE).valid);
+    TEST_ASSERT_FALSE(fitRLStep(tUs, raw, 31, FIT_BASELINE).valid);
+    TEST_ASSERT_FALSE(fitRLStep(tUs, raw, FIT_SAMPLES, FIT_BASELINE).valid);
+}
+
+// A response of a few counts is mostly noise: the band still catches some
+// samples and their slope is nearly flat, a tau of hours
+static void test_noise_only_capture_is_rejected() {
+    static uint32_t tUs[FIT_SAMPLES];
+    static uint16_t raw[FIT_SAMPLES];
+    for (uint32_t seed = 0; seed < FIT_SEEDS; seed++) {
+        noiseState = seed * 2654435761u + 1;
+        for (uint16_t i = 0; i < FIT_SAMPLES; i++) {
+            tUs[i] = i * 10;
+            float value = FIT_BASELINE + (i > 0 ? 9 : 0) + 0.6f * gaussian();
+            raw[i] = (uint16_t)lroundf(value);
+        }
+        RLFitResult fit = fitRLStep(tUs, raw, FIT_SAMPLES, FIT_BASELINE);
+        TEST_ASSERT_FALSE(fit.valid);
+        TEST_ASSERT_EQUAL_FLOAT(0, fit.tau);
+    }
+}
+
+// Settled within two samples: no tau to fit, but the caller learns that a
+// finer capture would resolve it
+static void test_rise_within_a_few_samples_is_too_fast() {
+    static uint32_t tUs[FIT_SAMPLES];
+    static uint16_t raw[FIT_SAMPLES];
+    const float tau = 8e-6f;
+    for (uint16_t i = 0; i < FIT_SAMPLES; i++) {
+        tUs[i] = i * 10;
+        raw[i] = (uint16_t)lroundf(FIT_BASELINE + FIT_FINAL * (1 - expf(-(tUs[i] + 2.0f) * 1e-6f / tau)));
+    }
+    RLFitResult fit = fitRLStep(tUs, raw, FIT_SAMPLES, FIT_BASELINE);
+    TEST_ASSERT_FALSE(fit.valid);
+    TEST_ASSERT_TRUE(fit.tooFast);
+}
+
+// A settled response that is not a first order rise (a linear ramp into
+// the limit) leaves a large residual
+static void test_non_exponential_rise_is_rejected() {
+    static uint32_t tUs[FIT_SAMPLES];
+    static uint16_t raw[FIT_SAMPLES];
+    for (uint16_t i = 0; i < FIT_SAMPLES; i++) {
+        tUs[i] = i * 10;
+        float ramp = fminf(i / 128.0f, 1.0f);
+        raw[i] = (uint16_t)lroundf(FIT_BASELINE + FIT_FINAL * ramp);
+    }
+    RLFitResult fit = fitRLStep(tUs, raw, FIT_SAMPLES, FIT_BASELINE);
+    TEST_ASSERT_TRUE(fit.settled);
+    TEST_ASSERT_FALSE(fit.valid);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_tau_sweep_with_noise);
+    RUN_TEST(test_noise_free_fit_is_exact);
+    RUN_TEST(test_unsettled_capture_is_rejected);
+    RUN_TEST(test_short_or_flat_capture_is_rejected);
+    RUN_TEST(test_noise_only_capture_is_rejected);
+    RUN_TEST(test_rise_within_a_few_samples_is_too_fast);
+    RUN_TEST(test_non_exponential_rise_is_rejected);
+    return UNITY_END();
+}
@@ -0,0 +1,133 @@
+// Two-thread stress test of SpscRing: one producer and one consumer thread
+// hammer a small ring so it is full most of the time, under both overflow
+// policies. Every item carries its sequence number in each word, so a copy
+// that raced with the producer shows up as a torn item.
+#include <unity.h>
+#include <atomic>
+#include <thread>
+#include "spsc_ring.h"
+
+#define STRESS_ITEMS      2000000u
+#define STRESS_RING_SIZE  64
+#define STRESS_BATCH      16
+#define STRESS_YIELD_MASK 127    // producer yields every 128 items, overflowing the ring in between
+
+struct StressItem {
+    uint32_t words[8];
+};
+
+static StressItem makeItem(uint32_t sequence) {
+    StressItem item;
+    for (uint32_t i = 0; i < 8; i++) item.words[i] = sequence * 2654435761u + i;
+    return item;
+}
+
+static bool itemIntact(const StressItem& item, uint32_t* sequence) {
+    uint32_t base = item.words[0];
+    for (uint32_t i = 1; i < 8; i++) {
+        if (item.words[i] != base + i) return false;
+    }
+    // 2654435761 is odd, so it has an inverse mod 2^32
+    *sequence = base * 244002641u;
+    return true;
+}
+
+struct StressResult {
+    uint32_t attempts;
+    uint32_t popped;
+    uint32_t torn;
+    uint32_t outOfOrder;
+};
+
+template <SpscPolicy Policy>
+static StressResult runStress(SpscRing<StressItem, STRESS_RING_SIZE, Policy>& ring) {
+    StressResult result = {0, 0, 0, 0};
+    std::atomic<bool> producerDone(false);
+
+    std::thread producer([&]() {
+        for (uint32_t i = 0; i < STRESS_ITEMS; i++) {
+            ring.push(makeItem(i));
+            if ((i & STRESS_YIELD_MASK) == 0) std::this_thread::yield();
+        }
+        producerDone.store(true, std::memory_order_release);
+    });
+
+    StressItem batch[STRESS_BATCH];
+    bool first = true;
+    uint32_t last = 0;
+    for (;;) {
+        bool done = producerDone.load(std::memory_order_acquire);
+        size_t count = ring.popBatch(batch, STRESS_BATCH);
+        for (size_t i = 0; i < count; i++) {
+            uint32_t sequence;
+            if (!itemIntact(batch[i], &sequence)) {
+                result.torn++;
+                continue;
+            }
+            if (!first && sequence <= last) result.outOfOrder++;
+            first = false;
+            last = sequence;
+        }
+        result.popped += count;
+        // Drained after the producer finished: nothing can follow
+        if (done && count == 0) break;
+        if (count == 0) std::this_thread::yield();
+    }
+    producer.join();
+    result.attempts = STRESS_ITEMS;
+    return result;
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_drop_newest_accounts_for_every_item() {
+    static SpscRing<StressItem, STRESS_RING_SIZE, SPSC_DROP_NEWEST> ring;
+    StressResult result = runStress(ring);
+
+    TEST_ASSERT_GREATER_THAN_UINT32(STRESS_ITEMS / 100, result.popped);
+    TEST_ASSERT_EQUAL_UINT32(0, result.torn);
+    TEST_ASSERT_EQUAL_UINT32(0, result.outOfOrder);
+    TEST_ASSERT_EQUAL_UINT32(ring.pushed(), result.popped);
+    TEST_ASSERT_EQUAL_UINT32(result.attempts, result.popped + ring.dropped());
+    TEST_ASSERT_EQUAL_UINT32(0, ring.overruns());
+}
+
+static void test_overwrite_oldest_accounts_for_every_item() {
+    static SpscRing<StressItem, STRESS_RING_SIZE, SPSC_OVERWRITE_OLDEST> ring;
+    StressResult result = runStress(ring);
+
+    TEST_ASSERT_GREATER_THAN_UINT32(STRESS_ITEMS / 100, result.popped);
+    TEST_ASSERT_EQUAL_UINT32(0, result.torn);
+    TEST_ASSERT_EQUAL_UINT32(0, result.outOfOrder);
+    TEST_ASSERT_EQUAL_UINT32(result.attempts, ring.pushed());
+    TEST_ASSERT_EQUAL_UINT32(ring.pushed(), result.popped + ring.overruns());
+    TEST_ASSERT_EQUAL_UINT32(0, ring.dropped());
+}
+
+// Single threaded edge cases: full ring, lapped consumer, empty pops
+static void test_policies_at_capacity() {
+    SpscRing<StressItem, 4, SPSC_DROP_NEWEST> drop;
+    for (uint32_t i = 0; i < 6; i++) drop.push(makeItem(i));
+    TEST_ASSERT_EQUAL_UINT32(4, drop.size());
+    TEST_ASSERT_EQUAL_UINT32(2, drop.dropped());
+
+    SpscRing<StressItem, 4, SPSC_OVERWRITE_OLDEST> overwrite;
+    for (uint32_t i = 0; i < 10; i++) overwrite.push(makeItem(i));
+    StressItem out[8];
+    size_t count = overwrite.popBatch(out, 8);
+    uint32_t sequence;
+    TEST_ASSERT_EQUAL_UINT32(3, count);
+    TEST_ASSERT_TRUE(itemIntact(out[0], &sequence));
+    TEST_ASSERT_EQUAL_UINT32(7, sequence);
+    TEST_ASSERT_EQUAL_UINT32(7, overwrite.overruns());
+    TEST_ASSERT_EQUAL_UINT32(0, overwrite.popBatch(out, 8));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_policies_at_capacity);
+    RUN_TEST(test_drop_newest_accounts_for_every_item);
+    RUN_TEST(test_overwrite_oldest_accounts_for_every_item);
+    return UNITY_END();
+}
@@ -0,0 +1,82 @@
+"""Compress the web UI into include/web_ui.h before every build.
+
+src/preview.html is the single source of the page. It is gzipped at build
+time and embedded as a PROGMEM blob together with a strong ETag derived
+from the compressed bytes, so the firmware can answer with
+Content-Encoding: gzip and 304 Not Modified.
+
+Runs as a PlatformIO pre script (extra_scripts = pre:tools/embed_web_ui.py)
+or standalone: python tools/embed_web_ui.py
+"""
+
+import gzip
+import hashlib
+import os
+
+# (source, URL path, content type, symbol)
+ASSETS = [
+    ("src/preview.html", "/", "text/html", "INDEX_HTML"),
+]
+
+OUTPUT = "include/web_ui.h"
+
+
+def c_array(data):
+    lines = []
+    for i in range(0, len(data), 16):
+        lines.append("    " + ", ".join("0x%02x" % b for b in data[i:i + 16]) + ",")
+    return "\n".join(lines)
+
+
+def generate(project_dir):
+    out = [
+        "// Generated by tools/embed_web_ui.py, do not edit",
+        "#ifndef WEB_UI_H",
+        "#define WEB_UI_H",
+        "",
+        '#include "web_assets.h"',
+        "",
+    ]
+    table = []
+
+    for source, path, content_type, symbol in ASSETS:
+        with open(os.path.join(project_dir, source), "rb") as f:
+            raw = f.read()
+        # mtime=0 keeps the output, and therefore the ETag, reproducible
+        compressed = gzip.compress(raw, compresslevel=9, mtime=0)
+        etag = '\\"%s\\"' % hashlib.sha256(compressed).hexdigest()[:16]
+
+        out.append("// %s: %d bytes, %d gzipped" % (source, len(raw), len(compressed)))
+        out.append("static const uint8_t WEB_UI_%s[] PROGMEM = {" % symbol)
+        out.append(c_array(compressed))
+        out.append("};")
+        out.append("")
+        table.append('    {"%s", "%s", WEB_UI_%s, sizeof(WEB_UI_%s), "%s"},'
+                     % (path, content_type, symbol, symbol, etag))
+
+    out.append("static const WebAsset WEB_UI_ASSETS[] = {")
+    out.extend(table)
+    out.append("};")
+    out.append("")
+    out.append("#endif")
+    out.append("")
+    text = "\n".join(out)
+
+    # Leave the file alone when nothing changed so it does not force a rebuild
+    target = os.path.join(project_dir, OUTPUT)
+    if os.path.exists(target):
+        with open(target) as f:
+            if f.read() == text:
+                return
+    os.makedirs(os.path.dirname(target), exist_ok=True)
+    with open(target, "w") as f:
+        f.write(text)
+    print("embed_web_ui: wrote %s" % OUTPUT)
+
+
+try:
+    Import("env")  # noqa: F821, provided by PlatformIO
+    generate(env.subst("$PROJECT_DIR"))  # noqa: F821
+except NameError:
+    if __name__ == "__main__":
+        generate(os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))